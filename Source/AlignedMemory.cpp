@@ -11,27 +11,245 @@
 #include <Windows.h>
 #else
 #include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #endif
 
+#include <atomic>
+#include <iostream>
+#include <limits>
+
+#include "BufferPool.h"
+
 #include "AlignedMemory.h"
 
+namespace
+{
+  std::atomic<unsigned int> defaultPolicy(0);
+  std::atomic<std::uint64_t> normalPages(0);
+  std::atomic<std::uint64_t> transparentHugePages(0);
+  std::atomic<std::uint64_t> explicitHugePages(0);
+  std::atomic<std::uint64_t> nodeBound(0);
+  std::atomic<std::uint64_t> interleaved(0);
+  std::atomic<std::uint64_t> placementFailures(0);
+
+#ifndef _WIN32
+  /**
+   * @brief Determines whether transparent huge pages can be enabled by madvise.
+   * @return Whether the kernel honors MADV_HUGEPAGE.
+   */
+  bool transparentHugePagesAvailable()
+  {
+    std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string setting;
+    return std::getline(file, setting) && setting.find("[never]") == std::string::npos;
+  }
+
+  /**
+   * @brief Determines the mask of online NUMA nodes.
+   * @return A bit mask in which the bit of each online node is set.
+   */
+  unsigned long onlineNodes()
+  {
+    // The file contains a list of ranges like "0-3,6".
+    std::ifstream file("/sys/devices/system/node/online");
+    unsigned long mask = 0;
+    unsigned int first, last;
+    char separator;
+    while(file >> first)
+    {
+      last = first;
+      if(file.peek() == '-')
+        file >> separator >> last;
+      for(unsigned int node = first; node <= last && node < sizeof(mask) * 8; node++)
+        mask |= 1ul << node;
+      if(!(file >> separator))
+        break;
+    }
+    return mask != 0 ? mask : 1;
+  }
+
+  /**
+   * @brief Sets the NUMA memory policy of a range of pages that have not been touched yet.
+   * @param addr The start of the range.
+   * @param length The length of the range.
+   * @param mode The policy (MPOL_*).
+   * @param mask The nodes that are used by the policy.
+   * @return Whether the policy could be set.
+   */
+  bool bindMemory(void* addr, std::size_t length, int mode, unsigned long mask)
+  {
+#ifdef SYS_mbind
+    // The kernel only reads maxnode - 1 bits (like numactl, one is added so that the highest node is not dropped).
+    return syscall(SYS_mbind, addr, length, mode, &mask, sizeof(mask) * 8 + 1, 0) == 0;
+#else
+    static_cast<void>(addr);
+    static_cast<void>(length);
+    static_cast<void>(mode);
+    static_cast<void>(mask);
+    return false;
+#endif
+  }
+#endif
+}
+
 void* AlignedMemory::alloc(std::size_t size, std::size_t alignment)
 {
+  return alloc(size, alignment, getDefaultPolicy());
+}
+
+void* AlignedMemory::alloc(std::size_t size, std::size_t alignment, const MemoryPolicy& policy)
+{
+  if(alignment <= BufferPool::maxAlignment)
+    return BufferPool::acquire(size, policy);
+  return allocSystem(size, alignment, noSizeClass, encode(policy, size));
+}
+
+void AlignedMemory::free(void* ptr)
+{
+  if(ptr == nullptr)
+    return;
+  if(header(ptr).sizeClass != noSizeClass)
+    BufferPool::release(ptr);
+  else
+    freeSystem(ptr);
+}
+
+void AlignedMemory::setDefaultPolicy(const MemoryPolicy& policy)
+{
+  defaultPolicy = encode(policy, largeAllocationSize);
+}
+
+MemoryPolicy AlignedMemory::getDefaultPolicy()
+{
+  const unsigned int policy = defaultPolicy;
+  MemoryPolicy result;
+  result.pages = static_cast<PageMode>(policy & 3);
+  result.placement = static_cast<NumaPlacement>((policy >> 2) & 3);
+  result.node = policy >> 4;
+  return result;
+}
+
+AlignedMemory::Statistics AlignedMemory::getStatistics()
+{
+  return {normalPages, transparentHugePages, explicitHugePages, nodeBound, interleaved, placementFailures};
+}
+
+void AlignedMemory::printStats()
+{
+  const Statistics statistics = getStatistics();
+  std::cout << "Large allocations:\n";
+  std::cout << "  " << statistics.normalPages << " with normal pages, " << statistics.transparentHugePages << " with transparent huge pages, " << statistics.explicitHugePages << " with explicit huge pages.\n";
+  std::cout << "  " << statistics.nodeBound << " placed on a node, " << statistics.interleaved << " interleaved, " << statistics.placementFailures << " placement failures.\n";
+}
+
+unsigned int AlignedMemory::encode(const MemoryPolicy& policy, std::size_t size)
+{
+  if(size < largeAllocationSize)
+    return 0;
+  return static_cast<unsigned int>(policy.pages) | (static_cast<unsigned int>(policy.placement) << 2) | (policy.placement == NumaPlacement::node ? policy.node << 4 : 0);
+}
+
+void* AlignedMemory::allocSystem(std::size_t size, std::size_t alignment, unsigned int sizeClass, unsigned int policy)
+{
+  // The header occupies a whole alignment unit in front of the returned pointer so that the pointer stays aligned.
+  const std::size_t offset = (sizeof(Header) + alignment - 1) / alignment * alignment;
+  // The sizes that are allocated below must not overflow.
+  if(size > std::numeric_limits<std::size_t>::max() - offset - largeAllocationSize)
+    return nullptr;
+  std::size_t mapped = 0;
+  void* base = nullptr;
+  if(policy != 0)
+  {
+    mapped = (offset + size + largeAllocationSize - 1) / largeAllocationSize * largeAllocationSize;
+    if((base = map(mapped, policy)) == nullptr)
+      return nullptr;
+  }
+  else
+  {
+    if(size >= largeAllocationSize)
+      normalPages++;
 #ifdef _WIN32
-  return _aligned_malloc(size, alignment);
+    if((base = _aligned_malloc(offset + size, alignment)) == nullptr)
+      return nullptr;
 #else
-  void* ptr;
-  if(posix_memalign(&ptr, alignment, size) != 0)
-    return nullptr;
+    if(posix_memalign(&base, alignment < sizeof(void*) ? sizeof(void*) : alignment, offset + size) != 0)
+      return nullptr;
+#endif
+  }
+  void* ptr = static_cast<char*>(base) + offset;
+  header(ptr) = {base, size, mapped, sizeClass, policy};
   return ptr;
+}
+
+void* AlignedMemory::map(std::size_t length, unsigned int policy)
+{
+#ifdef _WIN32
+  // Large pages need special privileges on Windows, so the system allocator is used (which also keeps the placement).
+  normalPages++;
+  return _aligned_malloc(length, largeAllocationSize);
+#else
+  const PageMode pages = static_cast<PageMode>(policy & 3);
+  const NumaPlacement placement = static_cast<NumaPlacement>((policy >> 2) & 3);
+  void* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if(pages == PageMode::explicitHuge && (base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)) != MAP_FAILED)
+    explicitHugePages++;
+#endif
+  if(base == MAP_FAILED)
+  {
+    // Transparent huge pages need a mapping that is aligned to the huge page size, so the excess is unmapped again.
+    char* region = static_cast<char*>(mmap(nullptr, length + largeAllocationSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(region == MAP_FAILED)
+      return nullptr;
+    char* aligned = region + (largeAllocationSize - reinterpret_cast<std::uintptr_t>(region) % largeAllocationSize) % largeAllocationSize;
+    if(aligned != region)
+      munmap(region, aligned - region);
+    munmap(aligned + length, region + largeAllocationSize - aligned);
+    base = aligned;
+
+    static const bool transparentHugePagesEnabled = transparentHugePagesAvailable();
+#ifdef MADV_HUGEPAGE
+    if(pages != PageMode::normal && transparentHugePagesEnabled && madvise(base, length, MADV_HUGEPAGE) == 0)
+      transparentHugePages++;
+    else
+#endif
+      normalPages++;
+  }
+
+  // The policy must be set before the pages are touched for the first time.
+  if(placement == NumaPlacement::node)
+  {
+    const unsigned int node = policy >> 4;
+    if(node < sizeof(unsigned long) * 8 && bindMemory(base, length, 1 /* MPOL_PREFERRED */, 1ul << node))
+      nodeBound++;
+    else
+      placementFailures++;
+  }
+  else if(placement == NumaPlacement::interleave)
+  {
+    static const unsigned long nodes = onlineNodes();
+    if(bindMemory(base, length, 3 /* MPOL_INTERLEAVE */, nodes))
+      interleaved++;
+    else
+      placementFailures++;
+  }
+  return base;
 #endif
 }
 
-void AlignedMemory::free(void* ptr)
+void AlignedMemory::freeSystem(void* ptr)
 {
+  const Header& h = header(ptr);
 #ifdef _WIN32
-  _aligned_free(ptr);
+  _aligned_free(h.base);
 #else
-  std::free(ptr);
+  if(h.mapped != 0)
+    munmap(h.base, h.mapped);
+  else
+    std::free(h.base);
 #endif
 }
@@ -8,14 +8,66 @@
 
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
 
+/**
+ * @brief This enum enumerates the kinds of pages that can back large allocations.
+ */
+enum class PageMode
+{
+  normal,          ///< Regular pages of the system allocator are used.
+  transparentHuge, ///< The kernel is advised to use transparent huge pages (madvise).
+  explicitHuge,    ///< Pages from the explicit huge page pool are used (MAP_HUGETLB), falling back to transparent huge pages.
+  numOfPageModes   ///< The number of page modes.
+};
+
+/**
+ * @brief This enum enumerates the ways in which large allocations can be placed on NUMA nodes.
+ */
+enum class NumaPlacement
+{
+  local,              ///< The pages are placed by the default policy of the kernel (usually the node that touches them first).
+  node,               ///< The pages are preferably placed on a given node.
+  interleave,         ///< The pages are interleaved over all online nodes.
+  numOfNumaPlacements ///< The number of NUMA placements.
+};
+
+/**
+ * @brief This struct describes how large allocations should be backed and placed.
+ */
+struct MemoryPolicy
+{
+  PageMode pages = PageMode::normal;               ///< The kind of pages.
+  NumaPlacement placement = NumaPlacement::local;  ///< The placement on NUMA nodes.
+  unsigned int node = 0;                           ///< The node if the placement is NumaPlacement::node.
+};
+
 /**
  * @brief This class provides function to allocate and free aligned memory.
+ *
+ * Blocks with an alignment of at most BufferPool::maxAlignment are recycled by the BufferPool,
+ * so repeatedly allocating buffers of similar sizes does not reach the system allocator.
+ * Blocks of at least largeAllocationSize bytes are allocated according to a MemoryPolicy.
  */
 class AlignedMemory
 {
 public:
+  static constexpr std::size_t largeAllocationSize = std::size_t(2) << 20; ///< The size from which on memory policies are applied (one huge page).
+
+  /**
+   * @brief This struct contains counters about the policies that large allocations actually obtained from the system.
+   */
+  struct Statistics
+  {
+    std::uint64_t normalPages;          ///< The number of large allocations that are backed by regular pages.
+    std::uint64_t transparentHugePages; ///< The number of large allocations for which transparent huge pages have been enabled.
+    std::uint64_t explicitHugePages;    ///< The number of large allocations that are backed by explicit huge pages.
+    std::uint64_t nodeBound;            ///< The number of large allocations that have been placed on a specific NUMA node.
+    std::uint64_t interleaved;          ///< The number of large allocations that have been interleaved over NUMA nodes.
+    std::uint64_t placementFailures;    ///< The number of large allocations for which the requested NUMA placement failed.
+  };
+
   /**
    * @brief Allocates memory that has a specific alignment.
    * @param size The size of the requested memory.
@@ -23,9 +75,90 @@ public:
    * @return A pointer to the allocated memory.
    */
   static void* alloc(std::size_t size, std::size_t alignment);
+  /**
+   * @brief Allocates memory that has a specific alignment.
+   * @param size The size of the requested memory.
+   * @param alignment The resulting address must be a multiple of this.
+   * @param policy How the memory should be backed and placed (if it is large).
+   * @return A pointer to the allocated memory.
+   */
+  static void* alloc(std::size_t size, std::size_t alignment, const MemoryPolicy& policy);
   /**
    * @brief Frees memory that has been allocated with alloc.
    * @param A pointer to the memory that shall be freed.
    */
   static void free(void* ptr);
+  /**
+   * @brief Sets the policy that is used by allocations that do not specify one.
+   * @param policy The new default policy.
+   */
+  static void setDefaultPolicy(const MemoryPolicy& policy);
+  /**
+   * @brief Returns the policy that is used by allocations that do not specify one.
+   * @return The default policy.
+   */
+  static MemoryPolicy getDefaultPolicy();
+  /**
+   * @brief Returns the current statistics.
+   * @return The statistics.
+   */
+  static Statistics getStatistics();
+  /**
+   * @brief Prints the current statistics.
+   */
+  static void printStats();
+private:
+  /**
+   * @brief This struct describes a block of memory. It is stored directly in front of the pointer returned by alloc.
+   */
+  struct Header
+  {
+    void* base;             ///< The address that has been returned by the system allocator.
+    std::size_t size;       ///< The number of usable bytes behind the header.
+    std::size_t mapped;     ///< The length of the mapping if the block has been mapped directly (0 otherwise).
+    unsigned int sizeClass; ///< The size class in the BufferPool or noSizeClass if the block is not pooled.
+    unsigned int policy;    ///< The encoded policy with which the block has been requested.
+  };
+
+  static constexpr unsigned int noSizeClass = ~0u; ///< The size class of blocks that bypass the BufferPool.
+
+  /**
+   * @brief Encodes a policy as an integer which is 0 for the default behavior of the system allocator.
+   * @param policy The policy.
+   * @param size The size of the allocation (policies are only applied to large allocations).
+   * @return The encoded policy.
+   */
+  static unsigned int encode(const MemoryPolicy& policy, std::size_t size);
+  /**
+   * @brief Allocates a block from the system and places a header in front of it.
+   * @param size The number of usable bytes.
+   * @param alignment The resulting address must be a multiple of this.
+   * @param sizeClass The size class that is stored in the header.
+   * @param policy The encoded policy.
+   * @return A pointer to the usable memory (behind the header).
+   */
+  static void* allocSystem(std::size_t size, std::size_t alignment, unsigned int sizeClass, unsigned int policy);
+  /**
+   * @brief Maps a block directly according to a policy.
+   * @param length The length of the mapping.
+   * @param policy The encoded policy.
+   * @return The start of the mapping or nullptr if the mapping failed.
+   */
+  static void* map(std::size_t length, unsigned int policy);
+  /**
+   * @brief Returns a block that has been allocated with allocSystem to the system.
+   * @param ptr A pointer to the usable memory (behind the header).
+   */
+  static void freeSystem(void* ptr);
+  /**
+   * @brief Accesses the header of a block.
+   * @param ptr A pointer to the usable memory (behind the header).
+   * @return The header of the block.
+   */
+  static Header& header(void* ptr)
+  {
+    return *(static_cast<Header*>(ptr) - 1);
+  }
+
+  friend class BufferPool;
 };
@@ -6,173 +6,128 @@
  * @author Arne Hasselbring
  */
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
-#include <cstring>
-#include <stdexcept>
+#include <memory>
 
-#include "AlignedMemory.h"
+#include "Avg5Kernels.h"
+#include "CPUFeatures.h"
 #include "Chronometer.h"
 #include "Image.h"
 #include "SIMD.h"
+#include "ThreadPool.h"
 
 #include "Avg5.h"
 
-Avg5::Avg5(OptimizationLevel optimizationLevel) :
-  optimizationLevel(optimizationLevel)
+// The vectorized kernels are compiled with their instruction sets in KernelsSSE4.cpp, KernelsAVX2.cpp and KernelsAVX512.cpp.
+INSTANTIATE_AVG5_KERNELS(extern, true, false, false);
+INSTANTIATE_AVG5_KERNELS(extern, true, true, false);
+INSTANTIATE_AVG5_KERNELS(extern, true, true, true);
+
+Avg5::Avg5(OptimizationLevel optimizationLevel, StorePolicy storePolicy, unsigned int threads, unsigned int iterations) :
+  optimizationLevel(CPUFeatures::resolve(optimizationLevel)),
+  storePolicy(storePolicy),
+  threads(threads > 0 ? threads : ThreadPool::getHardwareThreads()),
+  iterations(std::max(1u, iterations))
 {
 }
 
-Image Avg5::apply(const Image& image)
+Image Avg5::apply(const ImageView& image)
 {
   switch (optimizationLevel)
   {
     case OptimizationLevel::sse4:
-      return applyT<true, false>(image);
+      return applyT<true, false, false>(image, storePolicy, threads, iterations);
+    case OptimizationLevel::avx512:
+      return applyT<true, true, true>(image, storePolicy, threads, iterations);
     case OptimizationLevel::avx2:
-      return applyT<true, true>(image);
+      return applyT<true, true, false>(image, storePolicy, threads, iterations);
     case OptimizationLevel::noOptimization:
     default:
-      return applyT<false, false>(image);
+      return applyT<false, false, false>(image, storePolicy, threads, iterations);
   }
 }
 
-template<bool simd, bool avx>
-Image Avg5::applyT(const Image& image)
+template<bool simd, bool avx, bool avx512>
+Image Avg5::applyT(const ImageView& image, StorePolicy storePolicy, unsigned int threads, unsigned int iterations)
 {
-  Chronometer time(simd ? (avx ? "Avg5::applyT<true, true>" : "Avg5::applyT<true, false>") : "Avg5::applyT<false, false>");
+  // The kernels read the neighbors of the border pixels from a halo of zeros and the vectorized loops need aligned rows.
+  if(image.halo == 0 || image.border != BorderPolicy::zero || (simd && !image.aligned))
+    return applyT<simd, avx, avx512>(Image(image, 1, BorderPolicy::zero), storePolicy, threads, iterations);
 
-  if(!image.aligned)
-    throw std::runtime_error("Image must be aligned!");
+  Chronometer time(simd ? (avx ? (avx512 ? "Avg5::applyT<true, true, true>" : "Avg5::applyT<true, true, false>") : "Avg5::applyT<true, false, false>") : "Avg5::applyT<false, false, false>");
 
-  Image result(image.width, image.height, true);
+  // The pages of the result are placed by the default MemoryPolicy. Blocks that are recycled by the BufferPool have been
+  // touched before, so the bands cannot rely on placing them on their NUMA node by first touch.
+  Image result(image.width, image.height, true, 1);
 
-  std::uint8_t* zerow = static_cast<std::uint8_t*>(AlignedMemory::alloc(image.width, 32));
-  if(zerow == nullptr)
-    throw std::runtime_error("Could not allocate aligned memory!");
-  std::memset(zerow, 0, image.width);
+  const unsigned int bands = std::max(1u, std::min(threads, image.height));
 
-  if(simd)
-  {
-    if(avx)
-    {
-      __m256i factor = _mm256_set1_epi16((1 << 16) / 5 + 2);
+  // A result that fits into the cache together with the image is written through it, because the next filter reads it.
+  const bool streaming = CPUFeatures::resolve(storePolicy, 2 * static_cast<std::size_t>(result.stride) * result.height, bands) == StorePolicy::streaming;
 
-      const __m256i* srcRow =  reinterpret_cast<const __m256i*>(image[0]);
-      __m256i* dstRow = reinterpret_cast<__m256i*>(result[0]);
+  // Each band keeps the last three rows of every intermediate iteration, which stay in the cache.
+  std::unique_ptr<Image> rings;
+  if(iterations > 1)
+  {
+    rings.reset(new Image(image.width, bands * 3 * (iterations - 1), true, 1));
+    rings->fillBorder(BorderPolicy::zero);
+  }
 
-      for(unsigned int y = 0; y < image.height; y++)
-      {
-        const __m256i* prevRow = reinterpret_cast<const __m256i*>(y > 0 ? image[y - 1] : zerow);
-        const __m256i* const srcRowEnd = reinterpret_cast<const __m256i*>(image[y + 1]);
-        const __m256i* nextRow = reinterpret_cast<const __m256i*>(y < image.height - 1 ? image[y + 1] : zerow);
-
-        __m256i src = _mm256_load_si256(srcRow);
-        __m256i nextSrc;
-        __m256i lastSrc = _mm256_setzero_si256();
-        while(srcRow != srcRowEnd)
-        {
-          nextSrc = (++srcRow != srcRowEnd) ? _mm256_load_si256(srcRow) : _mm256_setzero_si256();
-          __m256i above = _mm256_load_si256(prevRow++);
-          __m256i mid = src;
-          __m256i below = _mm256_load_si256(nextRow++);
-          __m256i left = _mm256_alignr_epi8(src, _mm256_permute2x128_si256(src, lastSrc, (0 << 4) | 3), 15);
-          __m256i right = _mm256_alignr_epi8(_mm256_permute2x128_si256(src, nextSrc, (2 << 4) | 1), src, 1);
-          lastSrc = src;
-          src = nextSrc;
-
-          // This is actually a different order than one might expect due to unpack not being per 128-bit lane.
-          // This effect is however reversed by the fact that pack works in same way.
-          __m256i above1 = _mm256_unpacklo_epi8(above, _mm256_setzero_si256());
-          __m256i mid1 = _mm256_unpacklo_epi8(mid, _mm256_setzero_si256());
-          __m256i below1 = _mm256_unpacklo_epi8(below, _mm256_setzero_si256());
-          __m256i left1 = _mm256_unpacklo_epi8(left, _mm256_setzero_si256());
-          __m256i right1 = _mm256_unpacklo_epi8(right, _mm256_setzero_si256());
-
-          __m256i result1 = _mm256_add_epi16(_mm256_add_epi16(_mm256_add_epi16(above1, below1), _mm256_add_epi16(left1, right1)), mid1);
-
-          __m256i above2 = _mm256_unpackhi_epi8(above, _mm256_setzero_si256());
-          __m256i mid2 = _mm256_unpackhi_epi8(mid, _mm256_setzero_si256());
-          __m256i below2 = _mm256_unpackhi_epi8(below, _mm256_setzero_si256());
-          __m256i left2 = _mm256_unpackhi_epi8(left, _mm256_setzero_si256());
-          __m256i right2 = _mm256_unpackhi_epi8(right, _mm256_setzero_si256());
-
-          __m256i result2 = _mm256_add_epi16(_mm256_add_epi16(_mm256_add_epi16(above2, below2), _mm256_add_epi16(left2, right2)), mid2);
-
-          __m256i result = _mm256_packus_epi16(_mm256_mulhi_epu16(result1, factor), _mm256_mulhi_epu16(result2, factor));
-          _mm256_stream_si256(dstRow, result);
-          dstRow++;
-        }
-      }
+  ThreadPool::run(bands, [&](unsigned int band)
+  {
+    const unsigned int yBegin = band * image.height / bands;
+    const unsigned int yEnd = (band + 1) * image.height / bands;
+    const unsigned int ringBegin = band * 3 * (iterations - 1);
+    if(streaming)
+    {
+      averageBand<simd, avx, avx512, true>(image, result, rings.get(), ringBegin, iterations, yBegin, yEnd);
+      // The streaming stores must be visible to the thread that continues with the result.
+      _mm_sfence();
     }
     else
-    {
-      __m128i factor = _mm_set1_epi16((1 << 16) / 5 + 2);
+      averageBand<simd, avx, avx512, false>(image, result, rings.get(), ringBegin, iterations, yBegin, yEnd);
+  });
 
-      const __m128i* srcRow =  reinterpret_cast<const __m128i*>(image[0]);
-      __m128i* dstRow = reinterpret_cast<__m128i*>(result[0]);
+  // The result can be passed to the next filter without copying it.
+  result.fillBorder(BorderPolicy::zero);
 
-      for(unsigned int y = 0; y < image.height; y++)
-      {
-        const __m128i* prevRow = reinterpret_cast<const __m128i*>(y > 0 ? image[y - 1] : zerow);
-        const __m128i* const srcRowEnd =  reinterpret_cast<const __m128i*>(image[y] + image.width);
-        const __m128i* nextRow = reinterpret_cast<const __m128i*>(y < image.height - 1 ? image[y + 1] : zerow);
-
-        __m128i src = _mm_load_si128(srcRow);
-        __m128i nextSrc;
-        __m128i lastSrc = _mm_setzero_si128();
-        while(srcRow != srcRowEnd)
-        {
-          nextSrc = (++srcRow != srcRowEnd) ? _mm_load_si128(srcRow) : _mm_setzero_si128();
-          __m128i above = _mm_load_si128(prevRow++);
-          __m128i mid = src;
-          __m128i below = _mm_load_si128(nextRow++);
-          __m128i left = _mm_alignr_epi8(src, lastSrc, 15);
-          __m128i right = _mm_alignr_epi8(nextSrc, src, 1);
-          lastSrc = src;
-          src = nextSrc;
-
-          __m128i above1 = _mm_unpacklo_epi8(above, _mm_setzero_si128());
-          __m128i mid1 = _mm_unpacklo_epi8(mid, _mm_setzero_si128());
-          __m128i below1 = _mm_unpacklo_epi8(below, _mm_setzero_si128());
-          __m128i left1 = _mm_unpacklo_epi8(left, _mm_setzero_si128());
-          __m128i right1 = _mm_unpacklo_epi8(right, _mm_setzero_si128());
-
-          __m128i result1 = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(above1, below1), _mm_add_epi16(left1, right1)), mid1);
-
-          __m128i above2 = _mm_unpackhi_epi8(above, _mm_setzero_si128());
-          __m128i mid2 = _mm_unpackhi_epi8(mid, _mm_setzero_si128());
-          __m128i below2 = _mm_unpackhi_epi8(below, _mm_setzero_si128());
-          __m128i left2 = _mm_unpackhi_epi8(left, _mm_setzero_si128());
-          __m128i right2 = _mm_unpackhi_epi8(right, _mm_setzero_si128());
-
-          __m128i result2 = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(above2, below2), _mm_add_epi16(left2, right2)), mid2);
-
-          __m128i result = _mm_packus_epi16(_mm_mulhi_epu16(result1, factor), _mm_mulhi_epu16(result2, factor));
-          _mm_stream_si128(dstRow, result);
-          dstRow++;
-        }
-      }
-    }
-  }
-  else
+  return result;
+}
+
+template<bool simd, bool avx, bool avx512, bool streaming>
+void Avg5::averageBand(const ImageView& image, Image& result, Image* rings, unsigned int ringBegin, unsigned int iterations, unsigned int yBegin, unsigned int yEnd)
+{
+  const int height = static_cast<int>(image.height);
+  const int last = static_cast<int>(iterations) - 1;
+
+  // Returns a row after the given number of iterations (the halo of the image is zero after every iteration).
+  const auto row = [&](int iteration, int y) -> const std::uint8_t*
   {
-    for(unsigned int y = 0; y < image.height; y++)
+    if(y < 0 || y >= height)
+      return image[-1];
+    return iteration == 0 ? image[y] : (*rings)[ringBegin + (iteration - 1) * 3 + y % 3];
+  };
+
+  // Iteration i + 1 computes the rows of the band and last - i rows above and below it, which the later iterations read.
+  // It lags i rows behind the first iteration, so the three rows that it reads from the previous iteration are available.
+  const int stepBegin = std::max(0, static_cast<int>(yBegin) - last);
+  const int stepEnd = static_cast<int>(yEnd) + last;
+  for(int step = stepBegin; step < stepEnd; step++)
+    for(int i = 0; i <= last; i++)
     {
-      const std::uint8_t* prevRow = y > 0 ? image[y - 1] : zerow;
-      const std::uint8_t* srcRow =  image[y];
-      const std::uint8_t* nextRow = y < image.height - 1 ? image[y + 1] : zerow;
-      std::uint8_t* dstRow = result[y];
-
-      dstRow[0] = (srcRow[0] + srcRow[1] + prevRow[0] + nextRow[0]) / 5;
-      for(unsigned int x = 1; x < image.width - 1; x++)
+      const int y = step - i;
+      if(y < std::max(0, static_cast<int>(yBegin) - (last - i)) || y >= std::min(height, static_cast<int>(yEnd) + (last - i)))
+        continue;
+      if(i == last)
+        averageRow<simd, avx, avx512, streaming>(row(i, y - 1), row(i, y), row(i, y + 1), result[y], image.width);
+      else
       {
-        dstRow[x] = (srcRow[x - 1] + srcRow[x] + srcRow[x + 1] + prevRow[x] + nextRow[x]) / 5;
+        // The intermediate rows are read again soon and the vectorized kernels overwrite their right halo.
+        std::uint8_t* ringRow = (*rings)[ringBegin + i * 3 + y % 3];
+        averageRow<simd, avx, avx512, false>(row(i, y - 1), row(i, y), row(i, y + 1), ringRow, image.width);
+        ringRow[image.width] = 0;
       }
-      dstRow[image.width - 1] = (srcRow[image.width - 2] + srcRow[image.width - 1] + prevRow[image.width - 1] + nextRow[image.width - 1]) / 5;
     }
-  }
-
-  AlignedMemory::free(zerow);
-
-  return result;
 }
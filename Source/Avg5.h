@@ -8,10 +8,11 @@
 
 #pragma once
 
+#include <cstdint>
+
 #include "Operator.h"
 #include "OptimizationLevel.h"
-
-class Image;
+#include "StorePolicy.h"
 
 /**
  * @brief This class implements a denoising filter that takes the average of a pixel and its four neighbors.
@@ -22,23 +23,66 @@ public:
   /**
    * @brief Constructs a filter.
    * @param optimizationLevel The kind of optimization that should be used.
+   * @param storePolicy Whether the vectorized kernels write the result with non-temporal stores.
+   * @param threads The number of threads that process horizontal bands of the image (0 means one per hardware thread).
+   * @param iterations How often the average is applied (the result equals as many calls of apply, but the intermediate images are never stored).
    */
-  Avg5(OptimizationLevel optimizationLevel = OptimizationLevel::noOptimization);
+  Avg5(OptimizationLevel optimizationLevel = OptimizationLevel::noOptimization, StorePolicy storePolicy = StorePolicy::automatic, unsigned int threads = 1, unsigned int iterations = 1);
   /**
    * @brief Denoises an image.
    * @param image The image that is denoised.
    * @return A denoised image.
    */
-  Image apply(const Image& image) override;
+  Image apply(const ImageView& image) override;
 private:
   /**
    * @brief Denoises an image.
    * @tparam simd Whether SIMD instructions should be used.
    * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
    * @param image The image that is denoised.
+   * @param storePolicy Whether the vectorized kernels write the result with non-temporal stores.
+   * @param threads The number of threads that process horizontal bands of the image.
+   * @param iterations How often the average is applied.
    * @return A denoised image.
    */
-  template<bool simd, bool avx>
-  static Image applyT(const Image& image);
+  template<bool simd, bool avx, bool avx512>
+  static Image applyT(const ImageView& image, StorePolicy storePolicy, unsigned int threads, unsigned int iterations);
+  /**
+   * @brief Applies several iterations of the average to a band of rows.
+   *
+   * The iterations advance together row by row, so each intermediate iteration only keeps the three rows
+   * that the next iteration still reads. The band recomputes the intermediate rows of its neighbors it depends on.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @tparam streaming Whether the result is written with non-temporal stores (because it is not read again soon).
+   * @param image The image that is denoised (aligned, with a halo of zeros).
+   * @param result The denoised image (aligned, its halo is not filled).
+   * @param rings The rows of the intermediate iterations (aligned, with a halo of zeros, nullptr for a single iteration).
+   * @param ringBegin The first of the three rows per intermediate iteration that belong to this band.
+   * @param iterations How often the average is applied.
+   * @param yBegin The first row of the band.
+   * @param yEnd The end of the band (exclusive).
+   */
+  template<bool simd, bool avx, bool avx512, bool streaming>
+  static void averageBand(const ImageView& image, Image& result, Image* rings, unsigned int ringBegin, unsigned int iterations, unsigned int yBegin, unsigned int yEnd);
+  /**
+   * @brief Computes the average of each pixel of a row and its neighbors.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @tparam streaming Whether the result is written with non-temporal stores (because it is not read again soon).
+   * @param prevRow The row above (aligned).
+   * @param srcRow The row that is denoised (aligned, with a pixel of zero on either side).
+   * @param nextRow The row below (aligned).
+   * @param dstRow The denoised row (aligned, the vectorized kernels may overwrite the pixel after it).
+   * @param width The number of pixels in a row.
+   */
+  template<bool simd, bool avx, bool avx512, bool streaming>
+  static void averageRow(const std::uint8_t* prevRow, const std::uint8_t* srcRow, const std::uint8_t* nextRow, std::uint8_t* dstRow, unsigned int width);
   OptimizationLevel optimizationLevel; ///< The kind of optimization that should be used.
+  StorePolicy storePolicy;             ///< Whether the vectorized kernels write the result with non-temporal stores.
+  unsigned int threads;                ///< The number of threads that process horizontal bands of the image.
+  unsigned int iterations;             ///< How often the average is applied.
 };
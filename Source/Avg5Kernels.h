@@ -0,0 +1,32 @@
+/**
+ * @file Avg5Kernels.h
+ *
+ * This file implements the kernels of the Avg5 class, which are compiled once per instruction set.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "Stencil.h"
+
+#include "Avg5.h"
+
+/**
+ * @brief Instantiates the kernels of the Avg5 class for an instruction set.
+ * @param prefix Nothing to instantiate them or extern to declare that they are instantiated elsewhere.
+ */
+#define INSTANTIATE_AVG5_KERNELS(prefix, simd, avx, avx512) \
+  prefix template void Avg5::averageRow<simd, avx, avx512, false>(const std::uint8_t*, const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int); \
+  prefix template void Avg5::averageRow<simd, avx, avx512, true>(const std::uint8_t*, const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int)
+
+using Avg5Stencil = Stencil<5, 0, 1, 0, 1, 1, 1, 0, 1, 0>; ///< A pixel and its four neighbors with equal weights.
+
+template<bool simd, bool avx, bool avx512, bool streaming>
+void Avg5::averageRow(const std::uint8_t* prevRow, const std::uint8_t* srcRow, const std::uint8_t* nextRow, std::uint8_t* dstRow, unsigned int width)
+{
+  const std::uint8_t* rows[] = {prevRow, srcRow, nextRow};
+  Avg5Stencil::apply<simd, avx, avx512, streaming>(rows, dstRow, width);
+}
@@ -0,0 +1,142 @@
+/**
+ * @file BufferPool.cpp
+ *
+ * This file implements the BufferPool class.
+ *
+ * @author Arne Hasselbring
+ */
+
+#include <atomic>
+#include <iostream>
+
+#include "AlignedMemory.h"
+
+#include "BufferPool.h"
+
+namespace
+{
+  std::atomic<std::size_t> capacity(BufferPool::defaultCapacity);
+  std::atomic<std::uint64_t> requests(0);
+  std::atomic<std::uint64_t> hits(0);
+  std::atomic<std::uint64_t> misses(0);
+  std::atomic<std::uint64_t> evictions(0);
+  std::atomic<std::uint64_t> cachedBytes(0);
+}
+
+constexpr std::size_t BufferPool::maxAlignment;
+constexpr std::size_t BufferPool::defaultCapacity;
+constexpr std::size_t BufferPool::maxPooledSize;
+
+thread_local BufferPool::FreeLists BufferPool::freeLists;
+
+BufferPool::FreeLists::~FreeLists()
+{
+  drain(*this);
+}
+
+void BufferPool::setCapacity(std::size_t bytes)
+{
+  capacity = bytes;
+}
+
+std::size_t BufferPool::getCapacity()
+{
+  return capacity;
+}
+
+BufferPool::Statistics BufferPool::getStatistics()
+{
+  return {requests, hits, misses, evictions, cachedBytes};
+}
+
+void BufferPool::printStats()
+{
+  const Statistics statistics = getStatistics();
+  std::cout << "Buffer pool:\n";
+  std::cout << "  " << statistics.requests << " requests, " << statistics.hits << " hits, " << statistics.misses << " system allocations, " << statistics.evictions << " evictions.\n";
+  std::cout << "  " << statistics.cachedBytes << " bytes are cached.\n";
+}
+
+void BufferPool::trim()
+{
+  drain(freeLists);
+}
+
+void* BufferPool::acquire(std::size_t size, const MemoryPolicy& policy)
+{
+  // Larger blocks are allocated directly and freed directly (they have no size class).
+  if(size > maxPooledSize)
+    return AlignedMemory::allocSystem(size, maxAlignment, AlignedMemory::noSizeClass, AlignedMemory::encode(policy, size));
+
+  const unsigned int c = sizeClass(size);
+  const unsigned int encodedPolicy = AlignedMemory::encode(policy, classSize(c));
+  requests++;
+
+  // The lists are short, so searching for a block with the same policy is cheap.
+  FreeLists& lists = freeLists;
+  for(void** link = &lists.heads[c]; *link != nullptr; link = static_cast<void**>(*link))
+  {
+    void* ptr = *link;
+    if(AlignedMemory::header(ptr).policy != encodedPolicy)
+      continue;
+    *link = *static_cast<void**>(ptr);
+    lists.cachedBytes -= classSize(c);
+    cachedBytes -= classSize(c);
+    hits++;
+    return ptr;
+  }
+
+  misses++;
+  return AlignedMemory::allocSystem(classSize(c), maxAlignment, c, encodedPolicy);
+}
+
+void BufferPool::release(void* ptr)
+{
+  const unsigned int c = AlignedMemory::header(ptr).sizeClass;
+  const std::size_t size = classSize(c);
+
+  FreeLists& lists = freeLists;
+  if(lists.cachedBytes + size > capacity)
+  {
+    evictions++;
+    AlignedMemory::freeSystem(ptr);
+    return;
+  }
+
+  *static_cast<void**>(ptr) = lists.heads[c];
+  lists.heads[c] = ptr;
+  lists.cachedBytes += size;
+  cachedBytes += size;
+}
+
+void BufferPool::drain(FreeLists& freeLists)
+{
+  for(unsigned int c = 0; c < numOfSizeClasses; c++)
+    while(freeLists.heads[c] != nullptr)
+    {
+      void* ptr = freeLists.heads[c];
+      freeLists.heads[c] = *static_cast<void**>(ptr);
+      AlignedMemory::freeSystem(ptr);
+    }
+  cachedBytes -= freeLists.cachedBytes;
+  freeLists.cachedBytes = 0;
+}
+
+unsigned int BufferPool::sizeClass(std::size_t size)
+{
+  if(size <= 64)
+    return 0;
+  // The sizes in (2^p, 2^(p+1)] are split into four classes.
+  unsigned int p = 6;
+  while(((size - 1) >> (p + 1)) != 0)
+    p++;
+  return 1 + (p - 6) * 4 + static_cast<unsigned int>(((size - 1) >> (p - 2)) & 3);
+}
+
+std::size_t BufferPool::classSize(unsigned int sizeClass)
+{
+  if(sizeClass == 0)
+    return 64;
+  const unsigned int p = 6 + (sizeClass - 1) / 4;
+  return (std::size_t(1) << p) + (static_cast<std::size_t>((sizeClass - 1) % 4 + 1) << (p - 2));
+}
@@ -0,0 +1,118 @@
+/**
+ * @file BufferPool.h
+ *
+ * This file declares the BufferPool class.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct MemoryPolicy;
+
+/**
+ * @brief This class recycles memory blocks of AlignedMemory so that steady-state processing does not allocate from the system.
+ *
+ * Requested sizes are rounded up to size classes (four classes per power of two). Released blocks are kept in free lists
+ * of the releasing thread as long as that thread caches less than the capacity, otherwise they are returned to the system.
+ * Large blocks are only handed out again for requests with the same MemoryPolicy.
+ * The free lists of a thread are returned to the system when the thread exits.
+ * By default, each thread caches up to defaultCapacity bytes (e.g. the double buffers of a few 4K images in float precision),
+ * which can be changed with setCapacity. Requests above maxPooledSize bypass the pool and are returned to the system when
+ * they are freed, because a few of them would occupy the whole capacity.
+ */
+class BufferPool
+{
+public:
+  static constexpr std::size_t maxAlignment = 64;                         ///< The largest alignment that pooled blocks satisfy.
+  static constexpr std::size_t defaultCapacity = std::size_t(128) << 20;  ///< The number of bytes that each thread keeps in its free lists by default.
+  static constexpr std::size_t maxPooledSize = std::size_t(64) << 20;     ///< The largest request that is rounded up to a size class.
+
+  /**
+   * @brief This struct contains counters about the usage of the pool (summed over all threads).
+   */
+  struct Statistics
+  {
+    std::uint64_t requests;    ///< The number of acquired blocks.
+    std::uint64_t hits;        ///< The number of blocks that could be taken from a free list.
+    std::uint64_t misses;      ///< The number of blocks that had to be allocated from the system.
+    std::uint64_t evictions;   ///< The number of released blocks that have been returned to the system.
+    std::uint64_t cachedBytes; ///< The number of bytes that are currently kept in free lists.
+  };
+
+  /**
+   * @brief Sets the maximum number of bytes that each thread keeps in its free lists.
+   * @param bytes The capacity per thread (0 disables pooling).
+   */
+  static void setCapacity(std::size_t bytes);
+  /**
+   * @brief Returns the maximum number of bytes that each thread keeps in its free lists.
+   * @return The capacity per thread.
+   */
+  static std::size_t getCapacity();
+  /**
+   * @brief Returns the current statistics.
+   * @return The statistics.
+   */
+  static Statistics getStatistics();
+  /**
+   * @brief Prints the current statistics.
+   */
+  static void printStats();
+  /**
+   * @brief Returns all blocks that are cached by the calling thread to the system.
+   */
+  static void trim();
+private:
+  static constexpr unsigned int numOfSizeClasses = 1 + 4 * (26 - 6); ///< The number of size classes (the smallest one is 64 bytes, the largest one maxPooledSize).
+
+  /**
+   * @brief This struct contains the free lists of a thread.
+   */
+  struct FreeLists
+  {
+    /**
+     * @brief Returns all cached blocks to the system.
+     */
+    ~FreeLists();
+    void* heads[numOfSizeClasses] = {}; ///< The first free block of each size class (the blocks are linked through their first bytes).
+    std::size_t cachedBytes = 0;        ///< The number of bytes in all free lists.
+  };
+
+  /**
+   * @brief Returns a block of at least a given size, preferably from the free lists of the calling thread.
+   * @param size The requested number of bytes.
+   * @param policy How the block should be backed and placed if it is allocated from the system.
+   * @return A pointer to the block (aligned to maxAlignment) or nullptr if the system is out of memory.
+   */
+  static void* acquire(std::size_t size, const MemoryPolicy& policy);
+  /**
+   * @brief Puts a block into the free lists of the calling thread or returns it to the system if the capacity is exhausted.
+   * @param ptr A pointer that has been returned by acquire.
+   */
+  static void release(void* ptr);
+  /**
+   * @brief Returns all blocks of some free lists to the system.
+   * @param freeLists The free lists that are emptied.
+   */
+  static void drain(FreeLists& freeLists);
+  /**
+   * @brief Determines the smallest size class that can hold a given number of bytes.
+   * @param size The number of bytes (at most maxPooledSize).
+   * @return The size class.
+   */
+  static unsigned int sizeClass(std::size_t size);
+  /**
+   * @brief Determines the number of bytes of the blocks in a size class.
+   * @param sizeClass The size class.
+   * @return The number of bytes.
+   */
+  static std::size_t classSize(unsigned int sizeClass);
+
+  static thread_local FreeLists freeLists; ///< The free lists of the calling thread.
+
+  friend class AlignedMemory;
+};
@@ -0,0 +1,169 @@
+/**
+ * @file CPUFeatures.cpp
+ *
+ * This file implements the CPUFeatures class.
+ *
+ * @author Arne Hasselbring
+ */
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#include "CPUFeatures.h"
+
+namespace
+{
+  /**
+   * @brief Executes the cpuid instruction.
+   * @param leaf The leaf (eax).
+   * @param subleaf The subleaf (ecx).
+   * @param registers Receives eax, ebx, ecx and edx (zeros if the leaf is not supported).
+   */
+  void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int (&registers)[4])
+  {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, static_cast<int>(leaf & 0x80000000));
+    if(static_cast<unsigned int>(info[0]) < leaf)
+      std::fill(info, info + 4, 0);
+    else
+      __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+    std::copy(info, info + 4, registers);
+#else
+    if(__get_cpuid_max(leaf & 0x80000000, nullptr) < leaf)
+      std::fill(registers, registers + 4, 0u);
+    else
+      __cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+  }
+
+  /**
+   * @brief Reads the register that tells which register states the operating system saves (XCR0).
+   * @return The value of XCR0 (must only be called if the OSXSAVE bit is set).
+   */
+  std::uint64_t xcr0()
+  {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    // The instruction is executed directly because _xgetbv would need XSAVE to be enabled for the whole file.
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<std::uint64_t>(edx) << 32) | eax;
+#endif
+  }
+}
+
+OptimizationLevel CPUFeatures::detect()
+{
+  unsigned int basic[4], extended[4];
+  cpuid(1, 0, basic);
+  cpuid(7, 0, extended);
+  const auto has = [](unsigned int reg, unsigned int bit) { return ((reg >> bit) & 1) != 0; };
+
+  // The SSE kernels use SSSE3 shuffles and POPCNT as well.
+  if(!has(basic[2], 9) || !has(basic[2], 19) || !has(basic[2], 23))
+    return OptimizationLevel::noOptimization;
+
+  // The AVX registers are only usable if the operating system saves them on context switches.
+  const bool osxsave = has(basic[2], 27);
+  const std::uint64_t states = osxsave ? xcr0() : 0;
+  if(!has(basic[2], 28) || !has(basic[2], 12) || !has(basic[2], 29) || (states & 0x6) != 0x6 ||
+     !has(extended[1], 5) || !has(extended[1], 3) || !has(extended[1], 8))
+    return OptimizationLevel::sse4;
+
+  // AVX-512 additionally needs the opmask registers and the upper halves of all 32 registers.
+  if(!has(extended[1], 16) || !has(extended[1], 30) || !has(extended[1], 31) || (states & 0xe6) != 0xe6)
+    return OptimizationLevel::avx2;
+
+  return OptimizationLevel::avx512;
+}
+
+OptimizationLevel CPUFeatures::best()
+{
+  static const OptimizationLevel level = []
+  {
+    const char* name = std::getenv("FILTERS_OPTIMIZATION_LEVEL");
+    const OptimizationLevel requested = name && *name ? parse(name) : OptimizationLevel::automatic;
+    const OptimizationLevel supported = detect();
+    return requested == OptimizationLevel::automatic ? supported : std::min(requested, supported);
+  }();
+  return level;
+}
+
+OptimizationLevel CPUFeatures::resolve(OptimizationLevel optimizationLevel)
+{
+  if(optimizationLevel == OptimizationLevel::automatic)
+    return best();
+  // Requesting a level that the CPU does not support would end with an illegal instruction.
+  static const OptimizationLevel supported = detect();
+  return std::min(optimizationLevel, supported);
+}
+
+OptimizationLevel CPUFeatures::parse(const char* name)
+{
+  if(!std::strcmp(name, "none"))
+    return OptimizationLevel::noOptimization;
+  else if(!std::strcmp(name, "sse4"))
+    return OptimizationLevel::sse4;
+  else if(!std::strcmp(name, "avx2"))
+    return OptimizationLevel::avx2;
+  else if(!std::strcmp(name, "avx512"))
+    return OptimizationLevel::avx512;
+  else if(!std::strcmp(name, "auto"))
+    return OptimizationLevel::automatic;
+  throw std::runtime_error("Unknown optimization level given!");
+}
+
+std::size_t CPUFeatures::getCacheSize()
+{
+  static const std::size_t size = []
+  {
+    unsigned int vendor[4];
+    cpuid(0, 0, vendor);
+    // The vendor string "AuthenticAMD" ends with "cAMD" in ecx.
+    const unsigned int leaf = vendor[2] == 0x444d4163 ? 0x8000001d : 4;
+    std::size_t largest = 0;
+    std::size_t share = 0;
+    for(unsigned int subleaf = 0; subleaf < 16; subleaf++)
+    {
+      unsigned int registers[4];
+      cpuid(leaf, subleaf, registers);
+      const unsigned int type = registers[0] & 0x1f;
+      if(type == 0)
+        break;
+      // Instruction caches (type 2) do not hold the images.
+      if(type == 2)
+        continue;
+      const std::size_t ways = (registers[1] >> 22) + 1;
+      const std::size_t partitions = ((registers[1] >> 12) & 0x3ff) + 1;
+      const std::size_t lineSize = (registers[1] & 0xfff) + 1;
+      const std::size_t sets = static_cast<std::size_t>(registers[2]) + 1;
+      // The other cores that share the cache evict the data of this one when they run kernels at the same time.
+      const std::size_t sharing = ((registers[0] >> 14) & 0xfff) + 1;
+      if(ways * partitions * lineSize * sets > largest)
+      {
+        largest = ways * partitions * lineSize * sets;
+        share = largest / sharing;
+      }
+    }
+    return share > 0 ? share : std::size_t(8) << 20;
+  }();
+  return size;
+}
+
+StorePolicy CPUFeatures::resolve(StorePolicy storePolicy, std::size_t workingSet, unsigned int threads)
+{
+  if(storePolicy == StorePolicy::automatic)
+    return workingSet > getCacheSize() * std::max(1u, threads) ? StorePolicy::streaming : StorePolicy::regular;
+  return storePolicy;
+}
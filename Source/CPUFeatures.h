@@ -0,0 +1,66 @@
+/**
+ * @file CPUFeatures.h
+ *
+ * This file declares the CPUFeatures class.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "OptimizationLevel.h"
+#include "StorePolicy.h"
+
+/**
+ * @brief This class determines which optimization levels the executing CPU supports and how large its caches are.
+ *
+ * Only the kernels are compiled for instruction set extensions (see KernelsSSE4.cpp, KernelsAVX2.cpp and KernelsAVX512.cpp),
+ * so the same executable runs on every x86-64 CPU and the levels have to be chosen at runtime.
+ */
+class CPUFeatures
+{
+public:
+  /**
+   * @brief Determines the highest optimization level that the CPU and the operating system support.
+   * @return The supported optimization level.
+   */
+  static OptimizationLevel detect();
+  /**
+   * @brief Determines the optimization level that OptimizationLevel::automatic stands for.
+   *
+   * This is the supported level unless the environment variable FILTERS_OPTIMIZATION_LEVEL requests a lower one
+   * (none, sse4, avx2 or avx512). The result is determined once per process.
+   * @return The best optimization level.
+   */
+  static OptimizationLevel best();
+  /**
+   * @brief Maps an optimization level to one that can be executed.
+   * @param optimizationLevel The requested optimization level.
+   * @return The best level for OptimizationLevel::automatic, otherwise the requested level limited to the supported one.
+   */
+  static OptimizationLevel resolve(OptimizationLevel optimizationLevel);
+  /**
+   * @brief Parses the name of an optimization level.
+   * @param name The name (none, sse4, avx2, avx512 or auto).
+   * @return The optimization level.
+   */
+  static OptimizationLevel parse(const char* name);
+  /**
+   * @brief Determines the share of the last level cache that a logical processor can count on.
+   *
+   * The size and the number of logical processors that share the cache are read from the deterministic cache parameters
+   * of cpuid (leaf 4 on Intel and 0x8000001d on AMD CPUs). The result is determined once per process.
+   * @return The size of the largest data or unified cache in bytes divided by the number of logical processors that share it (8 MiB if the CPU does not report it).
+   */
+  static std::size_t getCacheSize();
+  /**
+   * @brief Maps a store policy to the one that a kernel should use.
+   * @param storePolicy The requested store policy.
+   * @param workingSet The number of bytes that the kernel reads and writes (e.g. its input and output images).
+   * @param threads The number of threads that run the kernel.
+   * @return For StorePolicy::automatic streaming if the working set is larger than the cache share of the threads and regular otherwise, the requested policy otherwise.
+   */
+  static StorePolicy resolve(StorePolicy storePolicy, std::size_t workingSet, unsigned int threads);
+};
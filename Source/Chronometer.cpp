@@ -13,7 +13,24 @@
 
 #include "Chronometer.h"
 
-std::unordered_map<std::string, std::vector<double>> Chronometer::runtimes;
+thread_local Chronometer::ThreadRuntimes Chronometer::threadRuntimes;
+std::vector<Chronometer::ThreadRuntimes*> Chronometer::threads;
+Chronometer::Runtimes Chronometer::finishedRuntimes;
+std::mutex Chronometer::mutex;
+
+Chronometer::ThreadRuntimes::ThreadRuntimes()
+{
+  std::lock_guard<std::mutex> lock(Chronometer::mutex);
+  threads.push_back(this);
+}
+
+Chronometer::ThreadRuntimes::~ThreadRuntimes()
+{
+  std::lock_guard<std::mutex> lock(Chronometer::mutex);
+  threads.erase(std::find(threads.begin(), threads.end(), this));
+  for(auto& runtime : runtimes)
+    finishedRuntimes[runtime.first].insert(finishedRuntimes[runtime.first].end(), runtime.second.begin(), runtime.second.end());
+}
 
 Chronometer::Chronometer(const std::string& str) :
   str(str),
@@ -24,11 +41,22 @@ Chronometer::Chronometer(const std::string& str) :
 Chronometer::~Chronometer()
 {
   auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start);
-  runtimes[str].push_back(static_cast<double>(microseconds.count()));
+  ThreadRuntimes& own = threadRuntimes;
+  std::lock_guard<std::mutex> lock(own.mutex);
+  own.runtimes[str].push_back(static_cast<double>(microseconds.count()));
 }
 
 void Chronometer::printStats()
 {
+  std::lock_guard<std::mutex> lock(mutex);
+  Runtimes runtimes = finishedRuntimes;
+  for(ThreadRuntimes* thread : threads)
+  {
+    std::lock_guard<std::mutex> threadLock(thread->mutex);
+    for(auto& runtime : thread->runtimes)
+      runtimes[runtime.first].insert(runtimes[runtime.first].end(), runtime.second.begin(), runtime.second.end());
+  }
+
   std::cout << "Runtimes:\n";
   for(auto& runtime : runtimes)
   {
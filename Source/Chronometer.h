@@ -9,12 +9,16 @@
 #pragma once
 
 #include <chrono>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 /**
  * @brief This class is a utility for time measurements.
+ *
+ * Measurements can be taken in several threads at the same time. Each thread records its runtimes in its own lists,
+ * so that the threads do not wait for each other. printStats combines the lists of all threads.
  */
 class Chronometer final
 {
@@ -33,7 +37,29 @@ public:
    */
   static void printStats();
 private:
+  using Runtimes = std::unordered_map<std::string, std::vector<double>>; ///< Lists of runtimes by identifier.
+
+  /**
+   * @brief This struct contains the runtimes that a thread has measured.
+   */
+  struct ThreadRuntimes
+  {
+    /**
+     * @brief Registers the lists of the calling thread.
+     */
+    ThreadRuntimes();
+    /**
+     * @brief Moves the runtimes into the lists of finished threads and unregisters the lists.
+     */
+    ~ThreadRuntimes();
+    Runtimes runtimes; ///< The runtimes of the thread.
+    std::mutex mutex;  ///< Protects the runtimes (it is only contended while printStats reads them).
+  };
+
   std::string str;                                                      ///< An identifier for the measurement.
   std::chrono::time_point<std::chrono::high_resolution_clock> start;    ///< The timestamp when the measurement has been started.
-  static std::unordered_map<std::string, std::vector<double>> runtimes; ///< The global list of all runtimes.
+  static thread_local ThreadRuntimes threadRuntimes;                    ///< The runtimes of the calling thread.
+  static std::vector<ThreadRuntimes*> threads;                          ///< The runtimes of all running threads that have taken measurements.
+  static Runtimes finishedRuntimes;                                     ///< The runtimes of the threads that have exited.
+  static std::mutex mutex;                                              ///< Protects the list of threads and the runtimes of exited threads.
 };
@@ -0,0 +1,93 @@
+/**
+ * @file ConstantDivision.h
+ *
+ * This file declares the ConstantDivision struct, which replaces the division of 16-bit integers by a constant.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ * @brief Calculates the rounded up quotient of 2^(16 + shift) and a divisor.
+ * @param divisor The divisor.
+ * @param shift The number of bits that the product is shifted after taking its upper 16 bits.
+ * @return The multiplier (which may need 17 bits).
+ */
+constexpr std::uint64_t divisionMultiplier(unsigned int divisor, unsigned int shift)
+{
+  return ((std::uint64_t(1) << (16 + shift)) + divisor - 1) / divisor;
+}
+
+/**
+ * @brief Searches the smallest shift for which the multiplication is exact for all numerators up to a maximum.
+ *
+ * The multiplier exceeds 2^(16 + shift) / divisor by error / divisor, so the quotient is exact if maxNumerator * error < 2^(16 + shift)
+ * (Granlund and Montgomery). This holds at the latest when 2^shift reaches the divisor.
+ * @param divisor The divisor.
+ * @param maxNumerator The largest numerator.
+ * @param shift The smallest shift that is considered.
+ * @return The shift.
+ */
+constexpr unsigned int divisionShift(unsigned int divisor, unsigned int maxNumerator, unsigned int shift = 0)
+{
+  return (divisionMultiplier(divisor, shift) * divisor - (std::uint64_t(1) << (16 + shift))) * maxNumerator < (std::uint64_t(1) << (16 + shift)) ?
+         shift : divisionShift(divisor, maxNumerator, shift + 1);
+}
+
+/**
+ * @brief Calculates the binary logarithm of a power of two.
+ * @param divisor The power of two.
+ * @return The exponent.
+ */
+constexpr unsigned int divisionLog2(unsigned int divisor)
+{
+  return divisor > 1 ? 1 + divisionLog2(divisor / 2) : 0;
+}
+
+/**
+ * @brief This struct describes how unsigned 16-bit integers up to a maximum are divided exactly by a constant.
+ *
+ * SIMD instruction sets have no integer division, but the upper half of a 16x16-bit product, so the quotient
+ * is computed as (n * multiplier) >> (16 + shift). A power of two is only a shift. If the multiplier needs 17 bits,
+ * its highest bit is added separately without overflowing 16 bits: t = (n * multiplier) >> 16, q = (((n - t) >> 1) + t) >> (shift - 1).
+ * @tparam divisor The divisor.
+ * @tparam maxNumerator The largest numerator that is divided.
+ */
+template<unsigned int divisor, unsigned int maxNumerator>
+struct ConstantDivision
+{
+  static_assert(divisor > 0, "The divisor must not be zero!");
+  static_assert(maxNumerator <= 0xffff, "The numerators must fit into 16 bits!");
+
+  static constexpr bool powerOfTwo = (divisor & (divisor - 1)) == 0;                                                                  ///< Whether the division is a shift.
+  static constexpr unsigned int shift = powerOfTwo ? divisionLog2(divisor) : divisionShift(divisor, maxNumerator);               ///< The number of bits that are shifted after the multiplication.
+  static constexpr bool add = !powerOfTwo && divisionMultiplier(divisor, shift) > 0xffff;                                         ///< Whether the 17th bit of the multiplier is added separately.
+  static constexpr std::uint16_t multiplier = powerOfTwo ? 0 : static_cast<std::uint16_t>(divisionMultiplier(divisor, shift)); ///< The lower 16 bits of the multiplier.
+
+  /**
+   * @brief Divides a number with the same steps as the vectorized kernels.
+   * @param n The numerator.
+   * @return The quotient.
+   */
+  static constexpr unsigned int divide(unsigned int n)
+  {
+    return powerOfTwo ? n >> shift :
+           add ? ((((n - ((n * multiplier) >> 16)) >> 1) + ((n * multiplier) >> 16)) >> (shift - 1)) :
+           ((n * multiplier) >> 16) >> shift;
+  }
+};
+
+template<unsigned int divisor, unsigned int maxNumerator>
+constexpr bool ConstantDivision<divisor, maxNumerator>::powerOfTwo;
+
+template<unsigned int divisor, unsigned int maxNumerator>
+constexpr unsigned int ConstantDivision<divisor, maxNumerator>::shift;
+
+template<unsigned int divisor, unsigned int maxNumerator>
+constexpr bool ConstantDivision<divisor, maxNumerator>::add;
+
+template<unsigned int divisor, unsigned int maxNumerator>
+constexpr std::uint16_t ConstantDivision<divisor, maxNumerator>::multiplier;
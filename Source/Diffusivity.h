@@ -0,0 +1,235 @@
+/**
+ * @file Diffusivity.h
+ *
+ * This file declares the diffusivity functions that the PeronaMalik class can use.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "SIMD.h"
+
+/**
+ * @brief This enum enumerates the functions that map the squared norm of the gradient to a diffusivity.
+ */
+enum class DiffusivityFunction
+{
+  rational,                 ///< kappa^2 / (kappa^2 + s) (the second function of Perona and Malik).
+  exponential,              ///< exp(-s / kappa^2) (the first function of Perona and Malik).
+  tukey,                    ///< (1 - s / kappa^2)^2 for s < kappa^2, otherwise 0 (Tukey's biweight, which stops the diffusion completely).
+  charbonnier,              ///< 1 / sqrt(1 + s / kappa^2) (which is convex, so it does not sharpen edges).
+  weickert,                 ///< 1 - exp(-3.31488 / (s / kappa^2)^4) (which is almost constant below and decays fast above kappa^2).
+  numOfDiffusivityFunctions ///< The number of diffusivity functions.
+};
+
+inline namespace SIMD_NAMESPACE
+{
+
+/**
+ * @brief This struct computes 2^t for t in [-126, 0] with a polynomial, which is much faster than std::exp when vectorized.
+ *
+ * The exponent is rounded to an integer that becomes the exponent bits of the result and the rest in [-0.5, 0.5)
+ * is approximated by the polynomial of Cephes' exp2f (within about one ulp). For t <= -126 the result is exactly 0,
+ * so that 1 - 2^t is exactly 1 in every rounding mode. All variants compute identical results.
+ */
+struct FastExp2
+{
+  static ALWAYSINLINE float compute(float t)
+  {
+    if(t <= -126.f)
+      return 0.f;
+    const float n = std::floor(t + 0.5f);
+    const float f = t - n;
+    const std::uint32_t bits = static_cast<std::uint32_t>(static_cast<int>(n) + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    float p = 1.535336188319500e-4f;
+    p = p * f + 1.339887440266574e-3f;
+    p = p * f + 9.618437357674640e-3f;
+    p = p * f + 5.550332471162809e-2f;
+    p = p * f + 2.402264791363012e-1f;
+    p = p * f + 6.931472028550421e-1f;
+    return (p * f + 1.f) * scale;
+  }
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 computeSSE(__m128 t)
+  {
+    const __m128 valid = _mm_cmpgt_ps(t, _mm_set1_ps(-126.f));
+    t = _mm_max_ps(t, _mm_set1_ps(-126.f));
+    const __m128 n = _mm_floor_ps(_mm_add_ps(t, _mm_set1_ps(0.5f)));
+    const __m128 f = _mm_sub_ps(t, n);
+    const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23));
+    __m128 p = _mm_set1_ps(1.535336188319500e-4f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.339887440266574e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.618437357674640e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.550332471162809e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.402264791363012e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.931472028550421e-1f));
+    return _mm_and_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.f)), scale), valid);
+  }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 computeAVX(__m256 t)
+  {
+    const __m256 valid = _mm256_cmp_ps(t, _mm256_set1_ps(-126.f), _CMP_GT_OQ);
+    t = _mm256_max_ps(t, _mm256_set1_ps(-126.f));
+    const __m256 n = _mm256_floor_ps(_mm256_add_ps(t, _mm256_set1_ps(0.5f)));
+    const __m256 f = _mm256_sub_ps(t, n);
+    const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23));
+    __m256 p = _mm256_set1_ps(1.535336188319500e-4f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.339887440266574e-3f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.618437357674640e-3f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.550332471162809e-2f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.402264791363012e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.931472028550421e-1f));
+    return _mm256_and_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.f)), scale), valid);
+  }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 computeAVX512(__m512 t)
+  {
+    const __mmask16 valid = _mm512_cmp_ps_mask(t, _mm512_set1_ps(-126.f), _CMP_GT_OQ);
+    t = _mm512_max_ps(t, _mm512_set1_ps(-126.f));
+    const __m512 n = _mm512_floor_ps(_mm512_add_ps(t, _mm512_set1_ps(0.5f)));
+    const __m512 f = _mm512_sub_ps(t, n);
+    const __m512 scale = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23));
+    __m512 p = _mm512_set1_ps(1.535336188319500e-4f);
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.339887440266574e-3f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(9.618437357674640e-3f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(5.550332471162809e-2f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(2.402264791363012e-1f));
+    p = _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(6.931472028550421e-1f));
+    return _mm512_maskz_mul_ps(valid, _mm512_add_ps(_mm512_mul_ps(p, f), _mm512_set1_ps(1.f)), scale);
+  }
+#endif
+};
+
+/**
+ * @brief This struct computes a diffusivity function from the squared norm of the gradient and kappa squared.
+ *
+ * The kernels of the PeronaMalik class are instantiated for each function, so choosing one does not cost a branch per pixel.
+ * The results of all variants are identical.
+ * @tparam function The diffusivity function.
+ */
+template<DiffusivityFunction function>
+struct DiffusivityTraits;
+
+template<>
+struct DiffusivityTraits<DiffusivityFunction::rational>
+{
+  static ALWAYSINLINE float compute(float sqrNorm, float kappaSqr) { return kappaSqr / (kappaSqr + sqrNorm); }
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 computeSSE(__m128 sqrNorm, __m128 kappaSqr) { return _mm_div_ps(kappaSqr, _mm_add_ps(kappaSqr, sqrNorm)); }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 computeAVX(__m256 sqrNorm, __m256 kappaSqr) { return _mm256_div_ps(kappaSqr, _mm256_add_ps(kappaSqr, sqrNorm)); }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 computeAVX512(__m512 sqrNorm, __m512 kappaSqr) { return _mm512_div_ps(kappaSqr, _mm512_add_ps(kappaSqr, sqrNorm)); }
+#endif
+};
+
+template<>
+struct DiffusivityTraits<DiffusivityFunction::exponential>
+{
+  static ALWAYSINLINE float compute(float sqrNorm, float kappaSqr) { return FastExp2::compute(sqrNorm / kappaSqr * -1.44269504f); }
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 computeSSE(__m128 sqrNorm, __m128 kappaSqr) { return FastExp2::computeSSE(_mm_mul_ps(_mm_div_ps(sqrNorm, kappaSqr), _mm_set1_ps(-1.44269504f))); }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 computeAVX(__m256 sqrNorm, __m256 kappaSqr) { return FastExp2::computeAVX(_mm256_mul_ps(_mm256_div_ps(sqrNorm, kappaSqr), _mm256_set1_ps(-1.44269504f))); }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 computeAVX512(__m512 sqrNorm, __m512 kappaSqr) { return FastExp2::computeAVX512(_mm512_mul_ps(_mm512_div_ps(sqrNorm, kappaSqr), _mm512_set1_ps(-1.44269504f))); }
+#endif
+};
+
+template<>
+struct DiffusivityTraits<DiffusivityFunction::tukey>
+{
+  static ALWAYSINLINE float compute(float sqrNorm, float kappaSqr)
+  {
+    const float t = std::max(1.f - sqrNorm / kappaSqr, 0.f);
+    return t * t;
+  }
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 computeSSE(__m128 sqrNorm, __m128 kappaSqr)
+  {
+    const __m128 t = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.f), _mm_div_ps(sqrNorm, kappaSqr)), _mm_setzero_ps());
+    return _mm_mul_ps(t, t);
+  }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 computeAVX(__m256 sqrNorm, __m256 kappaSqr)
+  {
+    const __m256 t = _mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_div_ps(sqrNorm, kappaSqr)), _mm256_setzero_ps());
+    return _mm256_mul_ps(t, t);
+  }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 computeAVX512(__m512 sqrNorm, __m512 kappaSqr)
+  {
+    const __m512 t = _mm512_max_ps(_mm512_sub_ps(_mm512_set1_ps(1.f), _mm512_div_ps(sqrNorm, kappaSqr)), _mm512_setzero_ps());
+    return _mm512_mul_ps(t, t);
+  }
+#endif
+};
+
+template<>
+struct DiffusivityTraits<DiffusivityFunction::charbonnier>
+{
+  static ALWAYSINLINE float compute(float sqrNorm, float kappaSqr) { return 1.f / std::sqrt(1.f + sqrNorm / kappaSqr); }
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 computeSSE(__m128 sqrNorm, __m128 kappaSqr) { return _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(_mm_add_ps(_mm_set1_ps(1.f), _mm_div_ps(sqrNorm, kappaSqr)))); }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 computeAVX(__m256 sqrNorm, __m256 kappaSqr) { return _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(_mm256_add_ps(_mm256_set1_ps(1.f), _mm256_div_ps(sqrNorm, kappaSqr)))); }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 computeAVX512(__m512 sqrNorm, __m512 kappaSqr) { return _mm512_div_ps(_mm512_set1_ps(1.f), _mm512_sqrt_ps(_mm512_add_ps(_mm512_set1_ps(1.f), _mm512_div_ps(sqrNorm, kappaSqr)))); }
+#endif
+};
+
+template<>
+struct DiffusivityTraits<DiffusivityFunction::weickert>
+{
+  // A vanishing gradient divides by zero, which yields an exponent of minus infinity and thus a diffusivity of 1.
+  static ALWAYSINLINE float compute(float sqrNorm, float kappaSqr)
+  {
+    const float ratio = sqrNorm / kappaSqr;
+    const float ratioSqr = ratio * ratio;
+    return 1.f - FastExp2::compute(-4.78242f / (ratioSqr * ratioSqr));
+  }
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 computeSSE(__m128 sqrNorm, __m128 kappaSqr)
+  {
+    const __m128 ratio = _mm_div_ps(sqrNorm, kappaSqr);
+    const __m128 ratioSqr = _mm_mul_ps(ratio, ratio);
+    return _mm_sub_ps(_mm_set1_ps(1.f), FastExp2::computeSSE(_mm_div_ps(_mm_set1_ps(-4.78242f), _mm_mul_ps(ratioSqr, ratioSqr))));
+  }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 computeAVX(__m256 sqrNorm, __m256 kappaSqr)
+  {
+    const __m256 ratio = _mm256_div_ps(sqrNorm, kappaSqr);
+    const __m256 ratioSqr = _mm256_mul_ps(ratio, ratio);
+    return _mm256_sub_ps(_mm256_set1_ps(1.f), FastExp2::computeAVX(_mm256_div_ps(_mm256_set1_ps(-4.78242f), _mm256_mul_ps(ratioSqr, ratioSqr))));
+  }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 computeAVX512(__m512 sqrNorm, __m512 kappaSqr)
+  {
+    const __m512 ratio = _mm512_div_ps(sqrNorm, kappaSqr);
+    const __m512 ratioSqr = _mm512_mul_ps(ratio, ratio);
+    return _mm512_sub_ps(_mm512_set1_ps(1.f), FastExp2::computeAVX512(_mm512_div_ps(_mm512_set1_ps(-4.78242f), _mm512_mul_ps(ratioSqr, ratioSqr))));
+  }
+#endif
+};
+
+}
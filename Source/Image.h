@@ -1,86 +1,447 @@
 /**
  * @file Image.hpp
  *
- * This file declares the Image class.
+ * This file declares the ImageT and ImageViewT classes.
  *
  * @author Arne Hasselbring
  */
 
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <stdexcept>
 
 #include "AlignedMemory.h"
+#include "Pixel.h"
 
 /**
- * @brief This class is a container for grayscale / single channel images.
+ * @brief This enum enumerates the ways in which the halo around an image can be filled.
  */
-class Image final
+enum class BorderPolicy
+{
+  none,               ///< The halo has not been filled (its content is undefined).
+  zero,               ///< The halo is filled with zeros.
+  replicate,          ///< The halo repeats the outermost pixels (which yields a Neumann boundary for difference operators).
+  mirror,             ///< The halo mirrors the image at its outermost pixels (without repeating them).
+  numOfBorderPolicies ///< The number of border policies.
+};
+
+/**
+ * @brief This class references (a rectangular region of) single channel pixel data without owning it.
+ * @tparam Pixel The type of a pixel.
+ */
+template<typename Pixel>
+class ImageViewT final
 {
 public:
+  /**
+   * @brief Creates a view on existing pixel data.
+   * @param data A pointer to the first pixel of the first row.
+   * @param width The width of the view (i.e. number of columns).
+   * @param height The height of the view (i.e. number of rows).
+   * @param stride The distance between the starts of two consecutive rows (in pixels).
+   * @param aligned Whether all the rows are aligned and padded so that SSE/AVX instructions can be used.
+   * @param halo The number of rows and columns around the view that can be accessed as well.
+   * @param border How the halo has been filled.
+   */
+  ImageViewT(const Pixel* data, unsigned int width, unsigned int height, unsigned int stride, bool aligned, unsigned int halo = 0, BorderPolicy border = BorderPolicy::none) :
+    width(width),
+    height(height),
+    stride(stride),
+    aligned(aligned),
+    halo(halo),
+    border(border),
+    data(data)
+  {
+  }
+  /**
+   * @brief Creates a view on a rectangular region of this view.
+   * @param x The first column of the region.
+   * @param y The first row of the region.
+   * @param width The width of the region.
+   * @param height The height of the region.
+   * @return A view on the region (which only keeps the halo if it covers this whole view).
+   */
+  ImageViewT view(unsigned int x, unsigned int y, unsigned int width, unsigned int height) const;
+  /**
+   * @brief Accesses a pixel row (read-only).
+   * @param y The row (zero-based) that should be accessed (may be negative to access the halo).
+   * @return A pointer to the start of the row.
+   */
+  const Pixel* operator[](std::ptrdiff_t y) const
+  {
+    return data + y * static_cast<std::ptrdiff_t>(stride);
+  }
+  unsigned int width;  ///< The width of the view (in pixels).
+  unsigned int height; ///< The height of the view (in pixels).
+  unsigned int stride; ///< The distance between the starts of two consecutive rows (in pixels).
+  bool aligned;        ///< Whether all the rows are aligned (and padded) so that SSE/AVX instructions can be used.
+  unsigned int halo;   ///< The number of rows and columns around the view that can be accessed as well.
+  BorderPolicy border; ///< How the halo has been filled.
+private:
+  const Pixel* data; ///< The pixel data (row by row).
+};
+
+/**
+ * @brief This class is a container for single channel images.
+ * @tparam Pixel The type of a pixel.
+ */
+template<typename Pixel>
+class ImageT final
+{
+public:
+  static constexpr unsigned int alignment = 64; ///< The alignment (in bytes) of the rows of aligned images (a cache line and an AVX-512 vector).
+
   /**
    * @brief Creates an Image and allocates memory.
+   *
+   * Aligned images have their rows padded to a multiple of the alignment, so each row starts at an aligned address
+   * and SSE/AVX instructions can process whole vectors up to the end of the row. The content of the padding is undefined.
+   * The halo surrounds the image on all sides, so kernels can read the neighbors of border pixels without branches.
+   * It is undefined until fillBorder is called. In aligned images, the left halo is widened to a multiple of the alignment.
    * @param width The width of the image (i.e. number of columns).
    * @param height The height of the image (i.e. number of rows).
    * @param aligned Whether the memory must be aligned for SSE/AVX.
+   * @param halo The number of rows and columns that are allocated around the image.
+   * @param policy How the memory should be backed and placed if the image is large.
    */
-  Image(unsigned int width, unsigned int height, bool aligned = false) :
+  ImageT(unsigned int width, unsigned int height, bool aligned = false, unsigned int halo = 0, const MemoryPolicy& policy = AlignedMemory::getDefaultPolicy()) :
     width(width),
     height(height),
+    stride(paddedStride(width, aligned, halo)),
     aligned(aligned),
+    halo(halo),
+    border(BorderPolicy::none),
     data(nullptr)
   {
-    if(aligned && (width % 32) != 0)
-      throw std::runtime_error("The given width makes it impossible for this image to be properly aligned!");
-    if((data = static_cast<std::uint8_t*>(AlignedMemory::alloc(width * height, 32))) == nullptr)
+    Pixel* memory = static_cast<Pixel*>(AlignedMemory::alloc(size(), alignment, policy));
+    if(memory == nullptr)
       throw std::runtime_error("Could not allocate aligned memory!");
+    data = memory + origin();
+  }
+  /**
+   * @brief Copies the pixels referenced by a view into a new aligned Image.
+   * @param view The view whose pixels are copied into the new image.
+   * @param halo The number of rows and columns that are allocated around the new image.
+   * @param border How the halo of the new image is filled.
+   */
+  explicit ImageT(const ImageViewT<Pixel>& view, unsigned int halo = 0, BorderPolicy border = BorderPolicy::zero) :
+    ImageT(view.width, view.height, true, halo)
+  {
+    for(unsigned int y = 0; y < height; y++)
+      std::memcpy((*this)[y], view[y], width * sizeof(Pixel));
+    if(halo > 0)
+      fillBorder(border);
   }
   /**
    * @brief Copies an Image.
    * @param other The image that is copied into the new one.
    */
-  Image(const Image& other) :
+  ImageT(const ImageT& other) :
     width(other.width),
     height(other.height),
+    stride(other.stride),
     aligned(other.aligned),
+    halo(other.halo),
+    border(other.border),
     data(nullptr)
   {
-    if((data = static_cast<std::uint8_t*>(AlignedMemory::alloc(width * height, 32))) == nullptr)
+    Pixel* memory = static_cast<Pixel*>(AlignedMemory::alloc(size(), alignment));
+    if(memory == nullptr)
       throw std::runtime_error("Could not allocate aligned memory!");
+    data = memory + origin();
 
-    std::memcpy(data, other.data, width * height);
+    std::memcpy(memory, other.data - other.origin(), size());
+  }
+  /**
+   * @brief Moves an Image without copying its pixels.
+   * @param other The image whose pixels are taken over (it is empty afterwards).
+   */
+  ImageT(ImageT&& other) noexcept :
+    width(other.width),
+    height(other.height),
+    stride(other.stride),
+    aligned(other.aligned),
+    halo(other.halo),
+    border(other.border),
+    data(other.data)
+  {
+    other.width = other.height = other.stride = other.halo = 0;
+    other.data = nullptr;
   }
   /**
    * @brief Frees the pixel memory.
    */
-  ~Image()
+  ~ImageT()
   {
     if(data != nullptr)
-      AlignedMemory::free(data);
+      AlignedMemory::free(data - origin());
+  }
+  /**
+   * @brief Replaces the content of this Image by a copy of another one.
+   * @param other The image that is copied into this one.
+   * @return This image.
+   */
+  ImageT& operator=(const ImageT& other)
+  {
+    if(this != &other)
+      *this = ImageT(other);
+    return *this;
+  }
+  /**
+   * @brief Replaces the content of this Image by the pixels of another one without copying them.
+   * @param other The image whose pixels are taken over (it is empty afterwards).
+   * @return This image.
+   */
+  ImageT& operator=(ImageT&& other) noexcept
+  {
+    if(this != &other)
+    {
+      if(data != nullptr)
+        AlignedMemory::free(data - origin());
+      width = other.width;
+      height = other.height;
+      stride = other.stride;
+      aligned = other.aligned;
+      halo = other.halo;
+      border = other.border;
+      data = other.data;
+      other.width = other.height = other.stride = other.halo = 0;
+      other.data = nullptr;
+    }
+    return *this;
+  }
+  /**
+   * @brief Fills the halo around the image.
+   *
+   * The columns are filled row by row (with vectorized broadcasts for replicate and reversals for mirror) before the rows of the halo are copied as a whole (including the corners).
+   * @param policy How the halo should be filled.
+   */
+  void fillBorder(BorderPolicy policy);
+  /**
+   * @brief Determines the source of a halo pixel in one dimension.
+   * @param i The coordinate of the halo pixel (outside of [0, n)).
+   * @param n The extent of the image in this dimension.
+   * @param policy How the halo is filled (replicate or mirror).
+   * @return The coordinate of the pixel inside the image that is copied.
+   */
+  static int borderSource(int i, int n, BorderPolicy policy)
+  {
+    if(policy == BorderPolicy::replicate || n == 1)
+      return std::min(std::max(i, 0), n - 1);
+    // Mirroring is periodic if the halo is larger than the image.
+    const int period = 2 * (n - 1);
+    i = std::abs(i) % period;
+    return i < n ? i : period - i;
+  }
+  /**
+   * @brief Creates a view on the whole image.
+   * @return A view on the image.
+   */
+  ImageViewT<Pixel> view() const
+  {
+    return ImageViewT<Pixel>(data, width, height, stride, aligned, halo, border);
+  }
+  /**
+   * @brief Creates a view on a rectangular region of the image.
+   * @param x The first column of the region.
+   * @param y The first row of the region.
+   * @param width The width of the region.
+   * @param height The height of the region.
+   * @return A view on the region.
+   */
+  ImageViewT<Pixel> view(unsigned int x, unsigned int y, unsigned int width, unsigned int height) const
+  {
+    return view().view(x, y, width, height);
+  }
+  /**
+   * @brief Converts the image to a view on the whole image.
+   */
+  operator ImageViewT<Pixel>() const
+  {
+    return view();
   }
   /**
    * @brief Accesses a pixel row (mutable).
-   * @param y The row (zero-based) that should be accessed.
+   * @param y The row (zero-based) that should be accessed (may be negative to access the halo).
    * @return A pointer to the start of the row.
    */
-  std::uint8_t* operator[](unsigned int y)
+  Pixel* operator[](std::ptrdiff_t y)
   {
-    return data + y * width;
+    return data + y * static_cast<std::ptrdiff_t>(stride);
   }
   /**
    * @brief Accesses a pixel row (read-only).
-   * @param y The row (zero-based) that should be accessed.
+   * @param y The row (zero-based) that should be accessed (may be negative to access the halo).
    * @return A pointer to the start of the row.
    */
-  const std::uint8_t* operator[](unsigned int y) const
+  const Pixel* operator[](std::ptrdiff_t y) const
   {
-    return data + y * width;
+    return data + y * static_cast<std::ptrdiff_t>(stride);
   }
   unsigned int width;  ///< The width of the image (in pixels).
   unsigned int height; ///< The height of the image (in pixels).
-  const bool aligned;  ///< Whether all the rows are aligned so that SSE/AVX instructions can be used.
+  unsigned int stride; ///< The distance between the starts of two consecutive rows (in pixels).
+  bool aligned;        ///< Whether all the rows are aligned so that SSE/AVX instructions can be used.
+  unsigned int halo;   ///< The number of rows and columns that are allocated around the image.
+  BorderPolicy border; ///< How the halo has been filled the last time.
 private:
-  std::uint8_t* data; ///< The pixel data (row by row).
+  /**
+   * @brief Sets a run of pixels to the same value.
+   * @param dst The first pixel of the run.
+   * @param value The value.
+   * @param count The number of pixels.
+   */
+  static ALWAYSINLINE void fillPixels(Pixel* dst, Pixel value, unsigned int count);
+  /**
+   * @brief Copies a run of pixels in reverse order (dst[i] = src[count - 1 - i]).
+   * @param dst The first pixel of the destination.
+   * @param src The first pixel of the source (which must not overlap the destination).
+   * @param count The number of pixels.
+   */
+  static ALWAYSINLINE void reversePixels(Pixel* dst, const Pixel* src, unsigned int count);
+  /**
+   * @brief Calculates the number of pixels in front of the first column of each row.
+   * @param aligned Whether the rows are aligned.
+   * @param halo The number of columns of the halo.
+   * @return The number of pixels in front of each row.
+   */
+  static unsigned int leftPadding(bool aligned, unsigned int halo)
+  {
+    return aligned ? (halo * sizeof(Pixel) + alignment - 1) / alignment * alignment / sizeof(Pixel) : halo;
+  }
+  /**
+   * @brief Calculates the distance between the starts of two consecutive rows.
+   * @param width The width of the image.
+   * @param aligned Whether the rows are aligned.
+   * @param halo The number of columns of the halo.
+   * @return The stride (in pixels).
+   */
+  static unsigned int paddedStride(unsigned int width, bool aligned, unsigned int halo)
+  {
+    const unsigned int pixels = leftPadding(aligned, halo) + width + halo;
+    return aligned ? (pixels * sizeof(Pixel) + alignment - 1) / alignment * alignment / sizeof(Pixel) : pixels;
+  }
+  /**
+   * @brief Calculates the offset of the first pixel from the start of the allocated memory.
+   * @return The offset (in pixels).
+   */
+  std::size_t origin() const
+  {
+    return static_cast<std::size_t>(halo) * stride + leftPadding(aligned, halo);
+  }
+  /**
+   * @brief Calculates the size of the allocated memory.
+   * @return The size (in bytes).
+   */
+  std::size_t size() const
+  {
+    return static_cast<std::size_t>(stride) * (height + 2 * halo) * sizeof(Pixel);
+  }
+
+  Pixel* data; ///< The pixel data (row by row).
 };
+
+template<typename Pixel>
+constexpr unsigned int ImageT<Pixel>::alignment;
+
+template<typename Pixel>
+void ImageT<Pixel>::fillBorder(BorderPolicy policy)
+{
+  border = policy;
+  // An empty image has no pixels that the halo could be filled from.
+  if(halo == 0 || policy == BorderPolicy::none || width == 0 || height == 0)
+    return;
+
+  const int n = static_cast<int>(halo);
+  const int w = static_cast<int>(width);
+  const int h = static_cast<int>(height);
+  switch(policy)
+  {
+    case BorderPolicy::zero:
+      for(int y = 0; y < h; y++)
+      {
+        fillPixels((*this)[y] - n, Pixel(), halo);
+        fillPixels((*this)[y] + w, Pixel(), halo);
+      }
+      for(int y = 1; y <= n; y++)
+      {
+        std::memset((*this)[-y] - n, 0, (w + 2 * n) * sizeof(Pixel));
+        std::memset((*this)[h - 1 + y] - n, 0, (w + 2 * n) * sizeof(Pixel));
+      }
+      return;
+    case BorderPolicy::replicate:
+      for(int y = 0; y < h; y++)
+      {
+        Pixel* row = (*this)[y];
+        fillPixels(row - n, row[0], halo);
+        fillPixels(row + w, row[w - 1], halo);
+      }
+      break;
+    case BorderPolicy::mirror:
+    default:
+      for(int y = 0; y < h; y++)
+      {
+        Pixel* row = (*this)[y];
+        // Only a halo that is larger than the image wraps around more than once.
+        if(n < w)
+        {
+          reversePixels(row - n, row + 1, halo);
+          reversePixels(row + w, row + w - 1 - n, halo);
+        }
+        else
+          for(int x = 1; x <= n; x++)
+          {
+            row[-x] = row[borderSource(-x, w, policy)];
+            row[w - 1 + x] = row[borderSource(w - 1 + x, w, policy)];
+          }
+      }
+      break;
+  }
+  for(int y = 1; y <= n; y++)
+  {
+    std::memcpy((*this)[-y] - n, (*this)[borderSource(-y, h, policy)] - n, (w + 2 * n) * sizeof(Pixel));
+    std::memcpy((*this)[h - 1 + y] - n, (*this)[borderSource(h - 1 + y, h, policy)] - n, (w + 2 * n) * sizeof(Pixel));
+  }
+}
+
+template<typename Pixel>
+ALWAYSINLINE void ImageT<Pixel>::fillPixels(Pixel* dst, Pixel value, unsigned int count)
+{
+  constexpr unsigned int lanes = sizeof(__m128i) / sizeof(Pixel);
+  const __m128i values = PixelTraits<Pixel>::broadcast(value);
+  unsigned int i = 0;
+  for(; i + lanes <= count; i += lanes)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), values);
+  for(; i < count; i++)
+    dst[i] = value;
+}
+
+template<typename Pixel>
+ALWAYSINLINE void ImageT<Pixel>::reversePixels(Pixel* dst, const Pixel* src, unsigned int count)
+{
+  constexpr unsigned int lanes = sizeof(__m128i) / sizeof(Pixel);
+  unsigned int i = 0;
+  for(; i + lanes <= count; i += lanes)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), PixelTraits<Pixel>::reverse(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + count - i - lanes))));
+  for(; i < count; i++)
+    dst[i] = src[count - 1 - i];
+}
+
+template<typename Pixel>
+ImageViewT<Pixel> ImageViewT<Pixel>::view(unsigned int x, unsigned int y, unsigned int width, unsigned int height) const
+{
+  if(x + width > this->width || y + height > this->height)
+    throw std::out_of_range("The region exceeds the image!");
+  if(x == 0 && y == 0 && width == this->width && height == this->height)
+    return *this;
+  // A region stays aligned if it starts at an aligned column, because its padding is then part of the padding of this view.
+  return ImageViewT<Pixel>(data + y * stride + x, width, height, stride, aligned && (x * sizeof(Pixel)) % ImageT<Pixel>::alignment == 0);
+}
+
+using Image = ImageT<std::uint8_t>;         ///< An image with 8-bit pixels.
+using ImageView = ImageViewT<std::uint8_t>; ///< A view on an image with 8-bit pixels.
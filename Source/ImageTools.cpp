@@ -6,20 +6,32 @@
  * @author Arne Hasselbring
  */
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <stdexcept>
 #include <vector>
 
 #include <lodepng/lodepng.h>
 
+#include "CPUFeatures.h"
+#include "ImageToolsKernels.h"
+
 #include "ImageTools.h"
 
+// The vectorized conversions are compiled with their instruction sets in KernelsSSE4.cpp, KernelsAVX2.cpp and KernelsAVX512.cpp.
+INSTANTIATE_IMAGETOOLS_KERNELS(extern, false, false);
+INSTANTIATE_IMAGETOOLS_KERNELS(extern, true, false);
+INSTANTIATE_IMAGETOOLS_KERNELS(extern, true, true);
+
 Image ImageTools::loadImage(const std::string& path, ImageFormat format)
 {
   std::vector<unsigned char> data;
   unsigned int width, height;
   if(lodepng::decode(data, width, height, path.c_str()) != 0)
     throw std::runtime_error("Could not read image!");
-  Image result(width, height, (width % 32) == 0);
+  // The halo lets filters read the neighbors of the border pixels without copying the image first.
+  Image result(width, height, true, 1);
   switch(format)
   {
     case ImageFormat::PNG:
@@ -35,10 +47,11 @@ Image ImageTools::loadImage(const std::string& path, ImageFormat format)
     default:
       throw std::runtime_error("Unknown image format given!");
   }
+  result.fillBorder(BorderPolicy::zero);
   return result;
 }
 
-void ImageTools::storeImage(const std::string& path, const Image& image)
+void ImageTools::storeImage(const std::string& path, const ImageView& image)
 {
   std::vector<unsigned char> data(4 * image.width * image.height);
   for(unsigned int y = 0; y < image.height; y++)
@@ -54,7 +67,7 @@ void ImageTools::storeImage(const std::string& path, const Image& image)
     throw std::runtime_error("Could not write image!");
 }
 
-bool ImageTools::compare(const Image& image1, const Image& image2)
+bool ImageTools::compare(const ImageView& image1, const ImageView& image2)
 {
   if(image1.width != image2.width || image1.height != image2.height)
     return false;
@@ -67,6 +80,172 @@ bool ImageTools::compare(const Image& image1, const Image& image2)
   return true;
 }
 
+template<typename To, typename From>
+ImageT<To> ImageTools::convert(const ImageViewT<From>& image, OptimizationLevel optimizationLevel, float scale)
+{
+  ImageT<To> result(image.width, image.height, true);
+  convert(image, result, optimizationLevel, scale);
+  return result;
+}
+
+template<typename To, typename From>
+void ImageTools::convert(const ImageViewT<From>& image, ImageT<To>& result, OptimizationLevel optimizationLevel, float scale)
+{
+  if(image.width > result.width || image.height > result.height)
+    throw std::runtime_error("The destination is too small!");
+  optimizationLevel = CPUFeatures::resolve(optimizationLevel);
+
+  for(unsigned int y = 0; y < image.height; y++)
+  {
+    const From* srcRow = image[y];
+    To* dstRow = result[y];
+    unsigned int x = 0;
+    switch(optimizationLevel)
+    {
+      case OptimizationLevel::avx512:
+        x = convertVectors<To, From, true, true>(srcRow, dstRow, image.width, scale);
+        break;
+      case OptimizationLevel::avx2:
+        x = convertVectors<To, From, true, false>(srcRow, dstRow, image.width, scale);
+        break;
+      case OptimizationLevel::sse4:
+        x = convertVectors<To, From, false, false>(srcRow, dstRow, image.width, scale);
+        break;
+      default:
+        break;
+    }
+    for(; x < image.width; x++)
+      PixelTraits<To>::store(dstRow + x, PixelTraits<From>::load(srcRow + x) * scale);
+  }
+}
+
+#define INSTANTIATE_CONVERT(To, From) \
+  template ImageT<To> ImageTools::convert<To, From>(const ImageViewT<From>&, OptimizationLevel, float); \
+  template void ImageTools::convert<To, From>(const ImageViewT<From>&, ImageT<To>&, OptimizationLevel, float)
+#define INSTANTIATE_CONVERT_FROM(From) \
+  INSTANTIATE_CONVERT(std::uint8_t, From); \
+  INSTANTIATE_CONVERT(std::uint16_t, From); \
+  INSTANTIATE_CONVERT(float, From); \
+  INSTANTIATE_CONVERT(Half, From)
+
+INSTANTIATE_CONVERT_FROM(std::uint8_t);
+INSTANTIATE_CONVERT_FROM(std::uint16_t);
+INSTANTIATE_CONVERT_FROM(float);
+INSTANTIATE_CONVERT_FROM(Half);
+
+Image ImageTools::downsample(const ImageView& image, OptimizationLevel optimizationLevel)
+{
+  optimizationLevel = CPUFeatures::resolve(optimizationLevel);
+  Image result((image.width + 1) / 2, (image.height + 1) / 2, true, 1);
+
+  for(unsigned int y = 0; y < result.height; y++)
+  {
+    const std::uint8_t* row = image[2 * y];
+    const std::uint8_t* nextRow = image[std::min(2 * y + 1, image.height - 1)];
+    std::uint8_t* dstRow = result[y];
+    unsigned int x = 0;
+    switch(optimizationLevel)
+    {
+      case OptimizationLevel::avx512:
+        x = downsampleVectors<true, true>(row, nextRow, dstRow, image.width / 2);
+        break;
+      case OptimizationLevel::avx2:
+        x = downsampleVectors<true, false>(row, nextRow, dstRow, image.width / 2);
+        break;
+      case OptimizationLevel::sse4:
+        x = downsampleVectors<false, false>(row, nextRow, dstRow, image.width / 2);
+        break;
+      default:
+        break;
+    }
+    for(; x < result.width; x++)
+    {
+      const unsigned int right = std::min(2 * x + 1, image.width - 1);
+      dstRow[x] = static_cast<std::uint8_t>((row[2 * x] + row[right] + nextRow[2 * x] + nextRow[right] + 2) >> 2);
+    }
+  }
+
+  result.fillBorder(BorderPolicy::zero);
+  return result;
+}
+
+Image ImageTools::upsampleChange(const ImageView& changed, const ImageView& original, const ImageView& image, OptimizationLevel optimizationLevel)
+{
+  if(changed.width != original.width || changed.height != original.height || (image.width + 1) / 2 != changed.width || (image.height + 1) / 2 != changed.height)
+    throw std::runtime_error("The images have incompatible sizes!");
+  optimizationLevel = CPUFeatures::resolve(optimizationLevel);
+  Image result(image.width, image.height, true, 1);
+
+  for(unsigned int y = 0; y < image.height; y++)
+  {
+    // Even rows lie between the nearest source row and the one above, odd rows between it and the one below.
+    const unsigned int sourceY = y / 2;
+    const unsigned int neighborY = y % 2 ? std::min(sourceY + 1, changed.height - 1) : (sourceY > 0 ? sourceY - 1 : 0);
+    const std::uint8_t* changedRow = changed[sourceY];
+    const std::uint8_t* changedNeighborRow = changed[neighborY];
+    const std::uint8_t* originalRow = original[sourceY];
+    const std::uint8_t* originalNeighborRow = original[neighborY];
+    const std::uint8_t* imageRow = image[y];
+    std::uint8_t* dstRow = result[y];
+    unsigned int x = 1;
+    switch(optimizationLevel)
+    {
+      case OptimizationLevel::avx512:
+        x = upsampleChangeVectors<true, true>(changedRow, changedNeighborRow, originalRow, originalNeighborRow, imageRow, dstRow, changed.width);
+        break;
+      case OptimizationLevel::avx2:
+        x = upsampleChangeVectors<true, false>(changedRow, changedNeighborRow, originalRow, originalNeighborRow, imageRow, dstRow, changed.width);
+        break;
+      case OptimizationLevel::sse4:
+        x = upsampleChangeVectors<false, false>(changedRow, changedNeighborRow, originalRow, originalNeighborRow, imageRow, dstRow, changed.width);
+        break;
+      default:
+        break;
+    }
+    // The vectors start at the second source column, because the first one has no left neighbor.
+    const auto difference = [&](unsigned int column)
+    {
+      return 3 * (changedRow[column] - originalRow[column]) + changedNeighborRow[column] - originalNeighborRow[column];
+    };
+    const auto upsampleColumn = [&](unsigned int sourceX)
+    {
+      const int mid = 3 * difference(sourceX) + 8;
+      const int left = (mid + difference(sourceX > 0 ? sourceX - 1 : 0)) >> 4;
+      dstRow[2 * sourceX] = clamp(imageRow[2 * sourceX] + left);
+      if(2 * sourceX + 1 < image.width)
+      {
+        const int right = (mid + difference(std::min(sourceX + 1, changed.width - 1))) >> 4;
+        dstRow[2 * sourceX + 1] = clamp(imageRow[2 * sourceX + 1] + right);
+      }
+    };
+    upsampleColumn(0);
+    for(; x < changed.width; x++)
+      upsampleColumn(x);
+  }
+
+  result.fillBorder(BorderPolicy::zero);
+  return result;
+}
+
+double ImageTools::psnr(const ImageView& image1, const ImageView& image2)
+{
+  if(image1.width != image2.width || image1.height != image2.height)
+    throw std::runtime_error("The images have different sizes!");
+
+  std::uint64_t sumOfSquares = 0;
+  for(unsigned int y = 0; y < image1.height; y++)
+    for(unsigned int x = 0; x < image1.width; x++)
+    {
+      const int difference = image1[y][x] - image2[y][x];
+      sumOfSquares += difference * difference;
+    }
+
+  if(sumOfSquares == 0)
+    return std::numeric_limits<double>::infinity();
+  const double meanSquaredError = static_cast<double>(sumOfSquares) / (static_cast<double>(image1.width) * image1.height);
+  return 10.0 * std::log10(255.0 * 255.0 / meanSquaredError);
+}
+
 unsigned char ImageTools::clamp(int value)
 {
   return (value > 255) ? 255 : ((value < 0) ? 0 : value);
@@ -8,9 +8,11 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 #include "Image.h"
+#include "OptimizationLevel.h"
 
 /**
  * @brief This enum enumerates the image formats that can be handled by the ImageTools class.
@@ -32,7 +34,7 @@ public:
    * @brief Loads an Image from a file.
    * @param path The path from which the Image should be loaded.
    * @param format The format in which the Image is stored.
-   * @return The loaded Image.
+   * @return The loaded Image (which has a halo of one pixel filled with zeros).
    */
   static Image loadImage(const std::string& path, ImageFormat format);
   /*+
@@ -40,15 +42,108 @@ public:
    * @param path The path where the Image should be stored.
    * @param image The Image to store.
    */
-  static void storeImage(const std::string& path, const Image& image);
+  static void storeImage(const std::string& path, const ImageView& image);
   /**
    * @brief Compares to Images for equality.
    * @param image1 The first operand.
    * @param image2 The second operand.
    * @return Whether the two Images are equal.
    */
-  static bool compare(const Image& image1, const Image& image2);
+  static bool compare(const ImageView& image1, const ImageView& image2);
+  /**
+   * @brief Converts an Image to another pixel type (see PixelTraits for the rounding behavior).
+   * @tparam To The pixel type of the result.
+   * @tparam From The pixel type of the source.
+   * @param image The source.
+   * @param optimizationLevel The kind of optimization that should be used.
+   * @param scale The factor by which the pixels are multiplied before they are rounded.
+   * @return The converted (aligned) Image.
+   */
+  template<typename To, typename From>
+  static ImageT<To> convert(const ImageViewT<From>& image, OptimizationLevel optimizationLevel = OptimizationLevel::noOptimization, float scale = 1.f);
+  /**
+   * @brief Converts an Image to another pixel type and writes it into the top left corner of an existing Image.
+   * @tparam To The pixel type of the result.
+   * @tparam From The pixel type of the source.
+   * @param image The source.
+   * @param result The destination which must be at least as large as the source.
+   * @param optimizationLevel The kind of optimization that should be used.
+   * @param scale The factor by which the pixels are multiplied before they are rounded.
+   */
+  template<typename To, typename From>
+  static void convert(const ImageViewT<From>& image, ImageT<To>& result, OptimizationLevel optimizationLevel = OptimizationLevel::noOptimization, float scale = 1.f);
+  /**
+   * @brief Halves the resolution of an Image by averaging blocks of 2x2 pixels (rounded to the nearest integer).
+   *
+   * An odd last column or row is averaged with itself.
+   * @param image The source.
+   * @param optimizationLevel The kind of optimization that should be used.
+   * @return The downsampled (aligned) Image of (width + 1) / 2 x (height + 1) / 2 pixels (which has a halo of one pixel filled with zeros).
+   */
+  static Image downsample(const ImageView& image, OptimizationLevel optimizationLevel = OptimizationLevel::noOptimization);
+  /**
+   * @brief Transfers the change of a downsampled Image to the full resolution.
+   *
+   * The difference between the changed and the original downsampled Image is upsampled by bilinear interpolation
+   * between the pixel centers, i.e. each pixel is (9 * nearest + 3 * horizontal neighbor + 3 * vertical neighbor + diagonal neighbor) / 16
+   * with the neighbors replicated at the borders. Adding it to the full resolution Image keeps the details that
+   * the downsampled Image cannot represent.
+   * @param changed The changed downsampled Image.
+   * @param original The downsampled Image before the change (of the same size).
+   * @param image The full resolution Image (of 2 * width or 2 * width - 1 x 2 * height or 2 * height - 1 pixels).
+   * @param optimizationLevel The kind of optimization that should be used.
+   * @return The full resolution Image plus the upsampled change (saturated, aligned and with a halo of one pixel filled with zeros).
+   */
+  static Image upsampleChange(const ImageView& changed, const ImageView& original, const ImageView& image, OptimizationLevel optimizationLevel = OptimizationLevel::noOptimization);
+  /**
+   * @brief Calculates the peak signal-to-noise ratio between two Images of the same size.
+   * @param image1 The first operand.
+   * @param image2 The second operand.
+   * @return The PSNR in dB (infinity if the Images are equal).
+   */
+  static double psnr(const ImageView& image1, const ImageView& image2);
 private:
+  /**
+   * @brief Converts the whole vectors at the beginning of a row to another pixel type.
+   * @tparam To The pixel type of the result.
+   * @tparam From The pixel type of the source.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @param srcRow The row of the source.
+   * @param dstRow The row of the destination.
+   * @param width The number of pixels in the row.
+   * @param scale The factor by which the pixels are multiplied before they are rounded.
+   * @return The number of pixels that have been converted.
+   */
+  template<typename To, typename From, bool avx, bool avx512>
+  static unsigned int convertVectors(const From* srcRow, To* dstRow, unsigned int width, float scale);
+  /**
+   * @brief Downsamples the whole vectors at the beginning of a row.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @param row The upper row of the source.
+   * @param nextRow The lower row of the source.
+   * @param dstRow The row of the destination.
+   * @param width The number of destination pixels for which both source columns exist.
+   * @return The number of pixels that have been computed.
+   */
+  template<bool avx, bool avx512>
+  static unsigned int downsampleVectors(const std::uint8_t* row, const std::uint8_t* nextRow, std::uint8_t* dstRow, unsigned int width);
+  /**
+   * @brief Upsamples the change of the whole vectors of a row whose source pixels have a left and a right neighbor.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @param changedRow The row of the changed Image that is nearest to the destination row.
+   * @param changedNeighborRow The row of the changed Image that is second nearest to the destination row.
+   * @param originalRow The row of the original Image that is nearest to the destination row.
+   * @param originalNeighborRow The row of the original Image that is second nearest to the destination row.
+   * @param imageRow The row of the full resolution Image.
+   * @param dstRow The row of the destination.
+   * @param width The width of the downsampled Images.
+   * @return The source column after the last one that has been upsampled (starting at column 1).
+   */
+  template<bool avx, bool avx512>
+  static unsigned int upsampleChangeVectors(const std::uint8_t* changedRow, const std::uint8_t* changedNeighborRow, const std::uint8_t* originalRow, const std::uint8_t* originalNeighborRow, const std::uint8_t* imageRow, std::uint8_t* dstRow, unsigned int width);
   /**
    * @brief Clamps an integer to the range of an unsigned char.
    * @param value An integer.
@@ -0,0 +1,199 @@
+/**
+ * @file ImageToolsKernels.h
+ *
+ * This file implements the kernels of the ImageTools class, which are compiled once per instruction set.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "Pixel.h"
+#include "SIMD.h"
+
+#include "ImageTools.h"
+
+/**
+ * @brief Instantiates the conversions of the ImageTools class from one pixel type for an instruction set.
+ * @param prefix Nothing to instantiate them or extern to declare that they are instantiated elsewhere.
+ */
+#define INSTANTIATE_IMAGETOOLS_KERNELS_FROM(prefix, From, avx, avx512) \
+  prefix template unsigned int ImageTools::convertVectors<std::uint8_t, From, avx, avx512>(const From*, std::uint8_t*, unsigned int, float); \
+  prefix template unsigned int ImageTools::convertVectors<std::uint16_t, From, avx, avx512>(const From*, std::uint16_t*, unsigned int, float); \
+  prefix template unsigned int ImageTools::convertVectors<float, From, avx, avx512>(const From*, float*, unsigned int, float); \
+  prefix template unsigned int ImageTools::convertVectors<Half, From, avx, avx512>(const From*, Half*, unsigned int, float)
+
+/**
+ * @brief Instantiates the kernels of the ImageTools class for an instruction set.
+ * @param prefix Nothing to instantiate them or extern to declare that they are instantiated elsewhere.
+ */
+#define INSTANTIATE_IMAGETOOLS_KERNELS(prefix, avx, avx512) \
+  INSTANTIATE_IMAGETOOLS_KERNELS_FROM(prefix, std::uint8_t, avx, avx512); \
+  INSTANTIATE_IMAGETOOLS_KERNELS_FROM(prefix, std::uint16_t, avx, avx512); \
+  INSTANTIATE_IMAGETOOLS_KERNELS_FROM(prefix, float, avx, avx512); \
+  INSTANTIATE_IMAGETOOLS_KERNELS_FROM(prefix, Half, avx, avx512); \
+  prefix template unsigned int ImageTools::downsampleVectors<avx, avx512>(const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int); \
+  prefix template unsigned int ImageTools::upsampleChangeVectors<avx, avx512>(const std::uint8_t*, const std::uint8_t*, const std::uint8_t*, const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int)
+
+template<typename To, typename From, bool avx, bool avx512>
+unsigned int ImageTools::convertVectors(const From* srcRow, To* dstRow, unsigned int width, float scale)
+{
+  // Multiplying by one is exact, so unscaled conversions do not need a loop of their own.
+  unsigned int x = 0;
+  if(avx512)
+  {
+#ifdef HAS_AVX512
+    const __m512 factor = _mm512_set1_ps(scale);
+    for(; x + 16 <= width; x += 16)
+      PixelTraits<To>::storeAVX512(dstRow + x, _mm512_mul_ps(PixelTraits<From>::loadAVX512(srcRow + x), factor));
+#endif
+  }
+  else if(avx)
+  {
+#ifdef HAS_AVX2
+    const __m256 factor = _mm256_set1_ps(scale);
+    for(; x + 8 <= width; x += 8)
+      PixelTraits<To>::storeAVX(dstRow + x, _mm256_mul_ps(PixelTraits<From>::loadAVX(srcRow + x), factor));
+#endif
+  }
+  else
+  {
+#ifdef HAS_SSE4
+    const __m128 factor = _mm_set1_ps(scale);
+    for(; x + 4 <= width; x += 4)
+      PixelTraits<To>::storeSSE(dstRow + x, _mm_mul_ps(PixelTraits<From>::loadSSE(srcRow + x), factor));
+#endif
+  }
+  return x;
+}
+
+template<bool avx, bool avx512>
+unsigned int ImageTools::downsampleVectors(const std::uint8_t* row, const std::uint8_t* nextRow, std::uint8_t* dstRow, unsigned int width)
+{
+  // Multiplying the bytes with ones and adding adjacent products sums the horizontal pairs as 16-bit integers.
+  unsigned int x = 0;
+  if(avx512)
+  {
+#ifdef HAS_AVX512
+    const __m512i ones = _mm512_set1_epi8(1);
+    const __m512i two = _mm512_set1_epi16(2);
+    // Packing works per 128-bit lane, so the quadwords of both halves are interleaved afterwards.
+    const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+    for(; x + 64 <= width; x += 64)
+    {
+      const __m512i sum1 = _mm512_add_epi16(_mm512_maddubs_epi16(_mm512_loadu_si512(row + 2 * x), ones), _mm512_maddubs_epi16(_mm512_loadu_si512(nextRow + 2 * x), ones));
+      const __m512i sum2 = _mm512_add_epi16(_mm512_maddubs_epi16(_mm512_loadu_si512(row + 2 * x + 64), ones), _mm512_maddubs_epi16(_mm512_loadu_si512(nextRow + 2 * x + 64), ones));
+      const __m512i average1 = _mm512_srli_epi16(_mm512_add_epi16(sum1, two), 2);
+      const __m512i average2 = _mm512_srli_epi16(_mm512_add_epi16(sum2, two), 2);
+      _mm512_storeu_si512(dstRow + x, _mm512_permutexvar_epi64(order, _mm512_packus_epi16(average1, average2)));
+    }
+#endif
+  }
+  else if(avx)
+  {
+#ifdef HAS_AVX2
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi16(2);
+    for(; x + 32 <= width; x += 32)
+    {
+      const __m256i sum1 = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + 2 * x)), ones), _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(nextRow + 2 * x)), ones));
+      const __m256i sum2 = _mm256_add_epi16(_mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + 2 * x + 32)), ones), _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(nextRow + 2 * x + 32)), ones));
+      const __m256i average1 = _mm256_srli_epi16(_mm256_add_epi16(sum1, two), 2);
+      const __m256i average2 = _mm256_srli_epi16(_mm256_add_epi16(sum2, two), 2);
+      // Packing works per 128-bit lane, so the quadwords of both halves are interleaved afterwards.
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstRow + x), _mm256_permute4x64_epi64(_mm256_packus_epi16(average1, average2), 0xd8));
+    }
+#endif
+  }
+  else
+  {
+#ifdef HAS_SSE4
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi16(2);
+    for(; x + 16 <= width; x += 16)
+    {
+      const __m128i sum1 = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 2 * x)), ones), _mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(nextRow + 2 * x)), ones));
+      const __m128i sum2 = _mm_add_epi16(_mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 2 * x + 16)), ones), _mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(nextRow + 2 * x + 16)), ones));
+      const __m128i average1 = _mm_srli_epi16(_mm_add_epi16(sum1, two), 2);
+      const __m128i average2 = _mm_srli_epi16(_mm_add_epi16(sum2, two), 2);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dstRow + x), _mm_packus_epi16(average1, average2));
+    }
+#endif
+  }
+  return x;
+}
+
+template<bool avx, bool avx512>
+unsigned int ImageTools::upsampleChangeVectors(const std::uint8_t* changedRow, const std::uint8_t* changedNeighborRow, const std::uint8_t* originalRow, const std::uint8_t* originalNeighborRow, const std::uint8_t* imageRow, std::uint8_t* dstRow, unsigned int width)
+{
+  // The differences are weighted vertically (3:1) and horizontally (3:1 with the left neighbor for even and with the
+  // right neighbor for odd destination columns) as 16-bit integers. Interleaving the even and odd results, unpacking
+  // the full resolution pixels and packing the sums works per 128-bit lane, so the order of the pixels is kept.
+  unsigned int x = 1;
+  if(avx512)
+  {
+#ifdef HAS_AVX512
+    const auto difference = [&](unsigned int column)
+    {
+      const __m512i changed = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(changedRow + column))), _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(originalRow + column))));
+      const __m512i neighbor = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(changedNeighborRow + column))), _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(originalNeighborRow + column))));
+      return _mm512_add_epi16(_mm512_mullo_epi16(changed, _mm512_set1_epi16(3)), neighbor);
+    };
+    for(; x + 33 <= width; x += 32)
+    {
+      const __m512i mid = _mm512_add_epi16(_mm512_mullo_epi16(difference(x), _mm512_set1_epi16(3)), _mm512_set1_epi16(8));
+      const __m512i even = _mm512_srai_epi16(_mm512_add_epi16(mid, difference(x - 1)), 4);
+      const __m512i odd = _mm512_srai_epi16(_mm512_add_epi16(mid, difference(x + 1)), 4);
+      const __m512i image = _mm512_loadu_si512(imageRow + 2 * x);
+      const __m512i result1 = _mm512_add_epi16(_mm512_unpacklo_epi16(even, odd), _mm512_unpacklo_epi8(image, _mm512_setzero_si512()));
+      const __m512i result2 = _mm512_add_epi16(_mm512_unpackhi_epi16(even, odd), _mm512_unpackhi_epi8(image, _mm512_setzero_si512()));
+      _mm512_storeu_si512(dstRow + 2 * x, _mm512_packus_epi16(result1, result2));
+    }
+#endif
+  }
+  else if(avx)
+  {
+#ifdef HAS_AVX2
+    const auto difference = [&](unsigned int column)
+    {
+      const __m256i changed = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(changedRow + column))), _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(originalRow + column))));
+      const __m256i neighbor = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(changedNeighborRow + column))), _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(originalNeighborRow + column))));
+      return _mm256_add_epi16(_mm256_mullo_epi16(changed, _mm256_set1_epi16(3)), neighbor);
+    };
+    for(; x + 17 <= width; x += 16)
+    {
+      const __m256i mid = _mm256_add_epi16(_mm256_mullo_epi16(difference(x), _mm256_set1_epi16(3)), _mm256_set1_epi16(8));
+      const __m256i even = _mm256_srai_epi16(_mm256_add_epi16(mid, difference(x - 1)), 4);
+      const __m256i odd = _mm256_srai_epi16(_mm256_add_epi16(mid, difference(x + 1)), 4);
+      const __m256i image = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(imageRow + 2 * x));
+      const __m256i result1 = _mm256_add_epi16(_mm256_unpacklo_epi16(even, odd), _mm256_unpacklo_epi8(image, _mm256_setzero_si256()));
+      const __m256i result2 = _mm256_add_epi16(_mm256_unpackhi_epi16(even, odd), _mm256_unpackhi_epi8(image, _mm256_setzero_si256()));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstRow + 2 * x), _mm256_packus_epi16(result1, result2));
+    }
+#endif
+  }
+  else
+  {
+#ifdef HAS_SSE4
+    const auto difference = [&](unsigned int column)
+    {
+      const __m128i changed = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(changedRow + column))), _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(originalRow + column))));
+      const __m128i neighbor = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(changedNeighborRow + column))), _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(originalNeighborRow + column))));
+      return _mm_add_epi16(_mm_mullo_epi16(changed, _mm_set1_epi16(3)), neighbor);
+    };
+    for(; x + 9 <= width; x += 8)
+    {
+      const __m128i mid = _mm_add_epi16(_mm_mullo_epi16(difference(x), _mm_set1_epi16(3)), _mm_set1_epi16(8));
+      const __m128i even = _mm_srai_epi16(_mm_add_epi16(mid, difference(x - 1)), 4);
+      const __m128i odd = _mm_srai_epi16(_mm_add_epi16(mid, difference(x + 1)), 4);
+      const __m128i image = _mm_loadu_si128(reinterpret_cast<const __m128i*>(imageRow + 2 * x));
+      const __m128i result1 = _mm_add_epi16(_mm_unpacklo_epi16(even, odd), _mm_unpacklo_epi8(image, _mm_setzero_si128()));
+      const __m128i result2 = _mm_add_epi16(_mm_unpackhi_epi16(even, odd), _mm_unpackhi_epi8(image, _mm_setzero_si128()));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dstRow + 2 * x), _mm_packus_epi16(result1, result2));
+    }
+#endif
+  }
+  return x;
+}
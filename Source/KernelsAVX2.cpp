@@ -0,0 +1,20 @@
+/**
+ * @file KernelsAVX2.cpp
+ *
+ * This file instantiates the kernels that use AVX2. It is the only file that is compiled with AVX2 enabled,
+ * so the rest of the program also runs on CPUs without it.
+ *
+ * @author Arne Hasselbring
+ */
+
+#include "Avg5Kernels.h"
+#include "ImageToolsKernels.h"
+#include "PeronaMalikKernels.h"
+
+#ifndef HAS_AVX2
+#error "This file must be compiled with AVX2 enabled!"
+#endif
+
+INSTANTIATE_AVG5_KERNELS(, true, true, false);
+INSTANTIATE_IMAGETOOLS_KERNELS(, true, false);
+INSTANTIATE_PERONAMALIK_KERNELS(, true, true, false);
@@ -0,0 +1,20 @@
+/**
+ * @file KernelsAVX512.cpp
+ *
+ * This file instantiates the kernels that use AVX-512. It is the only file that is compiled with AVX-512 enabled,
+ * so the rest of the program also runs on CPUs without it.
+ *
+ * @author Arne Hasselbring
+ */
+
+#include "Avg5Kernels.h"
+#include "ImageToolsKernels.h"
+#include "PeronaMalikKernels.h"
+
+#ifndef HAS_AVX512
+#error "This file must be compiled with AVX-512 enabled!"
+#endif
+
+INSTANTIATE_AVG5_KERNELS(, true, true, true);
+INSTANTIATE_IMAGETOOLS_KERNELS(, true, true);
+INSTANTIATE_PERONAMALIK_KERNELS(, true, true, true);
@@ -0,0 +1,20 @@
+/**
+ * @file KernelsSSE4.cpp
+ *
+ * This file instantiates the kernels that use SSE4.1. It is the only file that is compiled with SSE4.1 enabled,
+ * so the rest of the program also runs on CPUs without it.
+ *
+ * @author Arne Hasselbring
+ */
+
+#include "Avg5Kernels.h"
+#include "ImageToolsKernels.h"
+#include "PeronaMalikKernels.h"
+
+#ifndef HAS_SSE4
+#error "This file must be compiled with SSE4.1 enabled!"
+#endif
+
+INSTANTIATE_AVG5_KERNELS(, true, false, false);
+INSTANTIATE_IMAGETOOLS_KERNELS(, false, false);
+INSTANTIATE_PERONAMALIK_KERNELS(, true, false, false);
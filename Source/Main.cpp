@@ -6,21 +6,38 @@
  * @author Arne Hasselbring
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <thread>
+#include <vector>
 
+#include "AlignedMemory.h"
+#include "Avg5.h"
+#include "BufferPool.h"
+#include "CPUFeatures.h"
 #include "Chronometer.h"
 #include "PeronaMalik.h"
 #include "Image.h"
 #include "ImageTools.h"
+#include "ThreadPool.h"
 
 int main(int argc, char* argv[])
 {
   float kappa = 1.f, dt = 1.f;
   unsigned int times = 300;
-  bool isotropic = false;
+  bool refinementGiven = false;
+  double minPSNR = 0.0;
+  unsigned int concurrentCallers = 0;
+  unsigned int thumbnailSize = 0;
+  unsigned int averageIterations = 0;
+  PeronaMalik::Options options;
+  options.optimizationLevel = OptimizationLevel::automatic;
+  MemoryPolicy policy;
 
   if(argc < 2)
     return EXIT_FAILURE;
@@ -45,33 +62,280 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
       times = atoi(argv[i]);
     }
+    else if(!strcmp(argv[i], "-threads"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      options.threads = atoi(argv[i]);
+    }
+    else if(!strcmp(argv[i], "-blockdepth"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      options.blockDepth = atoi(argv[i]);
+      // The filter would silently clamp a deeper block.
+      if(options.blockDepth > PeronaMalik::maxBlockDepth)
+        return EXIT_FAILURE;
+    }
+    else if(!strcmp(argv[i], "-tolerance"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      options.tolerance = atoi(argv[i]);
+    }
+    else if(!strcmp(argv[i], "-pyramid"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      options.pyramidLevels = atoi(argv[i]);
+    }
+    else if(!strcmp(argv[i], "-refine"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      options.refinementIterations = atoi(argv[i]);
+      refinementGiven = true;
+    }
+    else if(!strcmp(argv[i], "-psnr"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      minPSNR = atof(argv[i]);
+    }
+    else if(!strcmp(argv[i], "-concurrent"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      concurrentCallers = atoi(argv[i]);
+    }
+    else if(!strcmp(argv[i], "-batch"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      thumbnailSize = atoi(argv[i]);
+    }
+    else if(!strcmp(argv[i], "-avg5"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      averageIterations = atoi(argv[i]);
+    }
     else if(!strcmp(argv[i], "-isotropic"))
-      isotropic = !isotropic;
+      options.isotropic = !options.isotropic;
+    else if(!strcmp(argv[i], "-lut"))
+      options.lookupTable = true;
+    else if(!strcmp(argv[i], "-fixedpoint"))
+      options.fixedPoint = true;
+    else if(!strcmp(argv[i], "-tiles"))
+      options.activeTiles = true;
+    else if(!strcmp(argv[i], "-aos"))
+      options.semiImplicit = true;
+    else if(!strcmp(argv[i], "-rowstreaming"))
+      options.rowStreaming = true;
+    else if(!strcmp(argv[i], "-level"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      options.optimizationLevel = CPUFeatures::parse(argv[i]);
+    }
+    else if(!strcmp(argv[i], "-precision"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      if(!strcmp(argv[i], "uint8"))
+        options.precision = PixelFormat::uint8;
+      else if(!strcmp(argv[i], "uint16"))
+        options.precision = PixelFormat::uint16;
+      else if(!strcmp(argv[i], "float"))
+        options.precision = PixelFormat::float32;
+      else if(!strcmp(argv[i], "half"))
+        options.precision = PixelFormat::float16;
+      else
+        return EXIT_FAILURE;
+    }
+    else if(!strcmp(argv[i], "-diffusivity"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      if(!strcmp(argv[i], "rational"))
+        options.diffusivity = DiffusivityFunction::rational;
+      else if(!strcmp(argv[i], "exponential"))
+        options.diffusivity = DiffusivityFunction::exponential;
+      else if(!strcmp(argv[i], "tukey"))
+        options.diffusivity = DiffusivityFunction::tukey;
+      else if(!strcmp(argv[i], "charbonnier"))
+        options.diffusivity = DiffusivityFunction::charbonnier;
+      else if(!strcmp(argv[i], "weickert"))
+        options.diffusivity = DiffusivityFunction::weickert;
+      else
+        return EXIT_FAILURE;
+    }
+    else if(!strcmp(argv[i], "-stores"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      if(!strcmp(argv[i], "regular"))
+        options.storePolicy = StorePolicy::regular;
+      else if(!strcmp(argv[i], "streaming"))
+        options.storePolicy = StorePolicy::streaming;
+      else if(!strcmp(argv[i], "auto"))
+        options.storePolicy = StorePolicy::automatic;
+      else
+        return EXIT_FAILURE;
+    }
+    else if(!strcmp(argv[i], "-border"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      if(!strcmp(argv[i], "zero"))
+        options.border = BorderPolicy::zero;
+      else if(!strcmp(argv[i], "replicate"))
+        options.border = BorderPolicy::replicate;
+      else if(!strcmp(argv[i], "mirror"))
+        options.border = BorderPolicy::mirror;
+      else
+        return EXIT_FAILURE;
+    }
+    else if(!strcmp(argv[i], "-hugepages"))
+      policy.pages = PageMode::transparentHuge;
+    else if(!strcmp(argv[i], "-explicithugepages"))
+      policy.pages = PageMode::explicitHuge;
+    else if(!strcmp(argv[i], "-interleave"))
+      policy.placement = NumaPlacement::interleave;
+    else if(!strcmp(argv[i], "-node"))
+    {
+      if(++i == argc)
+        return EXIT_FAILURE;
+      policy.placement = NumaPlacement::node;
+      policy.node = atoi(argv[i]);
+    }
     else
       return EXIT_FAILURE;
   }
 
+  AlignedMemory::setDefaultPolicy(policy);
+
+  // By default, the pyramid computes an eighth of the iterations at full resolution.
+  if(!refinementGiven)
+    options.refinementIterations = times / 8;
+
   Image image = ImageTools::loadImage(argv[1], ImageFormat::YCbCr);
 
-  PeronaMalik pmAVX(kappa, dt, times, isotropic, OptimizationLevel::avx2);
-  PeronaMalik pmSSE(kappa, dt, times, isotropic, OptimizationLevel::sse4);
+  PeronaMalik::Options sseOptions = options;
+  sseOptions.optimizationLevel = OptimizationLevel::sse4;
+  PeronaMalik pmAVX(kappa, dt, times, options);
+  PeronaMalik pmSSE(kappa, dt, times, sseOptions);
 
   for(unsigned int i = 0; i < 100; i++)
   {
-    Image result = pmAVX.apply(image);
+    unsigned int iterations;
+    Image result = pmAVX.apply(image, iterations);
 
     if(i)
       continue;
 
+    std::cout << "Iterations: " << iterations << '\n';
+
     Image result2 = pmSSE.apply(image);
     if(!ImageTools::compare(result, result2))
       std::cout << "Images are different!\n";
 
+    if(options.pyramidLevels > 0)
+    {
+      // The pyramid is compared to the iterations at full resolution.
+      PeronaMalik::Options fullOptions = options;
+      fullOptions.pyramidLevels = 0;
+      fullOptions.refinementIterations = 0;
+      PeronaMalik pmFull(kappa, dt, times, fullOptions);
+      const double psnr = ImageTools::psnr(result, pmFull.apply(image));
+      std::cout << "PSNR to full resolution: " << psnr << " dB\n";
+      if(psnr < minPSNR)
+      {
+        std::cout << "The PSNR is below " << minPSNR << " dB!\n";
+        return EXIT_FAILURE;
+      }
+    }
+
+    if(concurrentCallers > 0)
+    {
+      // Several threads apply the same filter at the same time and must get the result of the sequential call.
+      const auto throughput = [&](unsigned int callers)
+      {
+        std::atomic<unsigned int> mismatches(0);
+        std::vector<std::thread> callerThreads;
+        const auto start = std::chrono::high_resolution_clock::now();
+        for(unsigned int caller = 0; caller < callers; caller++)
+          callerThreads.emplace_back([&]
+          {
+            for(unsigned int j = 0; j < 4; j++)
+              if(!ImageTools::compare(result, pmAVX.apply(image)))
+                mismatches++;
+          });
+        for(std::thread& thread : callerThreads)
+          thread.join();
+        const std::chrono::duration<double> seconds = std::chrono::high_resolution_clock::now() - start;
+        if(mismatches > 0)
+          std::cout << "Concurrent results are different!\n";
+        return callers * 4 / seconds.count();
+      };
+      const double sequential = throughput(1);
+      const double concurrent = throughput(concurrentCallers);
+      std::cout << "Throughput: " << sequential << " images/s with 1 caller, " << concurrent << " images/s with " << concurrentCallers << " callers (speedup " << concurrent / sequential << ")\n";
+      // The callers should scale linearly until each of them would get less than the threads of one call.
+      const unsigned int hardwareThreads = ThreadPool::getHardwareThreads();
+      const unsigned int threadsPerCall = options.threads > 0 ? std::min(options.threads, hardwareThreads) : hardwareThreads;
+      const unsigned int idealSpeedup = std::max(1u, std::min(concurrentCallers, hardwareThreads / threadsPerCall));
+      if(concurrent / sequential < 0.5 * idealSpeedup)
+      {
+        std::cout << "The speedup is less than half of " << idealSpeedup << "!\n";
+        return EXIT_FAILURE;
+      }
+    }
+
+    if(thumbnailSize > 0)
+    {
+      // The image is cut into thumbnails that are denoised one by one and as a batch.
+      std::vector<Image> thumbnails;
+      for(unsigned int y = 0; y + thumbnailSize <= image.height; y += thumbnailSize)
+        for(unsigned int x = 0; x + thumbnailSize <= image.width; x += thumbnailSize)
+          thumbnails.emplace_back(image.view(x, y, thumbnailSize, thumbnailSize));
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<Image> singleResults;
+      for(const Image& thumbnail : thumbnails)
+        singleResults.push_back(pmAVX.apply(thumbnail));
+      const std::chrono::duration<double> singleSeconds = std::chrono::high_resolution_clock::now() - start;
+      start = std::chrono::high_resolution_clock::now();
+      std::vector<Image> batchResults = pmAVX.applyBatch(thumbnails);
+      const std::chrono::duration<double> batchSeconds = std::chrono::high_resolution_clock::now() - start;
+      for(std::size_t j = 0; j < thumbnails.size(); j++)
+        if(!ImageTools::compare(singleResults[j], batchResults[j]))
+        {
+          std::cout << "Batch results are different!\n";
+          break;
+        }
+      std::cout << "Throughput: " << thumbnails.size() / singleSeconds.count() << " images/s one by one, " << thumbnails.size() / batchSeconds.count() << " images/s as a batch\n";
+    }
+
+    if(averageIterations > 0)
+    {
+      // The fused iterations of Avg5 must equal as many separate calls of the scalar filter.
+      Avg5 fused(options.optimizationLevel, options.storePolicy, options.threads, averageIterations);
+      Avg5 single;
+      Image fusedResult = fused.apply(image);
+      Image singleResult = single.apply(image);
+      for(unsigned int j = 1; j < averageIterations; j++)
+        singleResult = single.apply(singleResult);
+      if(!ImageTools::compare(fusedResult, singleResult))
+        std::cout << "Avg5 results are different!\n";
+    }
+
     ImageTools::storeImage("input.png", image);
     ImageTools::storeImage("output.png", result);
   }
 
   Chronometer::printStats();
+  BufferPool::printStats();
+  AlignedMemory::printStats();
 
   return EXIT_SUCCESS;
 }
@@ -24,10 +24,12 @@ public:
   virtual ~Operator() = default;
   /**
    * @brief Applies the operator to an image.
+   *
+   * Images convert implicitly to views, so both whole images and regions of them can be passed.
    * @param The operand.
    * @return The value.
    */
-  virtual Image apply(const Image& image) = 0;
+  virtual Image apply(const ImageView& image) = 0;
 };
 
 using OperatorPtr = std::unique_ptr<Operator>;
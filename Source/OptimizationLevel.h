@@ -14,7 +14,9 @@
 enum class OptimizationLevel
 {
   noOptimization,         ///< The code is written in plain C++ (compiler optimizations are not influenced by this).
-  sse4,                   ///< Intrinsics for SSE up to SSE4.1 are used.
+  sse4,                   ///< Intrinsics for SSE up to SSE4.1 (and POPCNT) are used.
   avx2,                   ///< Intrinsics for AVX2 are used.
+  avx512,                 ///< Intrinsics for AVX-512 (F, BW and VL) are used.
+  automatic,              ///< The best level that the CPU supports is chosen at runtime (see CPUFeatures).
   numOfOptimizationLevels ///< The number of optimization levels.
 };
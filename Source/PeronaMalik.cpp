@@ -6,310 +6,846 @@
  * @author Arne Hasselbring
  */
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <limits>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "AlignedMemory.h"
+#include "CPUFeatures.h"
 #include "Chronometer.h"
 #include "Image.h"
+#include "ImageTools.h"
+#include "PeronaMalikKernels.h"
 #include "SIMD.h"
+#include "ThreadPool.h"
 
 #include "PeronaMalik.h"
 
-PeronaMalik::PeronaMalik(float kappa, float dt, unsigned int times, bool isotropic, OptimizationLevel optimizationLevel) :
+// The vectorized row functions are compiled with their instruction sets in KernelsSSE4.cpp, KernelsAVX2.cpp and KernelsAVX512.cpp.
+INSTANTIATE_PERONAMALIK_KERNELS(extern, true, false, false);
+INSTANTIATE_PERONAMALIK_KERNELS(extern, true, true, false);
+INSTANTIATE_PERONAMALIK_KERNELS(extern, true, true, true);
+
+constexpr unsigned int PeronaMalik::maxBlockDepth;
+constexpr unsigned int PeronaMalik::maxPyramidLevels;
+constexpr unsigned int PeronaMalik::maxBatchWidth;
+constexpr unsigned int PeronaMalik::ringRows;
+constexpr unsigned int PeronaMalik::tileWidth;
+constexpr unsigned int PeronaMalik::tileHeight;
+constexpr int PeronaMalik::maxFixedPointFlux;
+
+PeronaMalik::PeronaMalik(float kappa, float dt, unsigned int times) :
+  PeronaMalik(kappa, dt, times, Options())
+{
+}
+
+PeronaMalik::PeronaMalik(float kappa, float dt, unsigned int times, const Options& options) :
   kappa(kappa),
   dt(dt),
   times(times),
-  isotropic(isotropic),
-  optimizationLevel(optimizationLevel)
+  isotropic(options.isotropic),
+  diffusivityFunction(options.diffusivity),
+  optimizationLevel(CPUFeatures::resolve(options.optimizationLevel)),
+  precision(options.precision),
+  border(options.border),
+  threads(options.threads > 0 ? options.threads : ThreadPool::getHardwareThreads()),
+  blockDepth(std::max(1u, std::min(options.blockDepth, maxBlockDepth))),
+  fixedPoint(options.fixedPoint),
+  fixedPointFluxes(),
+  tolerance(options.tolerance),
+  activeTiles(options.activeTiles),
+  semiImplicit(options.semiImplicit),
+  pyramidLevels(std::min(options.pyramidLevels, maxPyramidLevels)),
+  refinementIterations(options.refinementIterations),
+  rowStreaming(options.rowStreaming),
+  storePolicy(options.storePolicy)
+{
+  if(options.lookupTable)
+    diffusivityTable = createDiffusivityTable(diffusivityFunction, kappa * kappa, isotropic);
+  if(fixedPoint)
+    fixedPointFluxes = createFixedPointFlux(diffusivityFunction, kappa * kappa, dt);
+}
+
+Image PeronaMalik::apply(const ImageView& image)
 {
+  unsigned int iterations;
+  return apply(image, iterations);
 }
 
-Image PeronaMalik::apply(const Image& image)
+Image PeronaMalik::apply(const ImageView& image, unsigned int& iterations)
+{
+  if(pyramidLevels > 0)
+    return applyPyramid(image, iterations);
+  return applyLevel(image, times, nullptr, iterations);
+}
+
+std::vector<Image> PeronaMalik::applyBatch(const std::vector<Image>& images)
+{
+  Chronometer time("PeronaMalik::applyBatch");
+
+  std::vector<Image> results;
+  results.reserve(images.size());
+  for(const Image& image : images)
+    results.emplace_back(image.width, image.height, true, 1);
+
+  // The pyramid and the semi-implicit scheme couple the columns of all packed images and a tolerance would stop them together.
+  if(pyramidLevels > 0 || semiImplicit || tolerance > 0)
+  {
+    const unsigned int tasks = std::max(1u, std::min(threads, static_cast<unsigned int>(images.size())));
+    ThreadPool::run(tasks, [&](unsigned int task)
+    {
+      for(std::size_t i = task; i < images.size(); i += tasks)
+        results[i] = apply(images[i]);
+    });
+    return results;
+  }
+
+  // The images are sorted by height, so that consecutive images of the same height can be packed together.
+  std::vector<std::size_t> order(images.size());
+  for(std::size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return images[a].height < images[b].height; });
+  std::vector<std::vector<std::size_t>> packs;
+  unsigned int packWidth = 0;
+  for(std::size_t i : order)
+  {
+    if(packs.empty() || images[packs.back().front()].height != images[i].height || packWidth + 2 + images[i].width > maxBatchWidth)
+    {
+      packs.emplace_back();
+      packWidth = images[i].width;
+    }
+    else
+      packWidth += 2 + images[i].width;
+    packs.back().push_back(i);
+  }
+
+  const unsigned int tasks = std::max(1u, std::min(threads, static_cast<unsigned int>(packs.size())));
+  ThreadPool::run(tasks, [&](unsigned int task)
+  {
+    for(std::size_t p = task; p < packs.size(); p += tasks)
+    {
+      const std::vector<std::size_t>& pack = packs[p];
+      std::vector<unsigned int> starts;
+      unsigned int width = 0;
+      for(std::size_t i : pack)
+      {
+        starts.push_back(width);
+        width += images[i].width + 2;
+      }
+      const unsigned int height = images[pack.front()].height;
+
+      Image packed(width - 2, height, true, 1);
+      for(std::size_t k = 0; k < pack.size(); k++)
+        for(unsigned int y = 0; y < height; y++)
+          std::memcpy(packed[y] + starts[k], images[pack[k]][y], images[pack[k]].width);
+      fillSeparators(packed, starts, border);
+      packed.fillBorder(border);
+
+      unsigned int iterations;
+      const Image result = applyLevel(packed, times, pack.size() > 1 ? &starts : nullptr, iterations);
+      for(std::size_t k = 0; k < pack.size(); k++)
+      {
+        Image& dst = results[pack[k]];
+        for(unsigned int y = 0; y < height; y++)
+          std::memcpy(dst[y], result[y] + starts[k], dst.width);
+        dst.fillBorder(border);
+      }
+    }
+  });
+  return results;
+}
+
+Image PeronaMalik::applyPyramid(const ImageView& image, unsigned int& iterations)
+{
+  Chronometer time("PeronaMalik::applyPyramid");
+
+  std::vector<Image> pyramid;
+  pyramid.reserve(pyramidLevels);
+  ImageView source = image;
+  while(pyramid.size() < pyramidLevels && source.width > 1 && source.height > 1)
+  {
+    pyramid.push_back(ImageTools::downsample(source, optimizationLevel));
+    source = pyramid.back();
+  }
+  if(pyramid.empty())
+    return applyLevel(image, times, nullptr, iterations);
+
+  // An iteration on level l diffuses as long as 4^l iterations at full resolution. The finer levels compute at most
+  // the refinement iterations and the coarsest level the rest of the diffusion time.
+  std::vector<unsigned int> levelTimes(pyramid.size() + 1);
+  unsigned int remaining = times;
+  unsigned int scale = 1;
+  for(std::size_t level = 0; level < pyramid.size(); level++)
+  {
+    levelTimes[level] = std::min(refinementIterations, remaining / scale);
+    remaining -= levelTimes[level] * scale;
+    scale *= 4;
+  }
+  levelTimes.back() = (remaining + scale - 1) / scale;
+
+  // Each finer level starts from its own pixels plus the change that the iterations on the coarser level have made,
+  // so it keeps the details that the coarser level cannot represent.
+  iterations = 0;
+  Image result = levelTimes.back() > 0 ? applyLevel(pyramid.back(), levelTimes.back(), nullptr, iterations) : pyramid.back();
+  for(std::size_t level = pyramid.size(); level-- > 0;)
+  {
+    const ImageView fine = level > 0 ? pyramid[level - 1].view() : image;
+    result = ImageTools::upsampleChange(result, pyramid[level], fine, optimizationLevel);
+    iterations = 0;
+    if(levelTimes[level] > 0)
+      result = applyLevel(result, levelTimes[level], nullptr, iterations);
+  }
+  return result;
+}
+
+Image PeronaMalik::applyLevel(const ImageView& image, unsigned int times, const std::vector<unsigned int>* starts, unsigned int& iterations)
 {
   switch(optimizationLevel)
   {
     case OptimizationLevel::sse4:
+      return applyDiffusivity<true, false, false>(image, times, starts, iterations);
+    case OptimizationLevel::avx512:
+      return applyDiffusivity<true, true, true>(image, times, starts, iterations);
+    case OptimizationLevel::avx2:
+      return applyDiffusivity<true, true, false>(image, times, starts, iterations);
+    case OptimizationLevel::noOptimization:
+    default:
+      return applyDiffusivity<false, false, false>(image, times, starts, iterations);
+  }
+}
+
+template<bool simd, bool avx, bool avx512>
+Image PeronaMalik::applyDiffusivity(const ImageView& image, unsigned int times, const std::vector<unsigned int>* starts, unsigned int& iterations)
+{
+  // The diffusivity function is a template parameter of the kernels, so it is only chosen once per image.
+  switch(diffusivityFunction)
+  {
+    case DiffusivityFunction::exponential:
       if(isotropic)
-        return applyT<true, true, false>(image, kappa, dt, times);
+        return applyPrecision<DiffusivityFunction::exponential, true, simd, avx, avx512>(image, times, starts, iterations);
       else
-        return applyT<false, true, false>(image, kappa, dt, times);
-    case OptimizationLevel::avx2:
+        return applyPrecision<DiffusivityFunction::exponential, false, simd, avx, avx512>(image, times, starts, iterations);
+    case DiffusivityFunction::tukey:
       if(isotropic)
-        return applyT<true, true, true>(image, kappa, dt, times);
+        return applyPrecision<DiffusivityFunction::tukey, true, simd, avx, avx512>(image, times, starts, iterations);
       else
-        return applyT<false, true, true>(image, kappa, dt, times);
-    case OptimizationLevel::noOptimization:
+        return applyPrecision<DiffusivityFunction::tukey, false, simd, avx, avx512>(image, times, starts, iterations);
+    case DiffusivityFunction::charbonnier:
+      if(isotropic)
+        return applyPrecision<DiffusivityFunction::charbonnier, true, simd, avx, avx512>(image, times, starts, iterations);
+      else
+        return applyPrecision<DiffusivityFunction::charbonnier, false, simd, avx, avx512>(image, times, starts, iterations);
+    case DiffusivityFunction::weickert:
+      if(isotropic)
+        return applyPrecision<DiffusivityFunction::weickert, true, simd, avx, avx512>(image, times, starts, iterations);
+      else
+        return applyPrecision<DiffusivityFunction::weickert, false, simd, avx, avx512>(image, times, starts, iterations);
+    case DiffusivityFunction::rational:
     default:
       if(isotropic)
-        return applyT<true, false, false>(image, kappa, dt, times);
+        return applyPrecision<DiffusivityFunction::rational, true, simd, avx, avx512>(image, times, starts, iterations);
       else
-        return applyT<false, false, false>(image, kappa, dt, times);
+        return applyPrecision<DiffusivityFunction::rational, false, simd, avx, avx512>(image, times, starts, iterations);
   }
 }
 
-template<bool isotropic>
-ALWAYSINLINE void PeronaMalik::diffusionSSE(__m128i firstDerivativeXi, __m128i firstDerivativeYi, __m128i& res, __m128 kappaSqrVec, __m128 dtVec, __m128& lastScaledFirstDerivativeX, float*& cacheptr)
+template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+Image PeronaMalik::applyPrecision(const ImageView& image, unsigned int times, const std::vector<unsigned int>* starts, unsigned int& iterations)
 {
-  __m128 scaledFirstDerivativeX, scaledFirstDerivativeY;
-  __m128 firstDerivativeX = _mm_cvtepi32_ps(firstDerivativeXi), firstDerivativeY = _mm_cvtepi32_ps(firstDerivativeYi);
+  // The wide precisions are not quantized to whole pixel values, so they do not stop early.
+  iterations = times;
+  // The columns between packed images are only restored after whole passes. Row streaming is capped like the block depth,
+  // because each band recomputes depth - 1 rows of its neighbors and the iterations of a pass are computed even if an earlier one has converged.
+  const unsigned int depth = starts ? 1 : (rowStreaming ? std::min(times, maxBlockDepth) : blockDepth);
+  if(semiImplicit)
+    return applyAOS<diffusivity, isotropic, simd, avx, avx512>(image, kappa, dt, times, border, threads);
+  switch(precision)
+  {
+    case PixelFormat::uint16:
+      return applyWideT<diffusivity, isotropic, simd, avx, avx512, std::uint16_t>(image, kappa, dt, times, border, threads, depth, starts);
+    case PixelFormat::float32:
+      return applyWideT<diffusivity, isotropic, simd, avx, avx512, float>(image, kappa, dt, times, border, threads, depth, starts);
+    case PixelFormat::float16:
+      return applyWideT<diffusivity, isotropic, simd, avx, avx512, Half>(image, kappa, dt, times, border, threads, depth, starts);
+    case PixelFormat::uint8:
+    default:
+    {
+      // The anisotropic table is indexed by derivatives in [-255, 255].
+      const float* table = diffusivityTable.empty() ? nullptr : diffusivityTable.data() + (isotropic ? 0 : 255);
+      // The isotropic diffusivity depends on both derivatives, so it cannot be approximated by one-dimensional tables.
+      const FixedPointFlux* flux = fixedPoint && !isotropic ? &fixedPointFluxes : nullptr;
+      if(activeTiles)
+        return applyTiles<diffusivity, isotropic, simd, avx, avx512>(image, kappa, dt, times, border, threads, table, flux, tolerance, starts, iterations);
+      return applyT<diffusivity, isotropic, simd, avx, avx512>(image, kappa, dt, times, border, threads, depth, table, flux, tolerance, storePolicy, starts, iterations);
+    }
+  }
+}
 
+float PeronaMalik::computeDiffusivity(DiffusivityFunction diffusivity, float sqrNorm, float kappaSqr)
+{
+  switch(diffusivity)
+  {
+    case DiffusivityFunction::exponential:
+      return DiffusivityTraits<DiffusivityFunction::exponential>::compute(sqrNorm, kappaSqr);
+    case DiffusivityFunction::tukey:
+      return DiffusivityTraits<DiffusivityFunction::tukey>::compute(sqrNorm, kappaSqr);
+    case DiffusivityFunction::charbonnier:
+      return DiffusivityTraits<DiffusivityFunction::charbonnier>::compute(sqrNorm, kappaSqr);
+    case DiffusivityFunction::weickert:
+      return DiffusivityTraits<DiffusivityFunction::weickert>::compute(sqrNorm, kappaSqr);
+    case DiffusivityFunction::rational:
+    default:
+      return DiffusivityTraits<DiffusivityFunction::rational>::compute(sqrNorm, kappaSqr);
+  }
+}
+
+std::vector<float> PeronaMalik::createDiffusivityTable(DiffusivityFunction diffusivity, float kappaSqr, bool isotropic)
+{
+  // The entries are computed like in diffusion so that looking them up does not change the results.
+  // This includes the rounding mode, because the kernels do not change the MXCSR (they truncate explicitly).
+  std::vector<float> table;
   if(isotropic)
   {
-    __m128 sqrNormXY = _mm_add_ps(_mm_mul_ps(firstDerivativeX, firstDerivativeX), _mm_mul_ps(firstDerivativeY, firstDerivativeY));
-    __m128 g = _mm_div_ps(kappaSqrVec, _mm_add_ps(kappaSqrVec, sqrNormXY));
-    scaledFirstDerivativeX = _mm_mul_ps(firstDerivativeX, g);
-    scaledFirstDerivativeY = _mm_mul_ps(firstDerivativeY, g);
+    table.resize(2 * 255 * 255 + 1);
+    for(unsigned int sqrNorm = 0; sqrNorm < table.size(); sqrNorm++)
+      table[sqrNorm] = computeDiffusivity(diffusivity, static_cast<float>(sqrNorm), kappaSqr);
   }
   else
   {
-    __m128 gX = _mm_div_ps(kappaSqrVec, _mm_add_ps(kappaSqrVec, _mm_mul_ps(firstDerivativeX, firstDerivativeX)));
-    __m128 gY = _mm_div_ps(kappaSqrVec, _mm_add_ps(kappaSqrVec, _mm_mul_ps(firstDerivativeY, firstDerivativeY)));
-    scaledFirstDerivativeX = _mm_mul_ps(firstDerivativeX, gX);
-    scaledFirstDerivativeY = _mm_mul_ps(firstDerivativeY, gY);
+    table.resize(2 * 255 + 1);
+    for(int derivative = -255; derivative <= 255; derivative++)
+    {
+      const float firstDerivative = static_cast<float>(derivative);
+      table[derivative + 255] = firstDerivative * computeDiffusivity(diffusivity, firstDerivative * firstDerivative, kappaSqr);
+    }
   }
+  return table;
+}
 
-  __m128 lastColScaledFirstDerivativeX = _mm_castsi128_ps(_mm_alignr_epi8(_mm_castps_si128(scaledFirstDerivativeX), _mm_castps_si128(lastScaledFirstDerivativeX), 12));
-  __m128 lastRowScaledFirstDerivativeY = _mm_load_ps(cacheptr);
-
-  __m128 eulerStep = _mm_mul_ps(dtVec, _mm_add_ps(_mm_sub_ps(scaledFirstDerivativeX, lastColScaledFirstDerivativeX), _mm_sub_ps(scaledFirstDerivativeY, lastRowScaledFirstDerivativeY)));
-  res = _mm_cvtps_epi32(eulerStep);
-
-  lastScaledFirstDerivativeX = scaledFirstDerivativeX;
-  _mm_store_ps(cacheptr, scaledFirstDerivativeY);
+PeronaMalik::FixedPointFlux PeronaMalik::createFixedPointFlux(DiffusivityFunction diffusivity, float kappaSqr, float dt)
+{
+  // The rational flux is computed in double precision, the others like in the single precision path.
+  const auto exactFlux = [diffusivity, kappaSqr](int firstDerivative)
+  {
+    const double d = firstDerivative;
+    if(diffusivity == DiffusivityFunction::rational)
+      return d * kappaSqr / (kappaSqr + d * d);
+    return d * computeDiffusivity(diffusivity, static_cast<float>(firstDerivative * firstDerivative), kappaSqr);
+  };
+
+  // The fluxes get as many fractional bits as possible without exceeding the largest flux.
+  double maxFlux = 0.0;
+  for(int d = 0; d <= 256; d++)
+    maxFlux = std::max(maxFlux, dt * exactFlux(d));
+  FixedPointFlux flux;
+  flux.shift = 0;
+  while(flux.shift < 14 && maxFlux * (2 << flux.shift) <= maxFixedPointFlux)
+    flux.shift++;
+
+  const double scale = dt * static_cast<double>(1 << flux.shift);
+  const auto fixedFlux = [&](int firstDerivative) { return std::min(exactFlux(firstDerivative) * scale, static_cast<double>(maxFixedPointFlux)); };
+  const auto round = [](double value) { return static_cast<std::int16_t>(std::lround(value)); };
+  for(int i = 0; i < 8; i++)
+  {
+    flux.base[i] = round(fixedFlux(i));
+    flux.linear[i] = flux.quadratic[i] = 0;
+  }
+  for(int i = 8; i < 16; i++)
+  {
+    // The polynomial of a segment interpolates the fluxes at the start and the middle of the derivatives it is used for and at the start of the next segment.
+    const int start = std::max(32 * (i - 8), 8);
+    const int middle = (start + 32 * (i - 7)) / 2;
+    const double t0 = (start % 32) / 32.0, t1 = (middle % 32) / 32.0, t2 = 1.0;
+    const double f0 = fixedFlux(start), f1 = fixedFlux(middle), f2 = fixedFlux(32 * (i - 7));
+    const double slope01 = (f1 - f0) / (t1 - t0), slope12 = (f2 - f1) / (t2 - t1);
+    const double quadratic = (slope12 - slope01) / (t2 - t0);
+    const double linear = slope01 - quadratic * (t0 + t1);
+    flux.base[i] = round(f0 - linear * t0 - quadratic * t0 * t0);
+    flux.linear[i] = round(linear);
+    flux.quadratic[i] = round(quadratic);
+  }
+  return flux;
+}
 
-  cacheptr += 4;
+int PeronaMalik::fixedPointFlux(int firstDerivative, const FixedPointFlux& flux)
+{
+  // This rounds like _mm_mulhrs_epi16.
+  const auto mulhrs = [](int a, int b) { return (a * b + 0x4000) >> 15; };
+  const int absolute = std::abs(firstDerivative);
+  const int index = std::min(absolute, 8 + (absolute >> 5));
+  const int t = (absolute & 31) << 10;
+  const int value = flux.base[index] + mulhrs(flux.linear[index] + mulhrs(flux.quadratic[index], t), t);
+  return firstDerivative < 0 ? -value : value;
 }
 
-template<bool isotropic>
-ALWAYSINLINE void PeronaMalik::diffusionAVX(__m256i firstDerivativeXi, __m256i firstDerivativeYi, __m256i& res, __m256 kappaSqrVec, __m256 dtVec, __m256& lastScaledFirstDerivativeX, float*& cacheptr)
+template<typename Pixel>
+void PeronaMalik::fillSeparators(ImageT<Pixel>& image, const std::vector<unsigned int>& starts, BorderPolicy border)
 {
-  __m256 scaledFirstDerivativeX, scaledFirstDerivativeY;
-  __m256 firstDerivativeX = _mm256_cvtepi32_ps(firstDerivativeXi), firstDerivativeY = _mm256_cvtepi32_ps(firstDerivativeYi);
+  for(std::size_t k = 1; k < starts.size(); k++)
+  {
+    const unsigned int start = starts[k - 1];
+    const unsigned int width = starts[k] - 2 - start;
+    for(unsigned int y = 0; y < image.height; y++)
+    {
+      Pixel* row = image[y];
+      row[start + width] = border == BorderPolicy::zero ? Pixel() : row[start + ImageT<Pixel>::borderSource(width, width, border)];
+      row[starts[k] - 1] = row[starts[k]];
+    }
+  }
+}
 
-  if(isotropic)
+template<typename Pixel, typename RowFunction>
+void PeronaMalik::diffuseBand(const ImageViewT<Pixel>& src, ImageT<Pixel>& dst, unsigned int stages, unsigned int yBegin, unsigned int yEnd, BorderPolicy border, Pixel* rows, float* caches, unsigned int* changes, RowFunction diffuseRow)
+{
+  const unsigned int width = src.width;
+  const unsigned int height = src.height;
+  const std::size_t stride = dst.stride;
+  Pixel* const scratch = rows + (stages - 1) * ringRows * stride;
+  const auto ringRow = [&](unsigned int stage, unsigned int y) { return rows + (stage * ringRows + y % ringRows) * stride; };
+
+  // Stage s computes the rows [begin[s], end[s]) of the iteration s + 1 of the pass (a row streaming pass has a stage per iteration).
+  std::vector<unsigned int> begin(stages), end(stages), next(stages);
+  for(unsigned int s = 0; s < stages; s++)
   {
-    __m256 sqrNormXY = _mm256_add_ps(_mm256_mul_ps(firstDerivativeX, firstDerivativeX), _mm256_mul_ps(firstDerivativeY, firstDerivativeY));
-    __m256 g = _mm256_div_ps(kappaSqrVec, _mm256_add_ps(kappaSqrVec, sqrNormXY));
-    scaledFirstDerivativeX = _mm256_mul_ps(firstDerivativeX, g);
-    scaledFirstDerivativeY = _mm256_mul_ps(firstDerivativeY, g);
+    const unsigned int overlap = stages - 1 - s;
+    begin[s] = yBegin > overlap ? yBegin - overlap : 0;
+    end[s] = std::min(height, yEnd + overlap);
+    // The row above the first row is only computed to initialize the cache.
+    next[s] = begin[s] > 0 ? begin[s] - 1 : 0;
+    std::memset(caches + s * stride, 0, stride * sizeof(float));
+    changes[s] = 0;
   }
-  else
+
+  while(next[stages - 1] < end[stages - 1])
   {
-    __m256 gX = _mm256_div_ps(kappaSqrVec, _mm256_add_ps(kappaSqrVec, _mm256_mul_ps(firstDerivativeX, firstDerivativeX)));
-    __m256 gY = _mm256_div_ps(kappaSqrVec, _mm256_add_ps(kappaSqrVec, _mm256_mul_ps(firstDerivativeY, firstDerivativeY)));
-    scaledFirstDerivativeX = _mm256_mul_ps(firstDerivativeX, gX);
-    scaledFirstDerivativeY = _mm256_mul_ps(firstDerivativeY, gY);
+    for(unsigned int s = 0; s < stages; s++)
+    {
+      const unsigned int y = next[s];
+      // The rows y and y + 1 of the previous stage are needed (the row below the image is created together with the last row).
+      if(y >= end[s] || (s > 0 && next[s - 1] <= std::min(y + 1, height - 1)))
+        continue;
+      const bool last = s == stages - 1;
+      const Pixel* srcRow = s > 0 ? ringRow(s - 1, y) : src[y];
+      const Pixel* nextRow = s > 0 ? ringRow(s - 1, y + 1) : src[y] + src.stride;
+      Pixel* dstRow = y < begin[s] ? scratch : (last ? dst[y] : ringRow(s, y));
+      const unsigned int changed = diffuseRow(srcRow, nextRow, dstRow, caches + s * stride, last && y >= begin[s]);
+      // The rows outside of the band are counted by the neighboring bands.
+      if(y >= yBegin && y < yEnd)
+        changes[s] += changed;
+
+      // The halo of the intermediate iterations is created in the same way as fillBorder does it.
+      if(!last && y >= begin[s])
+      {
+        dstRow[width] = border == BorderPolicy::zero ? Pixel() : dstRow[ImageT<Pixel>::borderSource(width, width, border)];
+        if(y == height - 1)
+        {
+          if(border == BorderPolicy::zero)
+            std::memset(ringRow(s, height), 0, (width + 1) * sizeof(Pixel));
+          else
+            std::memcpy(ringRow(s, height), ringRow(s, ImageT<Pixel>::borderSource(height, height, border)), (width + 1) * sizeof(Pixel));
+        }
+      }
+      next[s]++;
+    }
   }
+}
 
-  __m256 lastColScaledFirstDerivativeX = _mm256_castsi256_ps(_mm256_alignr_epi8(_mm256_castps_si256(scaledFirstDerivativeX), _mm256_castps_si256(_mm256_permute2f128_ps(lastScaledFirstDerivativeX, scaledFirstDerivativeX, (2 << 4) | 1)), 12));
-  __m256 lastRowScaledFirstDerivativeY = _mm256_load_ps(cacheptr);
+template<typename RowFunction>
+unsigned int PeronaMalik::diffuseTiles(const ImageView& src, Image& dst, unsigned int yBegin, unsigned int yEnd, const std::uint8_t* active, std::uint8_t* changed, std::uint8_t* scratch, float* cache, RowFunction diffuseRow)
+{
+  const unsigned int width = src.width;
+  const unsigned int tilesX = (width + tileWidth - 1) / tileWidth;
+  unsigned int changes = 0;
 
-  __m256 eulerStep = _mm256_mul_ps(dtVec, _mm256_add_ps(_mm256_sub_ps(scaledFirstDerivativeX, lastColScaledFirstDerivativeX), _mm256_sub_ps(scaledFirstDerivativeY, lastRowScaledFirstDerivativeY)));
-  res = _mm256_cvtps_epi32(eulerStep);
+  for(unsigned int y = yBegin; y < yEnd; y++)
+  {
+    const std::uint8_t* activeRow = active + (y / tileHeight) * tilesX;
+    std::uint8_t* changedRow = changed + (y / tileHeight) * tilesX;
+    const bool top = y % tileHeight == 0;
+    if(top)
+      std::memset(changedRow, 0, tilesX);
 
-  lastScaledFirstDerivativeX = scaledFirstDerivativeX;
-  _mm256_store_ps(cacheptr, scaledFirstDerivativeY);
+    for(unsigned int tileX = 0; tileX < tilesX;)
+    {
+      if(!activeRow[tileX])
+      {
+        tileX++;
+        continue;
+      }
+      unsigned int tileEnd = tileX + 1;
+      while(tileEnd < tilesX && activeRow[tileEnd])
+        tileEnd++;
+
+      // The run starts a tile earlier, so that the flux into its first pixel is computed. That tile is copied afterwards.
+      const unsigned int xBegin = tileX > 0 ? (tileX - 1) * tileWidth : 0;
+      const unsigned int xRun = tileX * tileWidth;
+      const unsigned int xEnd = std::min(width, tileEnd * tileWidth);
+
+      // The rows of a tile continue the cache of the row above, the first row initializes it like at the beginning of a band.
+      if(top && y > 0)
+        diffuseRow(src[y - 1] + xBegin, src[y] + xBegin, scratch + xBegin, xEnd - xBegin, cache + xBegin);
+      else if(top)
+        std::memset(cache + xBegin, 0, (dst.stride - xBegin) * sizeof(float));
+
+      changes += diffuseRow(src[y] + xBegin, src[y] + src.stride + xBegin, dst[y] + xBegin, xEnd - xBegin, cache + xBegin);
+      for(unsigned int x = xBegin; x < xRun; x++)
+        changes -= dst[y][x] != src[y][x];
+
+      for(unsigned int t = tileX; t < tileEnd; t++)
+      {
+        const unsigned int x = t * tileWidth;
+        if(std::memcmp(dst[y] + x, src[y] + x, std::min(tileWidth, width - x)))
+          changedRow[t] = 1;
+      }
+      tileX = tileEnd;
+    }
 
-  cacheptr += 8;
+    // The pixels of the other tiles cannot have changed.
+    for(unsigned int tileX = 0; tileX < tilesX; tileX++)
+    {
+      const unsigned int x = tileX * tileWidth;
+      if(!activeRow[tileX])
+        std::memcpy(dst[y] + x, src[y] + x, std::min(tileWidth, width - x));
+    }
+  }
+  return changes;
 }
 
-template<bool isotropic, bool simd, bool avx>
-Image PeronaMalik::applyT(const Image& image, float kappa, float dt, unsigned int times)
+template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+Image PeronaMalik::applyT(const ImageView& image, float kappa, float dt, unsigned int times, BorderPolicy border, unsigned int threads, unsigned int blockDepth, const float* table, const FixedPointFlux* flux, unsigned int tolerance, StorePolicy storePolicy, const std::vector<unsigned int>* starts, unsigned int& iterations)
 {
-  Chronometer time(simd ? (avx ? "PeronaMalik::applyT<?, true, true>" : "PeronaMalik::applyT<?, true, false>") : "PeronaMalik::applyT<?, false, false>");
+  // The kernels read the right and lower neighbors of the border pixels from the halo and the vectorized loops need aligned rows.
+  if(image.halo == 0 || image.border != border || (simd && !image.aligned))
+    return applyT<diffusivity, isotropic, simd, avx, avx512>(Image(image, 1, border), kappa, dt, times, border, threads, blockDepth, table, flux, tolerance, storePolicy, starts, iterations);
 
-  if(!image.aligned)
-    throw std::runtime_error("Image must be aligned!");
+  Chronometer time(simd ? (avx ? (avx512 ? "PeronaMalik::applyT<?, true, true, true>" : "PeronaMalik::applyT<?, true, true, false>") : "PeronaMalik::applyT<?, true, false, false>") : "PeronaMalik::applyT<?, false, false, false>");
 
-  Image result1(image.width, image.height, true);
-  Image result2(image.width, image.height, true);
+  const unsigned int bands = std::max(1u, std::min(threads, image.height));
+  const unsigned int depth = std::max(1u, std::min(blockDepth, times));
 
-  float* cache = static_cast<float*>(AlignedMemory::alloc(image.width * sizeof(float), 32));
-  if(cache == nullptr)
+  // A single pass goes directly from the image to result1, so the second frame is only allocated for several passes.
+  const bool severalPasses = times > depth;
+  Image result1(image.width, image.height, true, 1);
+  Image result2(severalPasses ? image.width : 0, severalPasses ? image.height : 0, true, 1);
+
+  // Each band has a cache per stage, rings of rows for the intermediate iterations and a scratch row.
+  const std::size_t stride = result1.stride;
+  float* caches = static_cast<float*>(AlignedMemory::alloc(bands * depth * stride * sizeof(float), Image::alignment));
+  std::uint8_t* rows = static_cast<std::uint8_t*>(AlignedMemory::alloc(bands * bandRows(depth) * stride * sizeof(std::uint8_t), Image::alignment));
+  if(caches == nullptr || rows == nullptr)
+  {
+    AlignedMemory::free(caches);
+    AlignedMemory::free(rows);
     throw std::runtime_error("Could not allocate aligned memory!");
+  }
 
   const float kappaSqr = kappa * kappa;
+  // The next pass reads the result again, so it only bypasses the cache if the two frames do not fit into it anyway.
+  const bool streamStores = CPUFeatures::resolve(storePolicy, 2 * stride * (image.height + 2), bands) == StorePolicy::streaming;
 
-  const Image* src = &image;
+  ImageView src = image;
   Image* dst = &result1;
+  std::vector<unsigned int> changes(bands * depth);
 
-  __m128 kappaSqrVecSSE, dtVecSSE;
-  __m256 kappaSqrVecAVX, dtVecAVX;
-  if(simd)
+  // Computes a pass of several iterations from src to dst.
+  const auto pass = [&](unsigned int stages)
   {
-    if(avx)
+    ThreadPool::run(bands, [&](unsigned int band)
     {
-      kappaSqrVecAVX = _mm256_set1_ps(kappaSqr);
-      dtVecAVX = _mm256_set1_ps(dt);
-    }
-    else
+      diffuseBand(src, *dst, stages, band * image.height / bands, (band + 1) * image.height / bands, border,
+                  rows + band * bandRows(depth) * stride, caches + band * depth * stride, changes.data() + band * depth,
+                  [&](const std::uint8_t* srcRow, const std::uint8_t* nextRow, std::uint8_t* dstRow, float* cache, bool streaming)
+      {
+        streaming = streaming && streamStores;
+        if(flux && streaming)
+          return diffuseRowFixed<simd, avx, avx512, true>(srcRow, nextRow, dstRow, image.width, reinterpret_cast<std::int16_t*>(cache), *flux);
+        else if(flux)
+          return diffuseRowFixed<simd, avx, avx512, false>(srcRow, nextRow, dstRow, image.width, reinterpret_cast<std::int16_t*>(cache), *flux);
+        else if(table && streaming)
+          return diffuseRow<diffusivity, isotropic, simd, avx, avx512, true, true>(srcRow, nextRow, dstRow, image.width, cache, kappaSqr, dt, table);
+        else if(table)
+          return diffuseRow<diffusivity, isotropic, simd, avx, avx512, false, true>(srcRow, nextRow, dstRow, image.width, cache, kappaSqr, dt, table);
+        else if(streaming)
+          return diffuseRow<diffusivity, isotropic, simd, avx, avx512, true, false>(srcRow, nextRow, dstRow, image.width, cache, kappaSqr, dt, nullptr);
+        else
+          return diffuseRow<diffusivity, isotropic, simd, avx, avx512, false, false>(srcRow, nextRow, dstRow, image.width, cache, kappaSqr, dt, nullptr);
+      });
+
+      // The streaming stores must be visible to the thread that processes the neighboring band in the next iteration.
+      _mm_sfence();
+    });
+
+    if(starts)
+      fillSeparators(*dst, *starts, border);
+    // The vectors at the end of the rows have overwritten the right column of the halo.
+    dst->fillBorder(border);
+  };
+
+  iterations = 0;
+  bool converged = false;
+  while(iterations < times && !converged)
+  {
+    unsigned int stages = std::min(depth, times - iterations);
+    pass(stages);
+
+    // Looks for the first iteration of the pass that has changed at most tolerance pixels.
+    for(unsigned int s = 0; s < stages && !converged; s++)
     {
-      kappaSqrVecSSE = _mm_set1_ps(kappaSqr);
-      dtVecSSE = _mm_set1_ps(dt);
+      unsigned int changed = 0;
+      for(unsigned int band = 0; band < bands; band++)
+        changed += changes[band * depth + s];
+      if(changed <= tolerance)
+      {
+        // The following iterations reproduce a fixed point, otherwise the pass has to be repeated up to this iteration.
+        if(changed > 0 && s + 1 < stages)
+          pass(s + 1);
+        stages = s + 1;
+        converged = true;
+      }
     }
+    iterations += stages;
+
+    src = *dst;
+    dst = (dst == &result1 ? &result2 : &result1);
   }
 
-  int roundingMode = _MM_GET_ROUNDING_MODE();
-  _MM_SET_ROUNDING_MODE(_MM_ROUND_TOWARD_ZERO);
+  AlignedMemory::free(caches);
+  AlignedMemory::free(rows);
 
-  for(unsigned int i = 0; i < times; i++)
+  if(iterations == 0)
+    return Image(image, 1, border);
+  // The last result is moved out instead of being copied.
+  return std::move(dst == &result1 ? result2 : result1);
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+Image PeronaMalik::applyTiles(const ImageView& image, float kappa, float dt, unsigned int times, BorderPolicy border, unsigned int threads, const float* table, const FixedPointFlux* flux, unsigned int tolerance, const std::vector<unsigned int>* starts, unsigned int& iterations)
+{
+  // The kernels read the right and lower neighbors of the border pixels from the halo and the vectorized loops need aligned rows.
+  if(image.halo == 0 || image.border != border || (simd && !image.aligned))
+    return applyTiles<diffusivity, isotropic, simd, avx, avx512>(Image(image, 1, border), kappa, dt, times, border, threads, table, flux, tolerance, starts, iterations);
+
+  Chronometer time(simd ? (avx ? (avx512 ? "PeronaMalik::applyTiles<?, true, true, true>" : "PeronaMalik::applyTiles<?, true, true, false>") : "PeronaMalik::applyTiles<?, true, false, false>") : "PeronaMalik::applyTiles<?, false, false, false>");
+
+  Image result1(image.width, image.height, true, 1);
+  Image result2(image.width, image.height, true, 1);
+
+  // The bands consist of whole rows of tiles, so that each tile is only written by one thread.
+  const unsigned int tilesX = (image.width + tileWidth - 1) / tileWidth;
+  const unsigned int tilesY = (image.height + tileHeight - 1) / tileHeight;
+  const unsigned int bands = std::max(1u, std::min(threads, tilesY));
+  float* caches = static_cast<float*>(AlignedMemory::alloc(bands * result1.stride * sizeof(float), Image::alignment));
+  std::uint8_t* rows = static_cast<std::uint8_t*>(AlignedMemory::alloc(bands * result1.stride * sizeof(std::uint8_t), Image::alignment));
+  if(caches == nullptr || rows == nullptr)
   {
-    std::memset(cache, 0, image.width * sizeof(float));
-    for(unsigned int y = 0; y < image.height; y++)
+    AlignedMemory::free(caches);
+    AlignedMemory::free(rows);
+    throw std::runtime_error("Could not allocate aligned memory!");
+  }
+  // The rows above the tiles read the caches before they are initialized, but only for results that are discarded.
+  std::memset(caches, 0, bands * result1.stride * sizeof(float));
+
+  const float kappaSqr = kappa * kappa;
+
+  ImageView src = image;
+  Image* dst = &result1;
+  std::vector<unsigned int> changes(bands);
+  // All tiles are computed in the first iteration.
+  std::vector<std::uint8_t> active(tilesX * tilesY, 1);
+  std::vector<std::uint8_t> changed(tilesX * tilesY);
+
+  iterations = 0;
+  while(iterations < times)
+  {
+    ThreadPool::run(bands, [&](unsigned int band)
     {
-      if(simd)
+      changes[band] = diffuseTiles(src, *dst, band * tilesY / bands * tileHeight, std::min(image.height, (band + 1) * tilesY / bands * tileHeight),
+                                   active.data(), changed.data(), rows + band * result1.stride, caches + band * result1.stride,
+                                   [&](const std::uint8_t* srcRow, const std::uint8_t* nextRow, std::uint8_t* dstRow, unsigned int width, float* cache)
       {
-        float* cacheptr = cache;
-        if(avx)
-        {
-          const __m256i* srcRow = reinterpret_cast<const __m256i*>((*src)[y]);
-          __m256i* dstRow = reinterpret_cast<__m256i*>((*dst)[y]);
-
-          const __m256i* nextRow = reinterpret_cast<const __m256i*>((*src)[y + 1]);
-          const __m256i* const srcRowEnd = nextRow;
-
-          __m256i src = _mm256_load_si256(srcRow);
-          __m256i nextSrc;
-          __m256 lastScaledFirstDerivativeX = _mm256_setzero_ps();
-          while(srcRow != srcRowEnd)
-          {
-            nextSrc = (++srcRow != srcRowEnd) ? _mm256_load_si256(srcRow) : _mm256_setzero_si256();
-            __m256i row = src;
-            __m256i rowy = (y != image.height - 1) ? _mm256_load_si256(nextRow++) : _mm256_setzero_si256();
-            __m256i rowx = _mm256_alignr_epi8(_mm256_permute2x128_si256(src, nextSrc, (2 << 4) | 1), src, 1);
-            src = nextSrc;
-
-            __m256i row16a = _mm256_unpacklo_epi8(row, _mm256_setzero_si256());
-            __m256i row16b = _mm256_unpackhi_epi8(row, _mm256_setzero_si256());
-            __m256i rowx16a = _mm256_unpacklo_epi8(rowx, _mm256_setzero_si256());
-            __m256i rowx16b = _mm256_unpackhi_epi8(rowx, _mm256_setzero_si256());
-            __m256i firstDerivativeXa = _mm256_sub_epi16(rowx16a, row16a);
-            __m256i firstDerivativeXb = _mm256_sub_epi16(rowx16b, row16b);
-            __m256i rowy16a = _mm256_unpacklo_epi8(rowy, _mm256_setzero_si256());
-            __m256i rowy16b = _mm256_unpackhi_epi8(rowy, _mm256_setzero_si256());
-            __m256i firstDerivativeYa = _mm256_sub_epi16(rowy16a, row16a);
-            __m256i firstDerivativeYb = _mm256_sub_epi16(rowy16b, row16b);
-
-            __m256i lo, hi, tmp;
-
-            diffusionAVX<isotropic>(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeXa, 0)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeYa, 0)), lo, kappaSqrVecAVX, dtVecAVX, lastScaledFirstDerivativeX, cacheptr);
-            diffusionAVX<isotropic>(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeXb, 0)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeYb, 0)), hi, kappaSqrVecAVX, dtVecAVX, lastScaledFirstDerivativeX, cacheptr);
-            diffusionAVX<isotropic>(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeXa, 1)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeYa, 1)), tmp, kappaSqrVecAVX, dtVecAVX, lastScaledFirstDerivativeX, cacheptr);
-            lo = _mm256_packs_epi32(_mm256_permute2x128_si256(lo, tmp, (2 << 4) | 0), _mm256_permute2x128_si256(lo, tmp, (3 << 4) | 1));
-            diffusionAVX<isotropic>(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeXb, 1)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeYb, 1)), tmp, kappaSqrVecAVX, dtVecAVX, lastScaledFirstDerivativeX, cacheptr);
-            hi = _mm256_packs_epi32(_mm256_permute2x128_si256(hi, tmp, (2 << 4) | 0), _mm256_permute2x128_si256(hi, tmp, (3 << 4) | 1));
-
-            lo = _mm256_add_epi16(lo, row16a);
-            hi = _mm256_add_epi16(hi, row16b);
-            __m256i result = _mm256_packus_epi16(lo, hi);
-            _mm256_stream_si256(dstRow++, result);
-          }
-        }
+        // The runs of tiles do not overlap, so the fixed point fluxes of a run fit into the floats of the same pixels.
+        if(flux)
+          return diffuseRowFixed<simd, avx, avx512, false>(srcRow, nextRow, dstRow, width, reinterpret_cast<std::int16_t*>(cache), *flux);
+        else if(table)
+          return diffuseRow<diffusivity, isotropic, simd, avx, avx512, false, true>(srcRow, nextRow, dstRow, width, cache, kappaSqr, dt, table);
         else
-        {
-          const __m128i* srcRow = reinterpret_cast<const __m128i*>((*src)[y]);
-          __m128i* dstRow = reinterpret_cast<__m128i*>((*dst)[y]);
-
-          const __m128i* nextRow = reinterpret_cast<const __m128i*>((*src)[y + 1]);
-          const __m128i* const srcRowEnd = nextRow;
-
-          __m128i src = _mm_load_si128(srcRow);
-          __m128i nextSrc;
-          __m128 lastScaledFirstDerivativeX = _mm_setzero_ps();
-          while(srcRow != srcRowEnd)
-          {
-            nextSrc = (++srcRow != srcRowEnd) ? _mm_load_si128(srcRow) : _mm_setzero_si128();
-            __m128i row = src;
-            __m128i rowy = (y != image.height - 1) ? _mm_load_si128(nextRow++) : _mm_setzero_si128();
-            __m128i rowx = _mm_alignr_epi8(nextSrc, row, 1);
-            src = nextSrc;
-
-            __m128i row16a = _mm_unpacklo_epi8(row, _mm_setzero_si128());
-            __m128i row16b = _mm_unpackhi_epi8(row, _mm_setzero_si128());
-            __m128i rowx16a = _mm_unpacklo_epi8(rowx, _mm_setzero_si128());
-            __m128i rowx16b = _mm_unpackhi_epi8(rowx, _mm_setzero_si128());
-            __m128i firstDerivativeXa = _mm_sub_epi16(rowx16a, row16a);
-            __m128i firstDerivativeXb = _mm_sub_epi16(rowx16b, row16b);
-            __m128i rowy16a = _mm_unpacklo_epi8(rowy, _mm_setzero_si128());
-            __m128i rowy16b = _mm_unpackhi_epi8(rowy, _mm_setzero_si128());
-            __m128i firstDerivativeYa = _mm_sub_epi16(rowy16a, row16a);
-            __m128i firstDerivativeYb = _mm_sub_epi16(rowy16b, row16b);
-
-            __m128i lo, hi, tmp;
-
-            diffusionSSE<isotropic>(_mm_cvtepi16_epi32(firstDerivativeXa), _mm_cvtepi16_epi32(firstDerivativeYa), lo, kappaSqrVecSSE, dtVecSSE, lastScaledFirstDerivativeX, cacheptr);
-            diffusionSSE<isotropic>(_mm_cvtepi16_epi32(_mm_srli_si128(firstDerivativeXa, 8)), _mm_cvtepi16_epi32(_mm_srli_si128(firstDerivativeYa, 8)), hi, kappaSqrVecSSE, dtVecSSE, lastScaledFirstDerivativeX, cacheptr);
-            lo = _mm_packs_epi32(lo, hi);
-
-            diffusionSSE<isotropic>(_mm_cvtepi16_epi32(firstDerivativeXb), _mm_cvtepi16_epi32(firstDerivativeYb), hi, kappaSqrVecSSE, dtVecSSE, lastScaledFirstDerivativeX, cacheptr);
-            diffusionSSE<isotropic>(_mm_cvtepi16_epi32(_mm_srli_si128(firstDerivativeXb, 8)), _mm_cvtepi16_epi32(_mm_srli_si128(firstDerivativeYb, 8)), tmp, kappaSqrVecSSE, dtVecSSE, lastScaledFirstDerivativeX, cacheptr);
-            hi = _mm_packs_epi32(hi, tmp);
-
-            lo = _mm_add_epi16(lo, row16a);
-            hi = _mm_add_epi16(hi, row16b);
-            __m128i result = _mm_packus_epi16(lo, hi);
-            _mm_stream_si128(dstRow++, result);
-          }
-        }
-      }
-      else
-      {
-        float lastScaledFirstDerivativeX = 0.f;
-        const std::uint8_t* srcRow = (*src)[y];
-        const std::uint8_t* nextRow = (*src)[y + 1];
-        std::uint8_t* dstRow = (*dst)[y];
-        for(unsigned int x = 0; x < image.width; x++)
-        {
-          float firstDerivativeX = static_cast<float>((x != image.width - 1 ? srcRow[x + 1] : 0) - srcRow[x]);
-          float firstDerivativeY = static_cast<float>((y != image.height - 1 ? nextRow[x] : 0) - srcRow[x]);
+          return diffuseRow<diffusivity, isotropic, simd, avx, avx512, false, false>(srcRow, nextRow, dstRow, width, cache, kappaSqr, dt, nullptr);
+      });
+    });
 
-          float scaledFirstDerivativeX, scaledFirstDerivativeY;
+    if(starts)
+      fillSeparators(*dst, *starts, border);
+    // The vectors at the end of the rows have overwritten the right column of the halo.
+    dst->fillBorder(border);
 
-          if(isotropic)
-          {
-            float g = kappaSqr / (kappaSqr + firstDerivativeX * firstDerivativeX + firstDerivativeY * firstDerivativeY);
-            scaledFirstDerivativeX = firstDerivativeX * g;
-            scaledFirstDerivativeY = firstDerivativeY * g;
-          }
-          else
-          {
-            float gX = kappaSqr / (kappaSqr + firstDerivativeX * firstDerivativeX);
-            float gY = kappaSqr / (kappaSqr + firstDerivativeY * firstDerivativeY);
-            scaledFirstDerivativeX = firstDerivativeX * gX;
-            scaledFirstDerivativeY = firstDerivativeY * gY;
-          }
-
-          float eulerStep = dt * ((scaledFirstDerivativeX - lastScaledFirstDerivativeX) + (scaledFirstDerivativeY - cache[x]));
-          std::int32_t offset = static_cast<std::int32_t>(eulerStep);
-
-          if(offset < std::numeric_limits<std::int16_t>::min())
-            offset = std::numeric_limits<std::int16_t>::min();
-          else if(offset > std::numeric_limits<std::int16_t>::max())
-            offset = std::numeric_limits<std::int16_t>::max();
-
-          std::int16_t newVal = static_cast<std::int16_t>(srcRow[x]) + static_cast<std::int16_t>(offset);
-          if(newVal < 0)
-            newVal = 0;
-          else if(newVal > 255)
-            newVal = 255;
-          dstRow[x] = static_cast<std::uint8_t>(newVal);
-
-          lastScaledFirstDerivativeX = scaledFirstDerivativeX;
-          cache[x] = scaledFirstDerivativeY;
-        }
+    iterations++;
+    src = *dst;
+    dst = (dst == &result1 ? &result2 : &result1);
+
+    unsigned int total = 0;
+    for(unsigned int band = 0; band < bands; band++)
+      total += changes[band];
+    if(total <= tolerance)
+      break;
+
+    // A tile is active if it or one of its neighbors has changed.
+    for(unsigned int tileY = 0; tileY < tilesY; tileY++)
+      for(unsigned int tileX = 0; tileX < tilesX; tileX++)
+      {
+        std::uint8_t neighborhood = 0;
+        for(unsigned int y = tileY > 0 ? tileY - 1 : 0; y <= std::min(tileY + 1, tilesY - 1); y++)
+          for(unsigned int x = tileX > 0 ? tileX - 1 : 0; x <= std::min(tileX + 1, tilesX - 1); x++)
+            neighborhood |= changed[y * tilesX + x];
+        active[tileY * tilesX + tileX] = neighborhood;
       }
-    }
+  }
 
-    src = dst;
-    dst = (dst == &result1 ? &result2 : &result1);
+  AlignedMemory::free(caches);
+  AlignedMemory::free(rows);
+
+  if(iterations == 0)
+    return Image(image, 1, border);
+  // The last result is moved out instead of being copied.
+  return std::move(dst == &result1 ? result2 : result1);
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+Image PeronaMalik::applyAOS(const ImageView& image, float kappa, float dt, unsigned int times, BorderPolicy border, unsigned int threads)
+{
+  Chronometer time(simd ? (avx ? (avx512 ? "PeronaMalik::applyAOS<?, true, true, true>" : "PeronaMalik::applyAOS<?, true, true, false>") : "PeronaMalik::applyAOS<?, true, false, false>") : "PeronaMalik::applyAOS<?, false, false, false>");
+
+  const OptimizationLevel optimizationLevel = simd ? (avx ? (avx512 ? OptimizationLevel::avx512 : OptimizationLevel::avx2) : OptimizationLevel::sse4) : OptimizationLevel::noOptimization;
+
+  // All images have the same layout, so that the kernels can address their rows with the same stride.
+  ImageT<float> result1(image.width, image.height, true, 1);
+  ImageT<float> result2(image.width, image.height, true, 1);
+  ImageT<float> diffusivityX(image.width, image.height, true, 1);
+  // Isotropic tensors use the same diffusivities in both directions.
+  ImageT<float> diffusivityY(isotropic ? 0 : image.width, isotropic ? 0 : image.height, true, 1);
+  ImageT<float> rowSolution(image.width, image.height, true, 1);
+  ImageT<float> factors(image.width, image.height, true, 1);
+  ImageT<float> columnSolution(image.width, image.height, true, 1);
+  ImageTools::convert(image, result2, optimizationLevel);
+  result2.fillBorder(border);
+
+  // The rows are distributed to bands and the columns to stripes of whole vectors.
+  const unsigned int bands = std::max(1u, std::min(threads, image.height));
+  const unsigned int vectors = (image.width + 15) / 16;
+  const unsigned int stripes = std::max(1u, std::min(threads, vectors));
+  const std::size_t stride = result1.stride;
+  float* scratch = static_cast<float*>(AlignedMemory::alloc(bands * 16 * stride * sizeof(float), Image::alignment));
+  if(scratch == nullptr)
+    throw std::runtime_error("Could not allocate aligned memory!");
+
+  const float kappaSqr = kappa * kappa;
+  // Each direction is solved with twice the step length, because the solutions are averaged.
+  const float twoDt = 2.f * dt;
+  ImageT<float>& diffusivityColumns = isotropic ? diffusivityX : diffusivityY;
+
+  ImageT<float>* src = &result2;
+  ImageT<float>* dst = &result1;
+
+  for(unsigned int i = 0; i < times; i++)
+  {
+    ThreadPool::run(bands, [&](unsigned int band)
+    {
+      const unsigned int yBegin = band * image.height / bands;
+      const unsigned int yEnd = (band + 1) * image.height / bands;
+      for(unsigned int y = yBegin; y < yEnd; y++)
+        diffusivityRow<diffusivity, isotropic, simd, avx, avx512>((*src)[y], (*src)[y + 1], diffusivityX[y], isotropic ? nullptr : diffusivityY[y], image.width, kappaSqr);
+      solveRows<simd, avx, avx512>((*src)[yBegin], diffusivityX[yBegin], rowSolution[yBegin], scratch + band * 16 * stride, stride, image.width, yEnd - yBegin, twoDt);
+    });
+
+    // The columns need the diffusivities of all bands.
+    ThreadPool::run(stripes, [&](unsigned int stripe)
+    {
+      const unsigned int xBegin = stripe * vectors / stripes * 16;
+      const unsigned int xEnd = std::min(image.width, (stripe + 1) * vectors / stripes * 16);
+      solveColumns<simd, avx, avx512>((*src)[0] + xBegin, diffusivityColumns[0] + xBegin, factors[0] + xBegin, columnSolution[0] + xBegin,
+                                      rowSolution[0] + xBegin, (*dst)[0] + xBegin, stride, xEnd - xBegin, image.height, twoDt);
+    });
+
+    // The vectors at the end of the rows have overwritten the right column of the halo.
+    dst->fillBorder(border);
+
+    std::swap(src, dst);
   }
 
-  _MM_SET_ROUNDING_MODE(roundingMode);
+  AlignedMemory::free(scratch);
+
+  return ImageTools::convert<std::uint8_t>(src->view(0, 0, image.width, image.height), optimizationLevel);
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512, typename Pixel>
+Image PeronaMalik::applyWideT(const ImageView& image, float kappa, float dt, unsigned int times, BorderPolicy border, unsigned int threads, unsigned int blockDepth, const std::vector<unsigned int>* starts)
+{
+  Chronometer time(simd ? (avx ? (avx512 ? "PeronaMalik::applyWideT<?, true, true, true, ?>" : "PeronaMalik::applyWideT<?, true, true, false, ?>") : "PeronaMalik::applyWideT<?, true, false, false, ?>") : "PeronaMalik::applyWideT<?, false, false, false, ?>");
+
+  const OptimizationLevel optimizationLevel = simd ? (avx ? (avx512 ? OptimizationLevel::avx512 : OptimizationLevel::avx2) : OptimizationLevel::sse4) : OptimizationLevel::noOptimization;
+
+  // Integer pixels use their whole range, so kappa has to be scaled as well (the Euler step is linear in the scale).
+  const float scale = std::is_integral<Pixel>::value ? 65535.f / 255.f : 1.f;
+  kappa *= scale;
+
+  ImageT<Pixel> result1(image.width, image.height, true, 1);
+  ImageT<Pixel> result2(image.width, image.height, true, 1);
+  ImageTools::convert(image, result2, optimizationLevel, scale);
+  result2.fillBorder(border);
+
+  // Each band has a cache per stage, rings of rows for the intermediate iterations and a scratch row.
+  const unsigned int bands = std::max(1u, std::min(threads, image.height));
+  const unsigned int depth = std::max(1u, std::min(blockDepth, times));
+  const std::size_t stride = result1.stride;
+  float* caches = static_cast<float*>(AlignedMemory::alloc(bands * depth * stride * sizeof(float), Image::alignment));
+  Pixel* rows = static_cast<Pixel*>(AlignedMemory::alloc(bands * bandRows(depth) * stride * sizeof(Pixel), Image::alignment));
+  if(caches == nullptr || rows == nullptr)
+  {
+    AlignedMemory::free(caches);
+    AlignedMemory::free(rows);
+    throw std::runtime_error("Could not allocate aligned memory!");
+  }
+
+  const float kappaSqr = kappa * kappa;
+
+  ImageT<Pixel>* src = &result2;
+  ImageT<Pixel>* dst = &result1;
+  std::vector<unsigned int> changes(bands * depth);
+
+  for(unsigned int i = 0; i < times; i += depth)
+  {
+    const unsigned int stages = std::min(depth, times - i);
+    ThreadPool::run(bands, [&](unsigned int band)
+    {
+      diffuseBand(src->view(), *dst, stages, band * image.height / bands, (band + 1) * image.height / bands, border,
+                  rows + band * bandRows(depth) * stride, caches + band * depth * stride, changes.data() + band * depth,
+                  [&](const Pixel* srcRow, const Pixel* nextRow, Pixel* dstRow, float* cache, bool)
+      {
+        diffuseRowWide<diffusivity, isotropic, simd, avx, avx512>(srcRow, nextRow, dstRow, image.width, cache, kappaSqr, dt);
+        return 0u;
+      });
+    });
+
+    if(starts)
+      fillSeparators(*dst, *starts, border);
+    // The vectors at the end of the rows have overwritten the right column of the halo.
+    dst->fillBorder(border);
+
+    std::swap(src, dst);
+  }
 
-  AlignedMemory::free(cache);
+  AlignedMemory::free(caches);
+  AlignedMemory::free(rows);
 
-  return *src;
+  // The reciprocal of 257 rounds every 16-bit value to the same byte as the division.
+  Image result(image.width, image.height, true, 1);
+  ImageTools::convert(src->view(0, 0, image.width, image.height), result, optimizationLevel, 1.f / scale);
+  result.fillBorder(border);
+  return result;
 }
@@ -9,75 +9,689 @@
 #pragma once
 
 #include "Operator.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Diffusivity.h"
+#include "Image.h"
 #include "OptimizationLevel.h"
+#include "Pixel.h"
 #include "SIMD.h"
-
-class Image;
+#include "StorePolicy.h"
 
 /**
  * @brief This class implements the Perona Malik diffusion denoising filter.
+ *
+ * The filter does not change any global or thread state (e.g. the rounding mode of the MXCSR), so several threads
+ * can call apply on the same or on different instances concurrently. Their results are identical to sequential calls.
  */
 class PeronaMalik : public Operator
 {
 public:
-  /*
+  static constexpr unsigned int maxBlockDepth = 32; ///< The largest block depth (row streaming computes up to this many iterations in one pass).
+  static constexpr unsigned int maxPyramidLevels = 8; ///< The largest number of times that the image can be downsampled.
+  static constexpr unsigned int maxBatchWidth = 1024; ///< The width up to which the images of a batch are packed side by side.
+
+  /**
+   * @brief This struct contains the options of the filter (the defaults compute the plain scheme without optimizations).
+   */
+  struct Options
+  {
+    bool isotropic = false;                                                  ///< Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+    OptimizationLevel optimizationLevel = OptimizationLevel::noOptimization; ///< The kind of optimization that should be used.
+    PixelFormat precision = PixelFormat::uint8;                              ///< The pixel type in which the iterations are stored (all types except uint8 are computed in single precision).
+    BorderPolicy border = BorderPolicy::zero;                                ///< The values that are assumed behind the right and bottom border (replicate yields a Neumann boundary).
+    unsigned int threads = 1;                                                ///< The number of threads that process horizontal bands of each iteration (0 means one per hardware thread).
+    unsigned int blockDepth = 1;                                             ///< The number of iterations that are computed in one pass over the image (0 is raised to 1 and values above maxBlockDepth are clamped to it).
+    bool lookupTable = false;                                                ///< Whether the diffusivities of the uint8 precision are looked up in a table instead of being computed (the results are identical). Every diffusivity function uses the table, but it only pays off for the exponential, charbonnier and weickert ones; gathering from it is slower than computing the rational and tukey functions.
+    bool fixedPoint = false;                                                 ///< Whether the anisotropic uint8 precision is computed in 16-bit fixed point (for dt <= 0.5, an iteration differs by at most one from the float path).
+    unsigned int tolerance = 0;                                              ///< The uint8 precision stops after the first iteration that changes at most this many pixels (0 only stops at the fixed point, which does not change the result).
+    bool activeTiles = false;                                                ///< Whether the uint8 precision only recomputes the tiles in which a neighbor changed in the previous iteration (the results are identical, but the block depth is ignored).
+    bool semiImplicit = false;                                               ///< Whether the iterations are computed with the semi-implicit AOS scheme, which is stable for large dt (it is computed in single precision, so the options of the uint8 precision and the block depth are ignored).
+    unsigned int pyramidLevels = 0;                                          ///< The number of times that the image is halved in size before most of the iterations are computed on the coarsest level (0 computes all iterations at full resolution, at most maxPyramidLevels).
+    unsigned int refinementIterations = 0;                                   ///< The number of iterations that each finer level of the pyramid computes at most after upsampling the change of the coarser one (the coarsest level computes the rest of the diffusion time).
+    DiffusivityFunction diffusivity = DiffusivityFunction::rational;         ///< The function that maps the squared norm of the gradient to a diffusivity.
+    bool rowStreaming = false;                                               ///< Whether maxBlockDepth iterations are computed in one pass through rings of rows (the block depth is ignored), so that the uint8 precision only needs a few rows per iteration besides the frames. Convergence is only detected after a pass, so up to maxBlockDepth - 1 iterations are computed in vain.
+    StorePolicy storePolicy = StorePolicy::automatic;                        ///< Whether the vectorized uint8 kernels write the result of each pass with non-temporal stores (automatic streams if two frames do not fit into the share of the last level cache of its threads).
+  };
+
+  /**
+   * @brief Constructs a filter with the default options.
+   * @param kappa The larger, the less the diffusion is blocked at edges.
+   * @param dt The step length in the numeric solution of the diffusion equation.
+   * @param times The number of iterations (i.e. the solution is evaluated at dt*times).
+   */
+  PeronaMalik(float kappa, float dt, unsigned int times);
+  /**
    * @brief Constructs a filter.
    * @param kappa The larger, the less the diffusion is blocked at edges.
    * @param dt The step length in the numeric solution of the diffusion equation.
    * @param times The number of iterations (i.e. the solution is evaluated at dt*times).
-   * @param isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
-   * @param optimizationLevel The kind of optimization that should be used.
+   * @param options The options of the filter.
    */
-  PeronaMalik(float kappa, float dt, unsigned int times, bool isotropic = false, OptimizationLevel = OptimizationLevel::noOptimization);
+  PeronaMalik(float kappa, float dt, unsigned int times, const Options& options);
   /**
    * @brief Denoises an image.
    * @param image The image that is denoised.
    * @return A denoised image.
    */
-  Image apply(const Image& image) override;
+  Image apply(const ImageView& image) override;
+  /**
+   * @brief Denoises an image and tells how many iterations were computed.
+   * @param image The image that is denoised.
+   * @param iterations Receives the number of iterations until the result (less than times if the iterations stopped early, only the full resolution ones with a pyramid).
+   * @return A denoised image.
+   */
+  Image apply(const ImageView& image, unsigned int& iterations);
+  /**
+   * @brief Denoises a batch of images.
+   *
+   * Images of the same height are packed side by side into images of up to maxBatchWidth columns, so that small
+   * images fill the vectors and share the setup of the iterations. The packed images are distributed over the threads.
+   * The results are identical to those of apply.
+   * @param images The images that are denoised.
+   * @return The denoised images (in the same order).
+   */
+  std::vector<Image> applyBatch(const std::vector<Image>& images);
 private:
+  /**
+   * @brief This struct approximates the scaled fluxes dt * d * g(d) of the 8-bit derivatives in 16-bit fixed point.
+   *
+   * The fluxes of the derivatives 0 to 7 are stored exactly. Above, each segment of 32 derivatives is a quadratic
+   * polynomial in t = (d mod 32) / 32. The tables have 16 entries, so that they can be looked up with byte shuffles.
+   */
+  struct FixedPointFlux
+  {
+    std::int16_t base[16];      ///< The constant coefficient of each entry.
+    std::int16_t linear[16];    ///< The linear coefficient of each entry.
+    std::int16_t quadratic[16]; ///< The quadratic coefficient of each entry.
+    unsigned int shift;         ///< The number of fractional bits of the fluxes.
+  };
+
+  static constexpr int maxFixedPointFlux = 2047; ///< The largest flux, so that neither the coefficients nor the sum of four fluxes overflow.
+
+  /**
+   * @brief Fits the fixed point fluxes for a filter.
+   * @param diffusivity The diffusivity function.
+   * @param kappaSqr Kappa squared.
+   * @param dt The step length.
+   * @return The fixed point fluxes.
+   */
+  static FixedPointFlux createFixedPointFlux(DiffusivityFunction diffusivity, float kappaSqr, float dt);
+  /**
+   * @brief Computes a fixed point flux.
+   * @param firstDerivative The first derivative (in [-255, 255]).
+   * @param flux The fixed point fluxes.
+   * @return The flux in the fixed point format.
+   */
+  static int fixedPointFlux(int firstDerivative, const FixedPointFlux& flux);
+  /**
+   * @brief Computes fixed point fluxes.
+   * @param firstDerivative The first derivatives (as packed 16-bit integers in [-255, 255]).
+   * @param tables The low and high bytes of the base, linear and quadratic tables.
+   * @return The fluxes in the fixed point format.
+   */
+  static __m128i fixedPointFluxSSE(__m128i firstDerivative, const __m128i (&tables)[6]);
+  /**
+   * @brief Computes fixed point fluxes.
+   * @param firstDerivative The first derivatives (as packed 16-bit integers in [-255, 255]).
+   * @param tables The low and high bytes of the base, linear and quadratic tables (in both lanes).
+   * @return The fluxes in the fixed point format.
+   */
+  static __m256i fixedPointFluxAVX(__m256i firstDerivative, const __m256i (&tables)[6]);
+  /**
+   * @brief Computes fixed point fluxes.
+   * @param firstDerivative The first derivatives (as packed 16-bit integers in [-255, 255]).
+   * @param tables The base, linear and quadratic tables (as packed 16-bit integers).
+   * @return The fluxes in the fixed point format.
+   */
+  static __m512i fixedPointFluxAVX512(__m512i firstDerivative, const __m512i (&tables)[3]);
+  /**
+   * @brief Computes an iteration of pixels in fixed point.
+   * @param row The pixels (as packed 16-bit integers).
+   * @param rowx The right neighbors of the pixels (as packed 16-bit integers).
+   * @param rowy The lower neighbors of the pixels (as packed 16-bit integers).
+   * @param tables The tables for fixedPointFluxSSE.
+   * @param roundingBias A vector containing the bias that rounds negative steps toward zero.
+   * @param shift The number of fractional bits of the fluxes.
+   * @param lastFluxX The fluxes in x direction of the previous vector.
+   * @param cacheptr A pointer that points to the fluxes in y direction of the previous row.
+   * @return The pixels in the new iteration (as packed 16-bit integers).
+   */
+  static __m128i fixedPointStepSSE(__m128i row, __m128i rowx, __m128i rowy, const __m128i (&tables)[6], __m128i roundingBias, __m128i shift, __m128i& lastFluxX, std::int16_t*& cacheptr);
+  /**
+   * @brief Computes an iteration of pixels in fixed point.
+   * @param row The pixels (as packed 16-bit integers).
+   * @param rowx The right neighbors of the pixels (as packed 16-bit integers).
+   * @param rowy The lower neighbors of the pixels (as packed 16-bit integers).
+   * @param tables The tables for fixedPointFluxAVX.
+   * @param roundingBias A vector containing the bias that rounds negative steps toward zero.
+   * @param shift The number of fractional bits of the fluxes.
+   * @param lastFluxX The fluxes in x direction of the previous vector.
+   * @param cacheptr A pointer that points to the fluxes in y direction of the previous row.
+   * @return The pixels in the new iteration (as packed 16-bit integers).
+   */
+  static __m256i fixedPointStepAVX(__m256i row, __m256i rowx, __m256i rowy, const __m256i (&tables)[6], __m256i roundingBias, __m128i shift, __m256i& lastFluxX, std::int16_t*& cacheptr);
+  /**
+   * @brief Computes an iteration of pixels in fixed point.
+   * @param row The pixels (as packed 16-bit integers).
+   * @param rowx The right neighbors of the pixels (as packed 16-bit integers).
+   * @param rowy The lower neighbors of the pixels (as packed 16-bit integers).
+   * @param tables The tables for fixedPointFluxAVX512.
+   * @param roundingBias A vector containing the bias that rounds negative steps toward zero.
+   * @param shift The number of fractional bits of the fluxes.
+   * @param lastFluxX The fluxes in x direction of the previous vector.
+   * @param cacheptr A pointer that points to the fluxes in y direction of the previous row.
+   * @return The pixels in the new iteration (as packed 16-bit integers).
+   */
+  static __m512i fixedPointStepAVX512(__m512i row, __m512i rowx, __m512i rowy, const __m512i (&tables)[3], __m512i roundingBias, __m128i shift, __m512i& lastFluxX, std::int16_t*& cacheptr);
+  /**
+   * @brief Counts the pixels that an iteration has changed.
+   * @param row The pixels in the previous iteration.
+   * @param result The pixels in the new iteration.
+   * @param remaining The number of pixels from the first pixel of the vectors to the end of the row.
+   * @return The number of different pixels (among the ones in the row).
+   */
+  static unsigned int countChangesSSE(__m128i row, __m128i result, unsigned int remaining);
+  /**
+   * @brief Counts the pixels that an iteration has changed.
+   * @param row The pixels in the previous iteration.
+   * @param result The pixels in the new iteration.
+   * @param remaining The number of pixels from the first pixel of the vectors to the end of the row.
+   * @return The number of different pixels (among the ones in the row).
+   */
+  static unsigned int countChangesAVX(__m256i row, __m256i result, unsigned int remaining);
+  /**
+   * @brief Transposes a block of 4x4 floats.
+   * @param rows The rows of the block (are replaced by its columns).
+   */
+  static void transposeSSE(__m128 (&rows)[4]);
+  /**
+   * @brief Transposes a block of 8x8 floats.
+   * @param rows The rows of the block (are replaced by its columns).
+   */
+  static void transposeAVX(__m256 (&rows)[8]);
+  /**
+   * @brief Computes a diffusivity like the kernels do, but chooses the function at runtime.
+   * @param diffusivity The diffusivity function.
+   * @param sqrNorm The squared norm of the gradient.
+   * @param kappaSqr Kappa squared.
+   * @return The diffusivity.
+   */
+  static float computeDiffusivity(DiffusivityFunction diffusivity, float sqrNorm, float kappaSqr);
+  /**
+   * @brief Creates a table of the diffusivities for all derivatives between 8-bit pixels.
+   * @param diffusivity The diffusivity function.
+   * @param kappaSqr Kappa squared.
+   * @param isotropic Whether the table is indexed by the squared norm of the gradient (true) or contains the scaled derivatives (false).
+   * @return The table (the anisotropic one starts at the derivative -255).
+   */
+  static std::vector<float> createDiffusivityTable(DiffusivityFunction diffusivity, float kappaSqr, bool isotropic);
+  /**
+   * @brief Computes the increment (Euler step) to a pixel.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam lookup Whether the diffusivity is looked up in a table (the derivatives must be integers in [-255, 255]).
+   * @param firstDerivativeX The first derivative in x direction.
+   * @param firstDerivativeY The first derivative in y direction.
+   * @param kappaSqr Kappa squared.
+   * @param dt The step length.
+   * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
+   * @param cache The scaled first derivative in y direction of the previous row (is replaced by the one of this row).
+   * @param table The diffusivity table (only if lookup is true).
+   * @return The step that has to be added to the pixel.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic, bool lookup = false>
+  static float diffusion(float firstDerivativeX, float firstDerivativeY, float kappaSqr, float dt, float& lastScaledFirstDerivativeX, float& cache, const float* table = nullptr);
+  /**
+   * @brief Computes the increment (Euler step) to the image from the scaled first derivatives.
+   * @param scaledFirstDerivativeX The first derivatives in x direction multiplied by their diffusivities.
+   * @param scaledFirstDerivativeY The first derivatives in y direction multiplied by their diffusivities.
+   * @param dtVec A single precision vector containing the step length.
+   * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
+   * @param cacheptr A pointer that points to the scaled first derivatives in y direction of the previous row.
+   * @return The step that has to be added to the image.
+   */
+  static __m128 eulerStepSSE(__m128 scaledFirstDerivativeX, __m128 scaledFirstDerivativeY, __m128 dtVec, __m128& lastScaledFirstDerivativeX, float*& cacheptr);
+  /**
+   * @brief Computes the increment (Euler step) to the image from the scaled first derivatives.
+   * @param scaledFirstDerivativeX The first derivatives in x direction multiplied by their diffusivities.
+   * @param scaledFirstDerivativeY The first derivatives in y direction multiplied by their diffusivities.
+   * @param dtVec A single precision vector containing the step length.
+   * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
+   * @param cacheptr A pointer that points to the scaled first derivatives in y direction of the previous row.
+   * @return The step that has to be added to the image.
+   */
+  static __m256 eulerStepAVX(__m256 scaledFirstDerivativeX, __m256 scaledFirstDerivativeY, __m256 dtVec, __m256& lastScaledFirstDerivativeX, float*& cacheptr);
+  /**
+   * @brief Computes the increment (Euler step) to the image from the scaled first derivatives.
+   * @param scaledFirstDerivativeX The first derivatives in x direction multiplied by their diffusivities.
+   * @param scaledFirstDerivativeY The first derivatives in y direction multiplied by their diffusivities.
+   * @param dtVec A single precision vector containing the step length.
+   * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
+   * @param cacheptr A pointer that points to the scaled first derivatives in y direction of the previous row.
+   * @return The step that has to be added to the image.
+   */
+  static __m512 eulerStepAVX512(__m512 scaledFirstDerivativeX, __m512 scaledFirstDerivativeY, __m512 dtVec, __m512& lastScaledFirstDerivativeX, float*& cacheptr);
+  /**
+   * @brief Computes the increment (Euler step) to the image.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @param firstDerivativeX The first derivatives in x direction.
+   * @param firstDerivativeY The first derivatives in y direction.
+   * @param kappaSqrVec A single precision vector containing kappa squared.
+   * @param dtVec A single precision vector containing the step length.
+   * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
+   * @param cacheptr A pointer that points to the scaled first derivatives in y direction of the previous row.
+   * @return The step that has to be added to the image.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic>
+  static __m128 eulerStepSSE(__m128 firstDerivativeX, __m128 firstDerivativeY, __m128 kappaSqrVec, __m128 dtVec, __m128& lastScaledFirstDerivativeX, float*& cacheptr);
+  /**
+   * @brief Computes the increment (Euler step) to the image.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @param firstDerivativeX The first derivatives in x direction.
+   * @param firstDerivativeY The first derivatives in y direction.
+   * @param kappaSqrVec A single precision vector containing kappa squared.
+   * @param dtVec A single precision vector containing the step length.
+   * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
+   * @param cacheptr A pointer that points to the scaled first derivatives in y direction of the previous row.
+   * @return The step that has to be added to the image.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic>
+  static __m256 eulerStepAVX(__m256 firstDerivativeX, __m256 firstDerivativeY, __m256 kappaSqrVec, __m256 dtVec, __m256& lastScaledFirstDerivativeX, float*& cacheptr);
+  /**
+   * @brief Computes the increment (Euler step) to the image.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @param firstDerivativeX The first derivatives in x direction.
+   * @param firstDerivativeY The first derivatives in y direction.
+   * @param kappaSqrVec A single precision vector containing kappa squared.
+   * @param dtVec A single precision vector containing the step length.
+   * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
+   * @param cacheptr A pointer that points to the scaled first derivatives in y direction of the previous row.
+   * @return The step that has to be added to the image.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic>
+  static __m512 eulerStepAVX512(__m512 firstDerivativeX, __m512 firstDerivativeY, __m512 kappaSqrVec, __m512 dtVec, __m512& lastScaledFirstDerivativeX, float*& cacheptr);
   /**
    * @brief Computes the increment (Euler step) to the image.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
    * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam lookup Whether the diffusivities are looked up in a table instead of being divided.
    * @param firstDerivativeXi The first derivatives in x direction (as packed 32-bit integers).
    * @param firstDerivativeYi The first derivatives in y direction (as packed 32-bit integers).
-   * @param res The step that has to be added to the image.
+   * @param res The step that has to be added to the image (truncated toward zero).
    * @param kappaSqrVec A single precision vector containing kappa squared.
    * @param dtVec A single precision vector containing the step length.
    * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
    * @param cacheptr A pointer that points to the scaled first derivatives in y direction of the previous row.
+   * @param table The diffusivity table (only if lookup is true).
    */
-  template<bool isotropic>
-  static void diffusionSSE(__m128i firstDerivativeXi, __m128i firstDerivativeYi, __m128i& res, __m128 kappaSqrVec, __m128 dtVec, __m128& lastScaledFirstDerivativeX, float*& cacheptr);
+  template<DiffusivityFunction diffusivity, bool isotropic, bool lookup>
+  static void diffusionSSE(__m128i firstDerivativeXi, __m128i firstDerivativeYi, __m128i& res, __m128 kappaSqrVec, __m128 dtVec, __m128& lastScaledFirstDerivativeX, float*& cacheptr, const float* table);
   /**
    * @brief Computes the increment (Euler step) to the image.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
    * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam lookup Whether the diffusivities are looked up in a table instead of being divided.
    * @param firstDerivativeXi The first derivatives in x direction (as packed 32-bit integers).
    * @param firstDerivativeYi The first derivatives in y direction (as packed 32-bit integers).
-   * @param res The step that has to be added to the image.
+   * @param res The step that has to be added to the image (truncated toward zero).
    * @param kappaSqrVec A single precision vector containing kappa squared.
    * @param dtVec A single precision vector containing the step length.
    * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
    * @param cacheptr A pointer that points to the scaled first derivatives in y direction of the previous row.
+   * @param table The diffusivity table (only if lookup is true).
    */
-  template<bool isotropic>
-  static void diffusionAVX(__m256i firstDerivativeXi, __m256i firstDerivativeYi, __m256i& res, __m256 kappaSqrVec, __m256 dtVec, __m256& lastScaledFirstDerivativeX, float*& cacheptr);
+  template<DiffusivityFunction diffusivity, bool isotropic, bool lookup>
+  static void diffusionAVX(__m256i firstDerivativeXi, __m256i firstDerivativeYi, __m256i& res, __m256 kappaSqrVec, __m256 dtVec, __m256& lastScaledFirstDerivativeX, float*& cacheptr, const float* table);
+  /**
+   * @brief Computes the increment (Euler step) to the image.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam lookup Whether the diffusivities are looked up in a table instead of being divided.
+   * @param firstDerivativeXi The first derivatives in x direction (as packed 32-bit integers).
+   * @param firstDerivativeYi The first derivatives in y direction (as packed 32-bit integers).
+   * @param res The step that has to be added to the image (truncated toward zero).
+   * @param kappaSqrVec A single precision vector containing kappa squared.
+   * @param dtVec A single precision vector containing the step length.
+   * @param lastScaledFirstDerivativeX The value of the scaled first derivative in x direction of the previous column.
+   * @param cacheptr A pointer that points to the scaled first derivatives in y direction of the previous row.
+   * @param table The diffusivity table (only if lookup is true).
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic, bool lookup>
+  static void diffusionAVX512(__m512i firstDerivativeXi, __m512i firstDerivativeYi, __m512i& res, __m512 kappaSqrVec, __m512 dtVec, __m512& lastScaledFirstDerivativeX, float*& cacheptr, const float* table);
+  /**
+   * @brief Computes one row of an iteration.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @tparam streaming Whether the row is written with non-temporal stores (because it is not read again soon).
+   * @tparam lookup Whether the diffusivities are looked up in a table instead of being divided.
+   * @param srcRow The row in the previous iteration (aligned, followed by the right neighbor of its last pixel).
+   * @param nextRow The row below in the previous iteration (aligned).
+   * @param dstRow The row in the new iteration (aligned, padded to whole vectors).
+   * @param width The number of pixels in the row.
+   * @param cache The scaled first derivatives in y direction of the row above (are replaced by the ones of this row).
+   * @param kappaSqr Kappa squared.
+   * @param dt The step length.
+   * @param table The diffusivity table (only if lookup is true).
+   * @return The number of pixels that the iteration has changed.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512, bool streaming, bool lookup>
+  static unsigned int diffuseRow(const std::uint8_t* srcRow, const std::uint8_t* nextRow, std::uint8_t* dstRow, unsigned int width, float* cache, float kappaSqr, float dt, const float* table);
+  /**
+   * @brief Computes one row of an anisotropic iteration in 16-bit fixed point.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @tparam streaming Whether the row is written with non-temporal stores (because it is not read again soon).
+   * @param srcRow The row in the previous iteration (aligned, followed by the right neighbor of its last pixel).
+   * @param nextRow The row below in the previous iteration (aligned).
+   * @param dstRow The row in the new iteration (aligned, padded to whole vectors).
+   * @param width The number of pixels in the row.
+   * @param cache The fluxes in y direction of the row above (are replaced by the ones of this row).
+   * @param flux The fixed point fluxes.
+   * @return The number of pixels that the iteration has changed.
+   */
+  template<bool simd, bool avx, bool avx512, bool streaming>
+  static unsigned int diffuseRowFixed(const std::uint8_t* srcRow, const std::uint8_t* nextRow, std::uint8_t* dstRow, unsigned int width, std::int16_t* cache, const FixedPointFlux& flux);
+  /**
+   * @brief Computes one row of an iteration in a wider pixel type.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @tparam Pixel The pixel type of the iterations.
+   * @param srcRow The row in the previous iteration (followed by the right neighbor of its last pixel).
+   * @param nextRow The row below in the previous iteration.
+   * @param dstRow The row in the new iteration (padded to whole vectors).
+   * @param width The number of pixels in the row.
+   * @param cache The scaled first derivatives in y direction of the row above (are replaced by the ones of this row).
+   * @param kappaSqr Kappa squared.
+   * @param dt The step length.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512, typename Pixel>
+  static void diffuseRowWide(const Pixel* srcRow, const Pixel* nextRow, Pixel* dstRow, unsigned int width, float* cache, float kappaSqr, float dt);
+  /**
+   * @brief Computes the diffusivities of one row for the semi-implicit scheme.
+   *
+   * They belong to the connections between the pixels and their right and lower neighbors, like the fluxes of the explicit scheme.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @param row The row (followed by the right neighbor of its last pixel).
+   * @param nextRow The row below.
+   * @param diffusivityX Receives the diffusivities between the pixels and their right neighbors (padded to whole vectors).
+   * @param diffusivityY Receives the diffusivities between the pixels and their lower neighbors (not written for isotropic tensors, which use diffusivityX in both directions).
+   * @param width The number of pixels in the row.
+   * @param kappaSqr Kappa squared.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+  static void diffusivityRow(const float* row, const float* nextRow, float* diffusivityX, float* diffusivityY, unsigned int width, float kappaSqr);
+  /**
+   * @brief Solves the tridiagonal systems of the semi-implicit scheme along rows (Thomas algorithm).
+   *
+   * The vectorized versions solve the systems of several rows at once and transpose blocks of them in registers.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (the rows are solved like with AVX2).
+   * @param rhs The first row of the right hand sides (each row is followed by the value behind its last pixel).
+   * @param diffusivities The diffusivities between the pixels and their right neighbors.
+   * @param solution Receives the solutions (padded to whole vectors).
+   * @param scratch Memory for 16 rows of stride floats.
+   * @param stride The distance between two rows of all images.
+   * @param width The number of pixels in a row.
+   * @param rows The number of rows.
+   * @param twoDt The step length of a direction (twice the step length, because the solutions of both directions are averaged).
+   */
+  template<bool simd, bool avx, bool avx512>
+  static void solveRows(const float* rhs, const float* diffusivities, float* solution, float* scratch, std::size_t stride, unsigned int width, unsigned int rows, float twoDt);
+  /**
+   * @brief Solves the tridiagonal systems of the semi-implicit scheme along columns (Thomas algorithm, vectorized across the columns) and averages the solutions of both directions.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @param rhs The first row of the right hand sides (followed by a row of the values below the last row).
+   * @param diffusivities The diffusivities between the pixels and their lower neighbors.
+   * @param factors Memory for the eliminated upper diagonals.
+   * @param solution Receives the solutions.
+   * @param rowSolution The solutions of the systems along the rows.
+   * @param dst Receives the averages of both solutions, i.e. the next iteration (padded to whole vectors).
+   * @param stride The distance between two rows of all images.
+   * @param width The number of columns.
+   * @param rows The number of rows.
+   * @param twoDt The step length of a direction (twice the step length, because the solutions of both directions are averaged).
+   */
+  template<bool simd, bool avx, bool avx512>
+  static void solveColumns(const float* rhs, const float* diffusivities, float* factors, float* solution, const float* rowSolution, float* dst, std::size_t stride, unsigned int width, unsigned int rows, float twoDt);
+  /**
+   * @brief Restores the two columns between images that are packed side by side.
+   *
+   * The column behind each image is filled like its halo and the next one repeats the first column of the following
+   * image, so that no flux crosses from one image into the other.
+   * @tparam Pixel The type of the pixels.
+   * @param image The image into which the images are packed.
+   * @param starts The first columns of the packed images.
+   * @param border The values that are assumed behind the right border of each image.
+   */
+  template<typename Pixel>
+  static void fillSeparators(ImageT<Pixel>& image, const std::vector<unsigned int>& starts, BorderPolicy border);
+  /**
+   * @brief Advances a horizontal band by several iterations in one pass (temporal blocking).
+   *
+   * The iterations are computed as a wavefront: Each stage computes one iteration a row behind the previous stage,
+   * so the intermediate iterations only need a ring of rows that stays in the cache. Earlier stages compute
+   * rows beyond the band, so that the band does not depend on intermediate iterations of neighboring bands.
+   * @tparam Pixel The pixel type of the iterations.
+   * @tparam RowFunction The type of the function that computes one row.
+   * @param src The iteration before the pass (including its halo).
+   * @param dst The iteration after the pass (its halo is not filled).
+   * @param stages The number of iterations in the pass.
+   * @param yBegin The first row of the band.
+   * @param yEnd The end of the band (exclusive).
+   * @param border The values that are assumed behind the right and bottom border.
+   * @param rows Memory for bandRows(stages) rows of dst.stride pixels.
+   * @param caches Memory for stages rows of dst.stride floats.
+   * @param changes Receives the number of pixels of the band that each iteration of the pass has changed.
+   * @param diffuseRow A function (srcRow, nextRow, dstRow, cache, streaming) that computes one row and returns the number of changed pixels.
+   */
+  template<typename Pixel, typename RowFunction>
+  static void diffuseBand(const ImageViewT<Pixel>& src, ImageT<Pixel>& dst, unsigned int stages, unsigned int yBegin, unsigned int yEnd, BorderPolicy border, Pixel* rows, float* caches, unsigned int* changes, RowFunction diffuseRow);
+  /**
+   * @brief Computes an iteration of the active tiles in a horizontal band and copies the other tiles.
+   *
+   * A pixel only depends on the 3x3 pixels around it, so a tile can only change if a pixel in it or in one of the
+   * eight tiles around it has changed in the previous iteration. The runs of active tiles in a row are computed
+   * starting one tile earlier, so that the flux into their first pixel is known.
+   * @tparam RowFunction The type of the function that computes a part of a row.
+   * @param src The previous iteration (including its halo).
+   * @param dst The new iteration (its halo is not filled).
+   * @param yBegin The first row of the band (at the top of a tile).
+   * @param yEnd The end of the band (exclusive, at the bottom of a tile or of the image).
+   * @param active The flags of the tiles that have to be computed.
+   * @param changed Receives the flags of the tiles of the band that the iteration has changed.
+   * @param scratch Memory for a row of dst.stride pixels.
+   * @param cache Memory for a row of dst.stride floats.
+   * @param diffuseRow A function (srcRow, nextRow, dstRow, width, cache) that computes a part of a row and returns the number of changed pixels.
+   * @return The number of pixels of the band that the iteration has changed.
+   */
+  template<typename RowFunction>
+  static unsigned int diffuseTiles(const ImageView& src, Image& dst, unsigned int yBegin, unsigned int yEnd, const std::uint8_t* active, std::uint8_t* changed, std::uint8_t* scratch, float* cache, RowFunction diffuseRow);
+  /**
+   * @brief Calculates the number of rows that a band needs for a pass.
+   * @param stages The number of iterations in the pass.
+   * @return The number of rows for the rings of the intermediate iterations and a scratch row.
+   */
+  static unsigned int bandRows(unsigned int stages)
+  {
+    return (stages - 1) * ringRows + 1;
+  }
   /**
    * @brief Denoises an image.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
    * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
    * @tparam simd Whether SIMD instructions should be used.
    * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
    * @param image The image that is denoised.
    * @param kappa The larger, the less the diffusion is blocked at edges.
    * @param dt The step length in the numeric solution of the diffusion equation.
    * @param times The number of iterations (i.e. the solution is evaluated at dt*times).
+   * @param border The values that are assumed behind the right and bottom border.
+   * @param threads The number of horizontal bands that are processed in parallel.
+   * @param blockDepth The number of iterations that are computed in one pass over the image.
+   * @param table The diffusivity table for kappa (nullptr if the diffusivities should be divided).
+   * @param flux The fixed point fluxes for kappa and dt (nullptr if the iterations are computed in single precision).
+   * @param tolerance The iterations stop after the first one that changes at most this many pixels.
+   * @param storePolicy Whether the last iteration of each pass is written with non-temporal stores.
+   * @param starts The first columns of the images that are packed side by side (nullptr for a single image).
+   * @param iterations Receives the number of iterations until the result.
    * @return A denoised image.
    */
-  template<bool isotropic, bool simd, bool avx>
-  static Image applyT(const Image& image, float kappa, float dt, unsigned int times);
+  template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+  static Image applyT(const ImageView& image, float kappa, float dt, unsigned int times, BorderPolicy border, unsigned int threads, unsigned int blockDepth, const float* table, const FixedPointFlux* flux, unsigned int tolerance, StorePolicy storePolicy, const std::vector<unsigned int>* starts, unsigned int& iterations);
+  /**
+   * @brief Denoises an image while only recomputing the tiles that can still change.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @param image The image that is denoised.
+   * @param kappa The larger, the less the diffusion is blocked at edges.
+   * @param dt The step length in the numeric solution of the diffusion equation.
+   * @param times The number of iterations (i.e. the solution is evaluated at dt*times).
+   * @param border The values that are assumed behind the right and bottom border.
+   * @param threads The number of horizontal bands that are processed in parallel.
+   * @param table The diffusivity table for kappa (nullptr if the diffusivities should be divided).
+   * @param flux The fixed point fluxes for kappa and dt (nullptr if the iterations are computed in single precision).
+   * @param tolerance The iterations stop after the first one that changes at most this many pixels.
+   * @param starts The first columns of the images that are packed side by side (nullptr for a single image).
+   * @param iterations Receives the number of iterations until the result.
+   * @return A denoised image.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+  static Image applyTiles(const ImageView& image, float kappa, float dt, unsigned int times, BorderPolicy border, unsigned int threads, const float* table, const FixedPointFlux* flux, unsigned int tolerance, const std::vector<unsigned int>* starts, unsigned int& iterations);
+  /**
+   * @brief Denoises an image while storing the iterations in a wider pixel type.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @tparam Pixel The pixel type of the iterations.
+   * @param image The image that is denoised.
+   * @param kappa The larger, the less the diffusion is blocked at edges.
+   * @param dt The step length in the numeric solution of the diffusion equation.
+   * @param times The number of iterations (i.e. the solution is evaluated at dt*times).
+   * @param border The values that are assumed behind the right and bottom border.
+   * @param threads The number of horizontal bands that are processed in parallel.
+   * @param blockDepth The number of iterations that are computed in one pass over the image.
+   * @param starts The first columns of the images that are packed side by side (nullptr for a single image).
+   * @return A denoised image.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512, typename Pixel>
+  static Image applyWideT(const ImageView& image, float kappa, float dt, unsigned int times, BorderPolicy border, unsigned int threads, unsigned int blockDepth, const std::vector<unsigned int>* starts);
+  /**
+   * @brief Denoises an image with the semi-implicit additive operator splitting (AOS) scheme.
+   *
+   * Each iteration solves the linear implicit step along the rows and along the columns separately with the diffusivities
+   * of the previous iteration and averages both solutions. This is stable for every step length, so far fewer
+   * iterations are needed than with the explicit scheme.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @param image The image that is denoised.
+   * @param kappa The larger, the less the diffusion is blocked at edges.
+   * @param dt The step length in the numeric solution of the diffusion equation.
+   * @param times The number of iterations (i.e. the solution is evaluated at dt*times).
+   * @param border The values that are assumed behind the right and bottom border.
+   * @param threads The number of bands or stripes that are processed in parallel.
+   * @return A denoised image.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+  static Image applyAOS(const ImageView& image, float kappa, float dt, unsigned int times, BorderPolicy border, unsigned int threads);
+  /**
+   * @brief Denoises an image on the levels of a pyramid from the coarsest to the full resolution.
+   *
+   * A level with twice the grid spacing diffuses four times as long per iteration, so the coarsest level covers
+   * most of the diffusion time with few iterations. Each finer level adds the upsampled change of the coarser level
+   * to its own pixels and only computes the refinement iterations, which remove the finer details quickly.
+   * @param image The image that is denoised.
+   * @param iterations Receives the number of iterations at full resolution.
+   * @return A denoised image.
+   */
+  Image applyPyramid(const ImageView& image, unsigned int& iterations);
+  /**
+   * @brief Denoises an image at its resolution with the configured optimization level.
+   * @param image The image that is denoised.
+   * @param times The number of iterations.
+   * @param starts The first columns of the images that are packed side by side (nullptr for a single image).
+   * @param iterations Receives the number of iterations until the result.
+   * @return A denoised image.
+   */
+  Image applyLevel(const ImageView& image, unsigned int times, const std::vector<unsigned int>* starts, unsigned int& iterations);
+  /**
+   * @brief Denoises an image with the configured diffusivity function and kind of diffusion tensors.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @param image The image that is denoised.
+   * @param times The number of iterations.
+   * @param starts The first columns of the images that are packed side by side (nullptr for a single image).
+   * @param iterations Receives the number of iterations until the result.
+   * @return A denoised image.
+   */
+  template<bool simd, bool avx, bool avx512>
+  Image applyDiffusivity(const ImageView& image, unsigned int times, const std::vector<unsigned int>* starts, unsigned int& iterations);
+  /**
+   * @brief Denoises an image in the configured precision.
+   * @tparam diffusivity The function that maps the squared norm of the gradient to a diffusivity.
+   * @tparam isotropic Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @param image The image that is denoised.
+   * @param times The number of iterations.
+   * @param starts The first columns of the images that are packed side by side (nullptr for a single image).
+   * @param iterations Receives the number of iterations until the result.
+   * @return A denoised image.
+   */
+  template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+  Image applyPrecision(const ImageView& image, unsigned int times, const std::vector<unsigned int>* starts, unsigned int& iterations);
   float kappa;                         ///< The larger, the less the diffusion is blocked at edges.
   float dt;                            ///< The step length in the numeric solution of the diffusion equation.
   unsigned int times;                  ///< The number of iterations (i.e. the solution is evaluated at dt*times).
   bool isotropic;                      ///< Whether isotropic (true) or anisotropic (false) diffusion tensors should be used.
+  DiffusivityFunction diffusivityFunction; ///< The function that maps the squared norm of the gradient to a diffusivity.
   OptimizationLevel optimizationLevel; ///< The kind of optimization that should be used.
+  PixelFormat precision;               ///< The pixel type in which the iterations are stored.
+  BorderPolicy border;                 ///< The values that are assumed behind the right and bottom border.
+  unsigned int threads;                ///< The number of threads that process horizontal bands of each iteration.
+  unsigned int blockDepth;             ///< The number of iterations that are computed in one pass over the image.
+  std::vector<float> diffusivityTable; ///< The diffusivities for kappa (empty if they are divided).
+  bool fixedPoint;                     ///< Whether the anisotropic uint8 precision is computed in fixed point.
+  FixedPointFlux fixedPointFluxes;     ///< The fixed point fluxes for kappa and dt.
+  unsigned int tolerance;              ///< The uint8 precision stops after the first iteration that changes at most this many pixels.
+  bool activeTiles;                    ///< Whether the uint8 precision only recomputes the tiles that can still change.
+  bool semiImplicit;                   ///< Whether the iterations are computed with the semi-implicit AOS scheme.
+  unsigned int pyramidLevels;          ///< The number of times that the image is halved in size.
+  unsigned int refinementIterations;   ///< The number of iterations that each finer level of the pyramid computes.
+  bool rowStreaming;                   ///< Whether maxBlockDepth iterations are computed in one pass.
+  StorePolicy storePolicy;             ///< Whether the vectorized uint8 kernels write the result of each pass with non-temporal stores.
+
+  static constexpr unsigned int ringRows = 3; ///< The number of rows of an intermediate iteration that a stage keeps (two neighbors and the row below the image).
+  static constexpr unsigned int tileWidth = Image::alignment; ///< The width of the tiles of the active set (so that they start at aligned addresses).
+  static constexpr unsigned int tileHeight = 16; ///< The height of the tiles of the active set (the row above each tile is computed again).
 };
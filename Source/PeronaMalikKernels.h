@@ -0,0 +1,1210 @@
+/**
+ * @file PeronaMalikKernels.h
+ *
+ * This file implements the kernels of the PeronaMalik class, which are compiled once per instruction set.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#include "Diffusivity.h"
+#include "Pixel.h"
+#include "SIMD.h"
+
+#include "PeronaMalik.h"
+
+/**
+ * @brief Instantiates the row functions of the PeronaMalik class for a diffusivity function, one kind of diffusion tensors and an instruction set.
+ * @param prefix Nothing to instantiate them or extern to declare that they are instantiated elsewhere.
+ */
+#define INSTANTIATE_PERONAMALIK_KERNELS_ISOTROPIC(prefix, diffusivity, isotropic, simd, avx, avx512) \
+  prefix template unsigned int PeronaMalik::diffuseRow<diffusivity, isotropic, simd, avx, avx512, false, false>(const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int, float*, float, float, const float*); \
+  prefix template unsigned int PeronaMalik::diffuseRow<diffusivity, isotropic, simd, avx, avx512, false, true>(const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int, float*, float, float, const float*); \
+  prefix template unsigned int PeronaMalik::diffuseRow<diffusivity, isotropic, simd, avx, avx512, true, false>(const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int, float*, float, float, const float*); \
+  prefix template unsigned int PeronaMalik::diffuseRow<diffusivity, isotropic, simd, avx, avx512, true, true>(const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int, float*, float, float, const float*); \
+  prefix template void PeronaMalik::diffuseRowWide<diffusivity, isotropic, simd, avx, avx512, std::uint16_t>(const std::uint16_t*, const std::uint16_t*, std::uint16_t*, unsigned int, float*, float, float); \
+  prefix template void PeronaMalik::diffuseRowWide<diffusivity, isotropic, simd, avx, avx512, float>(const float*, const float*, float*, unsigned int, float*, float, float); \
+  prefix template void PeronaMalik::diffuseRowWide<diffusivity, isotropic, simd, avx, avx512, Half>(const Half*, const Half*, Half*, unsigned int, float*, float, float); \
+  prefix template void PeronaMalik::diffusivityRow<diffusivity, isotropic, simd, avx, avx512>(const float*, const float*, float*, float*, unsigned int, float)
+
+/**
+ * @brief Instantiates the row functions of the PeronaMalik class for a diffusivity function and an instruction set.
+ * @param prefix Nothing to instantiate them or extern to declare that they are instantiated elsewhere.
+ */
+#define INSTANTIATE_PERONAMALIK_KERNELS_DIFFUSIVITY(prefix, diffusivity, simd, avx, avx512) \
+  INSTANTIATE_PERONAMALIK_KERNELS_ISOTROPIC(prefix, diffusivity, false, simd, avx, avx512); \
+  INSTANTIATE_PERONAMALIK_KERNELS_ISOTROPIC(prefix, diffusivity, true, simd, avx, avx512)
+
+/**
+ * @brief Instantiates the row functions of the PeronaMalik class for an instruction set.
+ * @param prefix Nothing to instantiate them or extern to declare that they are instantiated elsewhere.
+ */
+#define INSTANTIATE_PERONAMALIK_KERNELS(prefix, simd, avx, avx512) \
+  INSTANTIATE_PERONAMALIK_KERNELS_DIFFUSIVITY(prefix, DiffusivityFunction::rational, simd, avx, avx512); \
+  INSTANTIATE_PERONAMALIK_KERNELS_DIFFUSIVITY(prefix, DiffusivityFunction::exponential, simd, avx, avx512); \
+  INSTANTIATE_PERONAMALIK_KERNELS_DIFFUSIVITY(prefix, DiffusivityFunction::tukey, simd, avx, avx512); \
+  INSTANTIATE_PERONAMALIK_KERNELS_DIFFUSIVITY(prefix, DiffusivityFunction::charbonnier, simd, avx, avx512); \
+  INSTANTIATE_PERONAMALIK_KERNELS_DIFFUSIVITY(prefix, DiffusivityFunction::weickert, simd, avx, avx512); \
+  prefix template unsigned int PeronaMalik::diffuseRowFixed<simd, avx, avx512, false>(const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int, std::int16_t*, const FixedPointFlux&); \
+  prefix template unsigned int PeronaMalik::diffuseRowFixed<simd, avx, avx512, true>(const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int, std::int16_t*, const FixedPointFlux&); \
+  prefix template void PeronaMalik::solveRows<simd, avx, avx512>(const float*, const float*, float*, float*, std::size_t, unsigned int, unsigned int, float); \
+  prefix template void PeronaMalik::solveColumns<simd, avx, avx512>(const float*, const float*, float*, float*, const float*, float*, std::size_t, unsigned int, unsigned int, float)
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool lookup>
+ALWAYSINLINE float PeronaMalik::diffusion(float firstDerivativeX, float firstDerivativeY, float kappaSqr, float dt, float& lastScaledFirstDerivativeX, float& cache, const float* table)
+{
+  float scaledFirstDerivativeX, scaledFirstDerivativeY;
+
+  // The operations are done in the same order as in the vectorized versions so that the results are identical.
+  if(lookup && isotropic)
+  {
+    float g = table[static_cast<int>(firstDerivativeX * firstDerivativeX + firstDerivativeY * firstDerivativeY)];
+    scaledFirstDerivativeX = firstDerivativeX * g;
+    scaledFirstDerivativeY = firstDerivativeY * g;
+  }
+  else if(lookup)
+  {
+    scaledFirstDerivativeX = table[static_cast<int>(firstDerivativeX)];
+    scaledFirstDerivativeY = table[static_cast<int>(firstDerivativeY)];
+  }
+  else if(isotropic)
+  {
+    float g = DiffusivityTraits<diffusivity>::compute(firstDerivativeX * firstDerivativeX + firstDerivativeY * firstDerivativeY, kappaSqr);
+    scaledFirstDerivativeX = firstDerivativeX * g;
+    scaledFirstDerivativeY = firstDerivativeY * g;
+  }
+  else
+  {
+    float gX = DiffusivityTraits<diffusivity>::compute(firstDerivativeX * firstDerivativeX, kappaSqr);
+    float gY = DiffusivityTraits<diffusivity>::compute(firstDerivativeY * firstDerivativeY, kappaSqr);
+    scaledFirstDerivativeX = firstDerivativeX * gX;
+    scaledFirstDerivativeY = firstDerivativeY * gY;
+  }
+
+  float eulerStep = dt * ((scaledFirstDerivativeX - lastScaledFirstDerivativeX) + (scaledFirstDerivativeY - cache));
+
+  lastScaledFirstDerivativeX = scaledFirstDerivativeX;
+  cache = scaledFirstDerivativeY;
+
+  return eulerStep;
+}
+
+#ifdef HAS_SSE4
+ALWAYSINLINE __m128i PeronaMalik::fixedPointFluxSSE(__m128i firstDerivative, const __m128i (&tables)[6])
+{
+  const __m128i absolute = _mm_abs_epi16(firstDerivative);
+  // The first 8 entries are the fluxes of the derivatives 0 to 7, the others are segments of 32 derivatives.
+  const __m128i index = _mm_min_epu16(absolute, _mm_add_epi16(_mm_srli_epi16(absolute, 5), _mm_set1_epi16(8)));
+
+  // The low and high bytes of the entries are shuffled separately (indices with bit 7 set yield zero bytes).
+  const __m128i lowIndex = _mm_or_si128(index, _mm_set1_epi16(static_cast<short>(0x8000)));
+  const __m128i highIndex = _mm_or_si128(_mm_slli_epi16(index, 8), _mm_set1_epi16(0x80));
+  const __m128i base = _mm_or_si128(_mm_shuffle_epi8(tables[0], lowIndex), _mm_shuffle_epi8(tables[1], highIndex));
+  const __m128i linear = _mm_or_si128(_mm_shuffle_epi8(tables[2], lowIndex), _mm_shuffle_epi8(tables[3], highIndex));
+  const __m128i quadratic = _mm_or_si128(_mm_shuffle_epi8(tables[4], lowIndex), _mm_shuffle_epi8(tables[5], highIndex));
+
+  const __m128i t = _mm_slli_epi16(_mm_and_si128(absolute, _mm_set1_epi16(31)), 10);
+  const __m128i value = _mm_add_epi16(base, _mm_mulhrs_epi16(_mm_add_epi16(linear, _mm_mulhrs_epi16(quadratic, t)), t));
+  return _mm_sign_epi16(value, firstDerivative);
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic>
+ALWAYSINLINE __m128 PeronaMalik::eulerStepSSE(__m128 firstDerivativeX, __m128 firstDerivativeY, __m128 kappaSqrVec, __m128 dtVec, __m128& lastScaledFirstDerivativeX, float*& cacheptr)
+{
+  __m128 scaledFirstDerivativeX, scaledFirstDerivativeY;
+
+  if(isotropic)
+  {
+    __m128 sqrNormXY = _mm_add_ps(_mm_mul_ps(firstDerivativeX, firstDerivativeX), _mm_mul_ps(firstDerivativeY, firstDerivativeY));
+    __m128 g = DiffusivityTraits<diffusivity>::computeSSE(sqrNormXY, kappaSqrVec);
+    scaledFirstDerivativeX = _mm_mul_ps(firstDerivativeX, g);
+    scaledFirstDerivativeY = _mm_mul_ps(firstDerivativeY, g);
+  }
+  else
+  {
+    __m128 gX = DiffusivityTraits<diffusivity>::computeSSE(_mm_mul_ps(firstDerivativeX, firstDerivativeX), kappaSqrVec);
+    __m128 gY = DiffusivityTraits<diffusivity>::computeSSE(_mm_mul_ps(firstDerivativeY, firstDerivativeY), kappaSqrVec);
+    scaledFirstDerivativeX = _mm_mul_ps(firstDerivativeX, gX);
+    scaledFirstDerivativeY = _mm_mul_ps(firstDerivativeY, gY);
+  }
+
+  return eulerStepSSE(scaledFirstDerivativeX, scaledFirstDerivativeY, dtVec, lastScaledFirstDerivativeX, cacheptr);
+}
+
+ALWAYSINLINE __m128 PeronaMalik::eulerStepSSE(__m128 scaledFirstDerivativeX, __m128 scaledFirstDerivativeY, __m128 dtVec, __m128& lastScaledFirstDerivativeX, float*& cacheptr)
+{
+  __m128 lastColScaledFirstDerivativeX = _mm_castsi128_ps(_mm_alignr_epi8(_mm_castps_si128(scaledFirstDerivativeX), _mm_castps_si128(lastScaledFirstDerivativeX), 12));
+  __m128 lastRowScaledFirstDerivativeY = _mm_load_ps(cacheptr);
+
+  __m128 eulerStep = _mm_mul_ps(dtVec, _mm_add_ps(_mm_sub_ps(scaledFirstDerivativeX, lastColScaledFirstDerivativeX), _mm_sub_ps(scaledFirstDerivativeY, lastRowScaledFirstDerivativeY)));
+
+  lastScaledFirstDerivativeX = scaledFirstDerivativeX;
+  _mm_store_ps(cacheptr, scaledFirstDerivativeY);
+
+  cacheptr += 4;
+
+  return eulerStep;
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool lookup>
+ALWAYSINLINE void PeronaMalik::diffusionSSE(__m128i firstDerivativeXi, __m128i firstDerivativeYi, __m128i& res, __m128 kappaSqrVec, __m128 dtVec, __m128& lastScaledFirstDerivativeX, float*& cacheptr, const float* table)
+{
+  if(lookup)
+  {
+    // SSE has no gather instruction, so the lanes are looked up one by one.
+    __m128 scaledFirstDerivativeX, scaledFirstDerivativeY;
+    if(isotropic)
+    {
+      __m128i sqrNormXY = _mm_add_epi32(_mm_mullo_epi32(firstDerivativeXi, firstDerivativeXi), _mm_mullo_epi32(firstDerivativeYi, firstDerivativeYi));
+      __m128 g = _mm_setr_ps(table[_mm_extract_epi32(sqrNormXY, 0)], table[_mm_extract_epi32(sqrNormXY, 1)], table[_mm_extract_epi32(sqrNormXY, 2)], table[_mm_extract_epi32(sqrNormXY, 3)]);
+      scaledFirstDerivativeX = _mm_mul_ps(_mm_cvtepi32_ps(firstDerivativeXi), g);
+      scaledFirstDerivativeY = _mm_mul_ps(_mm_cvtepi32_ps(firstDerivativeYi), g);
+    }
+    else
+    {
+      scaledFirstDerivativeX = _mm_setr_ps(table[_mm_extract_epi32(firstDerivativeXi, 0)], table[_mm_extract_epi32(firstDerivativeXi, 1)], table[_mm_extract_epi32(firstDerivativeXi, 2)], table[_mm_extract_epi32(firstDerivativeXi, 3)]);
+      scaledFirstDerivativeY = _mm_setr_ps(table[_mm_extract_epi32(firstDerivativeYi, 0)], table[_mm_extract_epi32(firstDerivativeYi, 1)], table[_mm_extract_epi32(firstDerivativeYi, 2)], table[_mm_extract_epi32(firstDerivativeYi, 3)]);
+    }
+    res = _mm_cvttps_epi32(eulerStepSSE(scaledFirstDerivativeX, scaledFirstDerivativeY, dtVec, lastScaledFirstDerivativeX, cacheptr));
+  }
+  else
+    res = _mm_cvttps_epi32(eulerStepSSE<diffusivity, isotropic>(_mm_cvtepi32_ps(firstDerivativeXi), _mm_cvtepi32_ps(firstDerivativeYi), kappaSqrVec, dtVec, lastScaledFirstDerivativeX, cacheptr));
+}
+
+ALWAYSINLINE __m128i PeronaMalik::fixedPointStepSSE(__m128i row, __m128i rowx, __m128i rowy, const __m128i (&tables)[6], __m128i roundingBias, __m128i shift, __m128i& lastFluxX, std::int16_t*& cacheptr)
+{
+  const __m128i fluxX = fixedPointFluxSSE(_mm_sub_epi16(rowx, row), tables);
+  const __m128i fluxY = fixedPointFluxSSE(_mm_sub_epi16(rowy, row), tables);
+  const __m128i lastColFluxX = _mm_alignr_epi8(fluxX, lastFluxX, 14);
+  const __m128i lastRowFluxY = _mm_load_si128(reinterpret_cast<const __m128i*>(cacheptr));
+  lastFluxX = fluxX;
+  _mm_store_si128(reinterpret_cast<__m128i*>(cacheptr), fluxY);
+  cacheptr += 8;
+
+  __m128i sum = _mm_add_epi16(_mm_sub_epi16(fluxX, lastColFluxX), _mm_sub_epi16(fluxY, lastRowFluxY));
+  // The step is rounded toward zero like in the single precision path.
+  sum = _mm_add_epi16(sum, _mm_and_si128(_mm_srai_epi16(sum, 15), roundingBias));
+  return _mm_add_epi16(row, _mm_sra_epi16(sum, shift));
+}
+
+ALWAYSINLINE unsigned int PeronaMalik::countChangesSSE(__m128i row, __m128i result, unsigned int remaining)
+{
+  unsigned int changed = ~static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(row, result))) & 0xffff;
+  // The last vector of a row also contains the halo and the padding.
+  if(remaining < 16)
+    changed &= (1u << remaining) - 1;
+  return _mm_popcnt_u32(changed);
+}
+
+ALWAYSINLINE void PeronaMalik::transposeSSE(__m128 (&rows)[4])
+{
+  _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+}
+#endif
+
+#ifdef HAS_AVX2
+ALWAYSINLINE __m256i PeronaMalik::fixedPointFluxAVX(__m256i firstDerivative, const __m256i (&tables)[6])
+{
+  const __m256i absolute = _mm256_abs_epi16(firstDerivative);
+  // The first 8 entries are the fluxes of the derivatives 0 to 7, the others are segments of 32 derivatives.
+  const __m256i index = _mm256_min_epu16(absolute, _mm256_add_epi16(_mm256_srli_epi16(absolute, 5), _mm256_set1_epi16(8)));
+
+  // The low and high bytes of the entries are shuffled separately (indices with bit 7 set yield zero bytes).
+  const __m256i lowIndex = _mm256_or_si256(index, _mm256_set1_epi16(static_cast<short>(0x8000)));
+  const __m256i highIndex = _mm256_or_si256(_mm256_slli_epi16(index, 8), _mm256_set1_epi16(0x80));
+  const __m256i base = _mm256_or_si256(_mm256_shuffle_epi8(tables[0], lowIndex), _mm256_shuffle_epi8(tables[1], highIndex));
+  const __m256i linear = _mm256_or_si256(_mm256_shuffle_epi8(tables[2], lowIndex), _mm256_shuffle_epi8(tables[3], highIndex));
+  const __m256i quadratic = _mm256_or_si256(_mm256_shuffle_epi8(tables[4], lowIndex), _mm256_shuffle_epi8(tables[5], highIndex));
+
+  const __m256i t = _mm256_slli_epi16(_mm256_and_si256(absolute, _mm256_set1_epi16(31)), 10);
+  const __m256i value = _mm256_add_epi16(base, _mm256_mulhrs_epi16(_mm256_add_epi16(linear, _mm256_mulhrs_epi16(quadratic, t)), t));
+  return _mm256_sign_epi16(value, firstDerivative);
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic>
+ALWAYSINLINE __m256 PeronaMalik::eulerStepAVX(__m256 firstDerivativeX, __m256 firstDerivativeY, __m256 kappaSqrVec, __m256 dtVec, __m256& lastScaledFirstDerivativeX, float*& cacheptr)
+{
+  __m256 scaledFirstDerivativeX, scaledFirstDerivativeY;
+
+  if(isotropic)
+  {
+    __m256 sqrNormXY = _mm256_add_ps(_mm256_mul_ps(firstDerivativeX, firstDerivativeX), _mm256_mul_ps(firstDerivativeY, firstDerivativeY));
+    __m256 g = DiffusivityTraits<diffusivity>::computeAVX(sqrNormXY, kappaSqrVec);
+    scaledFirstDerivativeX = _mm256_mul_ps(firstDerivativeX, g);
+    scaledFirstDerivativeY = _mm256_mul_ps(firstDerivativeY, g);
+  }
+  else
+  {
+    __m256 gX = DiffusivityTraits<diffusivity>::computeAVX(_mm256_mul_ps(firstDerivativeX, firstDerivativeX), kappaSqrVec);
+    __m256 gY = DiffusivityTraits<diffusivity>::computeAVX(_mm256_mul_ps(firstDerivativeY, firstDerivativeY), kappaSqrVec);
+    scaledFirstDerivativeX = _mm256_mul_ps(firstDerivativeX, gX);
+    scaledFirstDerivativeY = _mm256_mul_ps(firstDerivativeY, gY);
+  }
+
+  return eulerStepAVX(scaledFirstDerivativeX, scaledFirstDerivativeY, dtVec, lastScaledFirstDerivativeX, cacheptr);
+}
+
+ALWAYSINLINE __m256 PeronaMalik::eulerStepAVX(__m256 scaledFirstDerivativeX, __m256 scaledFirstDerivativeY, __m256 dtVec, __m256& lastScaledFirstDerivativeX, float*& cacheptr)
+{
+  __m256 lastColScaledFirstDerivativeX = _mm256_castsi256_ps(_mm256_alignr_epi8(_mm256_castps_si256(scaledFirstDerivativeX), _mm256_castps_si256(_mm256_permute2f128_ps(lastScaledFirstDerivativeX, scaledFirstDerivativeX, (2 << 4) | 1)), 12));
+  __m256 lastRowScaledFirstDerivativeY = _mm256_load_ps(cacheptr);
+
+  __m256 eulerStep = _mm256_mul_ps(dtVec, _mm256_add_ps(_mm256_sub_ps(scaledFirstDerivativeX, lastColScaledFirstDerivativeX), _mm256_sub_ps(scaledFirstDerivativeY, lastRowScaledFirstDerivativeY)));
+
+  lastScaledFirstDerivativeX = scaledFirstDerivativeX;
+  _mm256_store_ps(cacheptr, scaledFirstDerivativeY);
+
+  cacheptr += 8;
+
+  return eulerStep;
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool lookup>
+ALWAYSINLINE void PeronaMalik::diffusionAVX(__m256i firstDerivativeXi, __m256i firstDerivativeYi, __m256i& res, __m256 kappaSqrVec, __m256 dtVec, __m256& lastScaledFirstDerivativeX, float*& cacheptr, const float* table)
+{
+  if(lookup)
+  {
+    __m256 scaledFirstDerivativeX, scaledFirstDerivativeY;
+    if(isotropic)
+    {
+      __m256i sqrNormXY = _mm256_add_epi32(_mm256_mullo_epi32(firstDerivativeXi, firstDerivativeXi), _mm256_mullo_epi32(firstDerivativeYi, firstDerivativeYi));
+      __m256 g = _mm256_i32gather_ps(table, sqrNormXY, 4);
+      scaledFirstDerivativeX = _mm256_mul_ps(_mm256_cvtepi32_ps(firstDerivativeXi), g);
+      scaledFirstDerivativeY = _mm256_mul_ps(_mm256_cvtepi32_ps(firstDerivativeYi), g);
+    }
+    else
+    {
+      scaledFirstDerivativeX = _mm256_i32gather_ps(table, firstDerivativeXi, 4);
+      scaledFirstDerivativeY = _mm256_i32gather_ps(table, firstDerivativeYi, 4);
+    }
+    res = _mm256_cvttps_epi32(eulerStepAVX(scaledFirstDerivativeX, scaledFirstDerivativeY, dtVec, lastScaledFirstDerivativeX, cacheptr));
+  }
+  else
+    res = _mm256_cvttps_epi32(eulerStepAVX<diffusivity, isotropic>(_mm256_cvtepi32_ps(firstDerivativeXi), _mm256_cvtepi32_ps(firstDerivativeYi), kappaSqrVec, dtVec, lastScaledFirstDerivativeX, cacheptr));
+}
+
+ALWAYSINLINE __m256i PeronaMalik::fixedPointStepAVX(__m256i row, __m256i rowx, __m256i rowy, const __m256i (&tables)[6], __m256i roundingBias, __m128i shift, __m256i& lastFluxX, std::int16_t*& cacheptr)
+{
+  const __m256i fluxX = fixedPointFluxAVX(_mm256_sub_epi16(rowx, row), tables);
+  const __m256i fluxY = fixedPointFluxAVX(_mm256_sub_epi16(rowy, row), tables);
+  const __m256i lastColFluxX = _mm256_alignr_epi8(fluxX, _mm256_permute2x128_si256(lastFluxX, fluxX, (2 << 4) | 1), 14);
+  const __m256i lastRowFluxY = _mm256_load_si256(reinterpret_cast<const __m256i*>(cacheptr));
+  lastFluxX = fluxX;
+  _mm256_store_si256(reinterpret_cast<__m256i*>(cacheptr), fluxY);
+  cacheptr += 16;
+
+  __m256i sum = _mm256_add_epi16(_mm256_sub_epi16(fluxX, lastColFluxX), _mm256_sub_epi16(fluxY, lastRowFluxY));
+  // The step is rounded toward zero like in the single precision path.
+  sum = _mm256_add_epi16(sum, _mm256_and_si256(_mm256_srai_epi16(sum, 15), roundingBias));
+  return _mm256_add_epi16(row, _mm256_sra_epi16(sum, shift));
+}
+
+ALWAYSINLINE unsigned int PeronaMalik::countChangesAVX(__m256i row, __m256i result, unsigned int remaining)
+{
+  unsigned int changed = ~static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(row, result)));
+  // The last vector of a row also contains the halo and the padding.
+  if(remaining < 32)
+    changed &= (1u << remaining) - 1;
+  return _mm_popcnt_u32(changed);
+}
+
+ALWAYSINLINE void PeronaMalik::transposeAVX(__m256 (&rows)[8])
+{
+  // The pairs of rows are interleaved, then the quadruples, and finally the lanes are exchanged.
+  __m256 pairs[8], quadruples[8];
+  for(unsigned int i = 0; i < 4; i++)
+  {
+    pairs[2 * i] = _mm256_unpacklo_ps(rows[2 * i], rows[2 * i + 1]);
+    pairs[2 * i + 1] = _mm256_unpackhi_ps(rows[2 * i], rows[2 * i + 1]);
+  }
+  for(unsigned int i = 0; i < 2; i++)
+  {
+    quadruples[4 * i] = _mm256_shuffle_ps(pairs[4 * i], pairs[4 * i + 2], 0x44);
+    quadruples[4 * i + 1] = _mm256_shuffle_ps(pairs[4 * i], pairs[4 * i + 2], 0xee);
+    quadruples[4 * i + 2] = _mm256_shuffle_ps(pairs[4 * i + 1], pairs[4 * i + 3], 0x44);
+    quadruples[4 * i + 3] = _mm256_shuffle_ps(pairs[4 * i + 1], pairs[4 * i + 3], 0xee);
+  }
+  for(unsigned int i = 0; i < 4; i++)
+  {
+    rows[i] = _mm256_permute2f128_ps(quadruples[i], quadruples[i + 4], 0x20);
+    rows[i + 4] = _mm256_permute2f128_ps(quadruples[i], quadruples[i + 4], 0x31);
+  }
+}
+#endif
+
+#ifdef HAS_AVX512
+ALWAYSINLINE __m512i PeronaMalik::fixedPointFluxAVX512(__m512i firstDerivative, const __m512i (&tables)[3])
+{
+  const __m512i absolute = _mm512_abs_epi16(firstDerivative);
+  // The first 8 entries are the fluxes of the derivatives 0 to 7, the others are segments of 32 derivatives.
+  const __m512i index = _mm512_min_epu16(absolute, _mm512_add_epi16(_mm512_srli_epi16(absolute, 5), _mm512_set1_epi16(8)));
+
+  // The entries are permuted as whole words, so the tables do not have to be split into bytes.
+  const __m512i base = _mm512_permutexvar_epi16(index, tables[0]);
+  const __m512i linear = _mm512_permutexvar_epi16(index, tables[1]);
+  const __m512i quadratic = _mm512_permutexvar_epi16(index, tables[2]);
+
+  const __m512i t = _mm512_slli_epi16(_mm512_and_si512(absolute, _mm512_set1_epi16(31)), 10);
+  const __m512i value = _mm512_add_epi16(base, _mm512_mulhrs_epi16(_mm512_add_epi16(linear, _mm512_mulhrs_epi16(quadratic, t)), t));
+  return _mm512_mask_sub_epi16(value, _mm512_movepi16_mask(firstDerivative), _mm512_setzero_si512(), value);
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic>
+ALWAYSINLINE __m512 PeronaMalik::eulerStepAVX512(__m512 firstDerivativeX, __m512 firstDerivativeY, __m512 kappaSqrVec, __m512 dtVec, __m512& lastScaledFirstDerivativeX, float*& cacheptr)
+{
+  __m512 scaledFirstDerivativeX, scaledFirstDerivativeY;
+
+  if(isotropic)
+  {
+    __m512 sqrNormXY = _mm512_add_ps(_mm512_mul_ps(firstDerivativeX, firstDerivativeX), _mm512_mul_ps(firstDerivativeY, firstDerivativeY));
+    __m512 g = DiffusivityTraits<diffusivity>::computeAVX512(sqrNormXY, kappaSqrVec);
+    scaledFirstDerivativeX = _mm512_mul_ps(firstDerivativeX, g);
+    scaledFirstDerivativeY = _mm512_mul_ps(firstDerivativeY, g);
+  }
+  else
+  {
+    __m512 gX = DiffusivityTraits<diffusivity>::computeAVX512(_mm512_mul_ps(firstDerivativeX, firstDerivativeX), kappaSqrVec);
+    __m512 gY = DiffusivityTraits<diffusivity>::computeAVX512(_mm512_mul_ps(firstDerivativeY, firstDerivativeY), kappaSqrVec);
+    scaledFirstDerivativeX = _mm512_mul_ps(firstDerivativeX, gX);
+    scaledFirstDerivativeY = _mm512_mul_ps(firstDerivativeY, gY);
+  }
+
+  return eulerStepAVX512(scaledFirstDerivativeX, scaledFirstDerivativeY, dtVec, lastScaledFirstDerivativeX, cacheptr);
+}
+
+ALWAYSINLINE __m512 PeronaMalik::eulerStepAVX512(__m512 scaledFirstDerivativeX, __m512 scaledFirstDerivativeY, __m512 dtVec, __m512& lastScaledFirstDerivativeX, float*& cacheptr)
+{
+  // valignd shifts across the whole vector, so the lanes do not have to be permuted first.
+  __m512 lastColScaledFirstDerivativeX = _mm512_castsi512_ps(_mm512_alignr_epi32(_mm512_castps_si512(scaledFirstDerivativeX), _mm512_castps_si512(lastScaledFirstDerivativeX), 15));
+  __m512 lastRowScaledFirstDerivativeY = _mm512_load_ps(cacheptr);
+
+  __m512 eulerStep = _mm512_mul_ps(dtVec, _mm512_add_ps(_mm512_sub_ps(scaledFirstDerivativeX, lastColScaledFirstDerivativeX), _mm512_sub_ps(scaledFirstDerivativeY, lastRowScaledFirstDerivativeY)));
+
+  lastScaledFirstDerivativeX = scaledFirstDerivativeX;
+  _mm512_store_ps(cacheptr, scaledFirstDerivativeY);
+
+  cacheptr += 16;
+
+  return eulerStep;
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool lookup>
+ALWAYSINLINE void PeronaMalik::diffusionAVX512(__m512i firstDerivativeXi, __m512i firstDerivativeYi, __m512i& res, __m512 kappaSqrVec, __m512 dtVec, __m512& lastScaledFirstDerivativeX, float*& cacheptr, const float* table)
+{
+  if(lookup)
+  {
+    __m512 scaledFirstDerivativeX, scaledFirstDerivativeY;
+    if(isotropic)
+    {
+      __m512i sqrNormXY = _mm512_add_epi32(_mm512_mullo_epi32(firstDerivativeXi, firstDerivativeXi), _mm512_mullo_epi32(firstDerivativeYi, firstDerivativeYi));
+      __m512 g = _mm512_i32gather_ps(sqrNormXY, table, 4);
+      scaledFirstDerivativeX = _mm512_mul_ps(_mm512_cvtepi32_ps(firstDerivativeXi), g);
+      scaledFirstDerivativeY = _mm512_mul_ps(_mm512_cvtepi32_ps(firstDerivativeYi), g);
+    }
+    else
+    {
+      scaledFirstDerivativeX = _mm512_i32gather_ps(firstDerivativeXi, table, 4);
+      scaledFirstDerivativeY = _mm512_i32gather_ps(firstDerivativeYi, table, 4);
+    }
+    res = _mm512_cvttps_epi32(eulerStepAVX512(scaledFirstDerivativeX, scaledFirstDerivativeY, dtVec, lastScaledFirstDerivativeX, cacheptr));
+  }
+  else
+    res = _mm512_cvttps_epi32(eulerStepAVX512<diffusivity, isotropic>(_mm512_cvtepi32_ps(firstDerivativeXi), _mm512_cvtepi32_ps(firstDerivativeYi), kappaSqrVec, dtVec, lastScaledFirstDerivativeX, cacheptr));
+}
+
+ALWAYSINLINE __m512i PeronaMalik::fixedPointStepAVX512(__m512i row, __m512i rowx, __m512i rowy, const __m512i (&tables)[3], __m512i roundingBias, __m128i shift, __m512i& lastFluxX, std::int16_t*& cacheptr)
+{
+  const __m512i fluxX = fixedPointFluxAVX512(_mm512_sub_epi16(rowx, row), tables);
+  const __m512i fluxY = fixedPointFluxAVX512(_mm512_sub_epi16(rowy, row), tables);
+  // The first word is the last one of the previous vector, the others are shifted by one word.
+  const __m512i lastColFluxX = _mm512_permutex2var_epi16(lastFluxX, _mm512_add_epi16(_mm512_set1_epi16(31), _mm512_setr_epi64(0x0003000200010000, 0x0007000600050004, 0x000b000a00090008, 0x000f000e000d000c, 0x0013001200110010, 0x0017001600150014, 0x001b001a00190018, 0x001f001e001d001c)), fluxX);
+  const __m512i lastRowFluxY = _mm512_load_si512(cacheptr);
+  lastFluxX = fluxX;
+  _mm512_store_si512(cacheptr, fluxY);
+  cacheptr += 32;
+
+  __m512i sum = _mm512_add_epi16(_mm512_sub_epi16(fluxX, lastColFluxX), _mm512_sub_epi16(fluxY, lastRowFluxY));
+  // The step is rounded toward zero like in the single precision path.
+  sum = _mm512_add_epi16(sum, _mm512_and_si512(_mm512_srai_epi16(sum, 15), roundingBias));
+  return _mm512_add_epi16(row, _mm512_sra_epi16(sum, shift));
+}
+#endif
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512, bool streaming, bool lookup>
+unsigned int PeronaMalik::diffuseRow(const std::uint8_t* srcRow, const std::uint8_t* nextRow, std::uint8_t* dstRow, unsigned int width, float* cache, float kappaSqr, float dt, const float* table)
+{
+  unsigned int changes = 0;
+  if(simd)
+  {
+#ifdef HAS_SSE4
+    float* cacheptr = cache;
+    if(avx512)
+    {
+#ifdef HAS_AVX512
+      const __m512 kappaSqrVecAVX512 = _mm512_set1_ps(kappaSqr);
+      const __m512 dtVecAVX512 = _mm512_set1_ps(dt);
+      // Gathers the dwords of the four packed groups back into the order of the pixels.
+      const __m512i order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+
+      __m512 lastScaledFirstDerivativeX = _mm512_setzero_ps();
+      for(unsigned int x = 0; x < width; x += 64)
+      {
+        // The pixels are processed in groups of 16 which are zero extended to 32-bit integers directly.
+        __m512i steps[4], rows[4];
+        for(unsigned int i = 0; i < 4; i++)
+        {
+          const __m512i row = _mm512_cvtepu8_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(srcRow + x + 16 * i)));
+          const __m512i rowx = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(srcRow + x + 16 * i + 1)));
+          const __m512i rowy = _mm512_cvtepu8_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(nextRow + x + 16 * i)));
+          diffusionAVX512<diffusivity, isotropic, lookup>(_mm512_sub_epi32(rowx, row), _mm512_sub_epi32(rowy, row), steps[i], kappaSqrVecAVX512, dtVecAVX512, lastScaledFirstDerivativeX, cacheptr, table);
+          rows[i] = row;
+        }
+
+        // The steps are saturated to 16 bits before they are added to the pixels, like in the other paths.
+        __m512i lo = _mm512_add_epi16(_mm512_packs_epi32(steps[0], steps[1]), _mm512_packs_epi32(rows[0], rows[1]));
+        __m512i hi = _mm512_add_epi16(_mm512_packs_epi32(steps[2], steps[3]), _mm512_packs_epi32(rows[2], rows[3]));
+        __m512i result = _mm512_permutexvar_epi32(order, _mm512_packus_epi16(lo, hi));
+        const __mmask64 valid = x + 64 > width ? _bzhi_u64(~0ull, width - x) : ~0ull;
+        changes += static_cast<unsigned int>(_mm_popcnt_u64(_mm512_mask_cmpneq_epu8_mask(valid, _mm512_load_si512(srcRow + x), result)));
+        if(x + 64 > width)
+          _mm512_mask_storeu_epi8(dstRow + x, valid, result);
+        else if(streaming)
+          _mm512_stream_si512(reinterpret_cast<__m512i*>(dstRow + x), result);
+        else
+          _mm512_store_si512(dstRow + x, result);
+      }
+#endif
+    }
+    else if(avx)
+    {
+#ifdef HAS_AVX2
+      const __m256 kappaSqrVecAVX = _mm256_set1_ps(kappaSqr);
+      const __m256 dtVecAVX = _mm256_set1_ps(dt);
+      const __m256i* nextRowVec = reinterpret_cast<const __m256i*>(nextRow);
+      __m256i* dstRowVec = reinterpret_cast<__m256i*>(dstRow);
+
+      __m256 lastScaledFirstDerivativeX = _mm256_setzero_ps();
+      // The last vector may exceed the width, which only affects the padding (and the halo) of the result.
+      for(unsigned int x = 0; x < width; x += 32)
+      {
+        __m256i row = _mm256_load_si256(reinterpret_cast<const __m256i*>(srcRow + x));
+        __m256i rowy = _mm256_load_si256(nextRowVec++);
+        __m256i rowx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcRow + x + 1));
+
+        __m256i row16a = _mm256_unpacklo_epi8(row, _mm256_setzero_si256());
+        __m256i row16b = _mm256_unpackhi_epi8(row, _mm256_setzero_si256());
+        __m256i rowx16a = _mm256_unpacklo_epi8(rowx, _mm256_setzero_si256());
+        __m256i rowx16b = _mm256_unpackhi_epi8(rowx, _mm256_setzero_si256());
+        __m256i firstDerivativeXa = _mm256_sub_epi16(rowx16a, row16a);
+        __m256i firstDerivativeXb = _mm256_sub_epi16(rowx16b, row16b);
+        __m256i rowy16a = _mm256_unpacklo_epi8(rowy, _mm256_setzero_si256());
+        __m256i rowy16b = _mm256_unpackhi_epi8(rowy, _mm256_setzero_si256());
+        __m256i firstDerivativeYa = _mm256_sub_epi16(rowy16a, row16a);
+        __m256i firstDerivativeYb = _mm256_sub_epi16(rowy16b, row16b);
+
+        __m256i lo, hi, tmp;
+
+        diffusionAVX<diffusivity, isotropic, lookup>(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeXa, 0)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeYa, 0)), lo, kappaSqrVecAVX, dtVecAVX, lastScaledFirstDerivativeX, cacheptr, table);
+        diffusionAVX<diffusivity, isotropic, lookup>(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeXb, 0)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeYb, 0)), hi, kappaSqrVecAVX, dtVecAVX, lastScaledFirstDerivativeX, cacheptr, table);
+        diffusionAVX<diffusivity, isotropic, lookup>(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeXa, 1)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeYa, 1)), tmp, kappaSqrVecAVX, dtVecAVX, lastScaledFirstDerivativeX, cacheptr, table);
+        lo = _mm256_packs_epi32(_mm256_permute2x128_si256(lo, tmp, (2 << 4) | 0), _mm256_permute2x128_si256(lo, tmp, (3 << 4) | 1));
+        diffusionAVX<diffusivity, isotropic, lookup>(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeXb, 1)), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(firstDerivativeYb, 1)), tmp, kappaSqrVecAVX, dtVecAVX, lastScaledFirstDerivativeX, cacheptr, table);
+        hi = _mm256_packs_epi32(_mm256_permute2x128_si256(hi, tmp, (2 << 4) | 0), _mm256_permute2x128_si256(hi, tmp, (3 << 4) | 1));
+
+        lo = _mm256_add_epi16(lo, row16a);
+        hi = _mm256_add_epi16(hi, row16b);
+        __m256i result = _mm256_packus_epi16(lo, hi);
+        changes += countChangesAVX(row, result, width - x);
+        if(streaming)
+          _mm256_stream_si256(dstRowVec++, result);
+        else
+          _mm256_store_si256(dstRowVec++, result);
+      }
+#endif
+    }
+    else
+    {
+      const __m128 kappaSqrVecSSE = _mm_set1_ps(kappaSqr);
+      const __m128 dtVecSSE = _mm_set1_ps(dt);
+      const __m128i* nextRowVec = reinterpret_cast<const __m128i*>(nextRow);
+      __m128i* dstRowVec = reinterpret_cast<__m128i*>(dstRow);
+
+      __m128 lastScaledFirstDerivativeX = _mm_setzero_ps();
+      // The last vector may exceed the width, which only affects the padding (and the halo) of the result.
+      for(unsigned int x = 0; x < width; x += 16)
+      {
+        __m128i row = _mm_load_si128(reinterpret_cast<const __m128i*>(srcRow + x));
+        __m128i rowy = _mm_load_si128(nextRowVec++);
+        __m128i rowx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcRow + x + 1));
+
+        __m128i row16a = _mm_unpacklo_epi8(row, _mm_setzero_si128());
+        __m128i row16b = _mm_unpackhi_epi8(row, _mm_setzero_si128());
+        __m128i rowx16a = _mm_unpacklo_epi8(rowx, _mm_setzero_si128());
+        __m128i rowx16b = _mm_unpackhi_epi8(rowx, _mm_setzero_si128());
+        __m128i firstDerivativeXa = _mm_sub_epi16(rowx16a, row16a);
+        __m128i firstDerivativeXb = _mm_sub_epi16(rowx16b, row16b);
+        __m128i rowy16a = _mm_unpacklo_epi8(rowy, _mm_setzero_si128());
+        __m128i rowy16b = _mm_unpackhi_epi8(rowy, _mm_setzero_si128());
+        __m128i firstDerivativeYa = _mm_sub_epi16(rowy16a, row16a);
+        __m128i firstDerivativeYb = _mm_sub_epi16(rowy16b, row16b);
+
+        __m128i lo, hi, tmp;
+
+        diffusionSSE<diffusivity, isotropic, lookup>(_mm_cvtepi16_epi32(firstDerivativeXa), _mm_cvtepi16_epi32(firstDerivativeYa), lo, kappaSqrVecSSE, dtVecSSE, lastScaledFirstDerivativeX, cacheptr, table);
+        diffusionSSE<diffusivity, isotropic, lookup>(_mm_cvtepi16_epi32(_mm_srli_si128(firstDerivativeXa, 8)), _mm_cvtepi16_epi32(_mm_srli_si128(firstDerivativeYa, 8)), hi, kappaSqrVecSSE, dtVecSSE, lastScaledFirstDerivativeX, cacheptr, table);
+        lo = _mm_packs_epi32(lo, hi);
+
+        diffusionSSE<diffusivity, isotropic, lookup>(_mm_cvtepi16_epi32(firstDerivativeXb), _mm_cvtepi16_epi32(firstDerivativeYb), hi, kappaSqrVecSSE, dtVecSSE, lastScaledFirstDerivativeX, cacheptr, table);
+        diffusionSSE<diffusivity, isotropic, lookup>(_mm_cvtepi16_epi32(_mm_srli_si128(firstDerivativeXb, 8)), _mm_cvtepi16_epi32(_mm_srli_si128(firstDerivativeYb, 8)), tmp, kappaSqrVecSSE, dtVecSSE, lastScaledFirstDerivativeX, cacheptr, table);
+        hi = _mm_packs_epi32(hi, tmp);
+
+        lo = _mm_add_epi16(lo, row16a);
+        hi = _mm_add_epi16(hi, row16b);
+        __m128i result = _mm_packus_epi16(lo, hi);
+        changes += countChangesSSE(row, result, width - x);
+        if(streaming)
+          _mm_stream_si128(dstRowVec++, result);
+        else
+          _mm_store_si128(dstRowVec++, result);
+      }
+    }
+#endif
+  }
+  else
+  {
+    float lastScaledFirstDerivativeX = 0.f;
+    for(unsigned int x = 0; x < width; x++)
+    {
+      float firstDerivativeX = static_cast<float>(srcRow[x + 1] - srcRow[x]);
+      float firstDerivativeY = static_cast<float>(nextRow[x] - srcRow[x]);
+
+      float eulerStep = diffusion<diffusivity, isotropic, lookup>(firstDerivativeX, firstDerivativeY, kappaSqr, dt, lastScaledFirstDerivativeX, cache[x], table);
+      std::int32_t offset = static_cast<std::int32_t>(eulerStep);
+
+      if(offset < std::numeric_limits<std::int16_t>::min())
+        offset = std::numeric_limits<std::int16_t>::min();
+      else if(offset > std::numeric_limits<std::int16_t>::max())
+        offset = std::numeric_limits<std::int16_t>::max();
+
+      std::int16_t newVal = static_cast<std::int16_t>(srcRow[x]) + static_cast<std::int16_t>(offset);
+      if(newVal < 0)
+        newVal = 0;
+      else if(newVal > 255)
+        newVal = 255;
+      dstRow[x] = static_cast<std::uint8_t>(newVal);
+      changes += dstRow[x] != srcRow[x];
+    }
+  }
+  return changes;
+}
+
+template<bool simd, bool avx, bool avx512, bool streaming>
+unsigned int PeronaMalik::diffuseRowFixed(const std::uint8_t* srcRow, const std::uint8_t* nextRow, std::uint8_t* dstRow, unsigned int width, std::int16_t* cache, const FixedPointFlux& flux)
+{
+  unsigned int changes = 0;
+  if(simd)
+  {
+#ifdef HAS_SSE4
+    // Splits a table into its low and high bytes for the shuffles.
+    const std::int16_t* entries[3] = {flux.base, flux.linear, flux.quadratic};
+    __m128i tables[6];
+    for(unsigned int i = 0; i < 3; i++)
+    {
+      const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(entries[i]));
+      const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(entries[i] + 8));
+      tables[2 * i] = _mm_packus_epi16(_mm_and_si128(first, _mm_set1_epi16(0xff)), _mm_and_si128(second, _mm_set1_epi16(0xff)));
+      tables[2 * i + 1] = _mm_packus_epi16(_mm_srli_epi16(first, 8), _mm_srli_epi16(second, 8));
+    }
+    const __m128i shift = _mm_cvtsi32_si128(flux.shift);
+    std::int16_t* cacheptr = cache;
+
+    if(avx512)
+    {
+#ifdef HAS_AVX512
+      // The tables have 16 entries, so they are loaded into the lower halves of the vectors.
+      const __m512i tablesAVX512[3] =
+      {
+        _mm512_maskz_loadu_epi16(0xffff, flux.base),
+        _mm512_maskz_loadu_epi16(0xffff, flux.linear),
+        _mm512_maskz_loadu_epi16(0xffff, flux.quadratic)
+      };
+      const __m512i roundingBias = _mm512_set1_epi16(static_cast<short>((1 << flux.shift) - 1));
+      // Restores the order of the quadwords after packing the two halves lane by lane.
+      const __m512i order = _mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7);
+
+      __m512i lastFluxX = _mm512_setzero_si512();
+
+      for(unsigned int x = 0; x < width; x += 64)
+      {
+        __m512i lo = fixedPointStepAVX512(_mm512_cvtepu8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(srcRow + x))), _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcRow + x + 1))), _mm512_cvtepu8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(nextRow + x))), tablesAVX512, roundingBias, shift, lastFluxX, cacheptr);
+        __m512i hi = fixedPointStepAVX512(_mm512_cvtepu8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(srcRow + x + 32))), _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcRow + x + 33))), _mm512_cvtepu8_epi16(_mm256_load_si256(reinterpret_cast<const __m256i*>(nextRow + x + 32))), tablesAVX512, roundingBias, shift, lastFluxX, cacheptr);
+        __m512i result = _mm512_permutexvar_epi64(order, _mm512_packus_epi16(lo, hi));
+        const __mmask64 valid = x + 64 > width ? _bzhi_u64(~0ull, width - x) : ~0ull;
+        changes += static_cast<unsigned int>(_mm_popcnt_u64(_mm512_mask_cmpneq_epu8_mask(valid, _mm512_load_si512(srcRow + x), result)));
+        if(x + 64 > width)
+          _mm512_mask_storeu_epi8(dstRow + x, valid, result);
+        else if(streaming)
+          _mm512_stream_si512(reinterpret_cast<__m512i*>(dstRow + x), result);
+        else
+          _mm512_store_si512(dstRow + x, result);
+      }
+#endif
+    }
+    else if(avx)
+    {
+#ifdef HAS_AVX2
+      __m256i tablesAVX[6];
+      for(unsigned int i = 0; i < 6; i++)
+        tablesAVX[i] = _mm256_broadcastsi128_si256(tables[i]);
+      const __m256i roundingBias = _mm256_set1_epi16(static_cast<short>((1 << flux.shift) - 1));
+      __m256i* dstRowVec = reinterpret_cast<__m256i*>(dstRow);
+
+      __m256i lastFluxX = _mm256_setzero_si256();
+
+      // The last vector may exceed the width, which only affects the padding (and the halo) of the result.
+      for(unsigned int x = 0; x < width; x += 32)
+      {
+        __m256i row = _mm256_load_si256(reinterpret_cast<const __m256i*>(srcRow + x));
+        __m256i rowx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcRow + x + 1));
+        __m256i rowy = _mm256_load_si256(reinterpret_cast<const __m256i*>(nextRow + x));
+
+        __m256i lo = fixedPointStepAVX(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(row)), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(rowx)), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(rowy)), tablesAVX, roundingBias, shift, lastFluxX, cacheptr);
+        __m256i hi = fixedPointStepAVX(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(row, 1)), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(rowx, 1)), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(rowy, 1)), tablesAVX, roundingBias, shift, lastFluxX, cacheptr);
+        __m256i result = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), (3 << 6) | (1 << 4) | (2 << 2) | 0);
+        changes += countChangesAVX(row, result, width - x);
+        if(streaming)
+          _mm256_stream_si256(dstRowVec++, result);
+        else
+          _mm256_store_si256(dstRowVec++, result);
+      }
+#endif
+    }
+    else
+    {
+      const __m128i roundingBias = _mm_set1_epi16(static_cast<short>((1 << flux.shift) - 1));
+      __m128i* dstRowVec = reinterpret_cast<__m128i*>(dstRow);
+
+      __m128i lastFluxX = _mm_setzero_si128();
+
+      // The last vector may exceed the width, which only affects the padding (and the halo) of the result.
+      for(unsigned int x = 0; x < width; x += 16)
+      {
+        __m128i row = _mm_load_si128(reinterpret_cast<const __m128i*>(srcRow + x));
+        __m128i rowx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcRow + x + 1));
+        __m128i rowy = _mm_load_si128(reinterpret_cast<const __m128i*>(nextRow + x));
+
+        __m128i lo = fixedPointStepSSE(_mm_cvtepu8_epi16(row), _mm_cvtepu8_epi16(rowx), _mm_cvtepu8_epi16(rowy), tables, roundingBias, shift, lastFluxX, cacheptr);
+        __m128i hi = fixedPointStepSSE(_mm_cvtepu8_epi16(_mm_srli_si128(row, 8)), _mm_cvtepu8_epi16(_mm_srli_si128(rowx, 8)), _mm_cvtepu8_epi16(_mm_srli_si128(rowy, 8)), tables, roundingBias, shift, lastFluxX, cacheptr);
+        __m128i result = _mm_packus_epi16(lo, hi);
+        changes += countChangesSSE(row, result, width - x);
+        if(streaming)
+          _mm_stream_si128(dstRowVec++, result);
+        else
+          _mm_store_si128(dstRowVec++, result);
+      }
+    }
+#endif
+  }
+  else
+  {
+    int lastFluxX = 0;
+    for(unsigned int x = 0; x < width; x++)
+    {
+      const int fluxX = fixedPointFlux(srcRow[x + 1] - srcRow[x], flux);
+      const int fluxY = fixedPointFlux(nextRow[x] - srcRow[x], flux);
+      const int sum = (fluxX - lastFluxX) + (fluxY - cache[x]);
+      lastFluxX = fluxX;
+      cache[x] = static_cast<std::int16_t>(fluxY);
+
+      const int newVal = srcRow[x] + sum / (1 << flux.shift);
+      dstRow[x] = static_cast<std::uint8_t>(std::min(std::max(newVal, 0), 255));
+      changes += dstRow[x] != srcRow[x];
+    }
+  }
+  return changes;
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512, typename Pixel>
+void PeronaMalik::diffuseRowWide(const Pixel* srcRow, const Pixel* nextRow, Pixel* dstRow, unsigned int width, float* cache, float kappaSqr, float dt)
+{
+  unsigned int x = 0;
+  if(simd)
+  {
+#ifdef HAS_SSE4
+    float* cacheptr = cache;
+    // The vectors of the last block may exceed the width, which only affects the padding.
+    if(avx512)
+    {
+#ifdef HAS_AVX512
+      const __m512 kappaSqrVec = _mm512_set1_ps(kappaSqr);
+      const __m512 dtVec = _mm512_set1_ps(dt);
+      __m512 lastScaledFirstDerivativeX = _mm512_setzero_ps();
+      for(; x < width; x += 16)
+      {
+        __m512 row = PixelTraits<Pixel>::loadAVX512(srcRow + x);
+        __m512 firstDerivativeX = _mm512_sub_ps(PixelTraits<Pixel>::loadAVX512(srcRow + x + 1), row);
+        __m512 firstDerivativeY = _mm512_sub_ps(PixelTraits<Pixel>::loadAVX512(nextRow + x), row);
+        PixelTraits<Pixel>::storeAVX512(dstRow + x, _mm512_add_ps(row, eulerStepAVX512<diffusivity, isotropic>(firstDerivativeX, firstDerivativeY, kappaSqrVec, dtVec, lastScaledFirstDerivativeX, cacheptr)));
+      }
+#endif
+    }
+    else if(avx)
+    {
+#ifdef HAS_AVX2
+      const __m256 kappaSqrVec = _mm256_set1_ps(kappaSqr);
+      const __m256 dtVec = _mm256_set1_ps(dt);
+      __m256 lastScaledFirstDerivativeX = _mm256_setzero_ps();
+      for(; x < width; x += 8)
+      {
+        __m256 row = PixelTraits<Pixel>::loadAVX(srcRow + x);
+        __m256 firstDerivativeX = _mm256_sub_ps(PixelTraits<Pixel>::loadAVX(srcRow + x + 1), row);
+        __m256 firstDerivativeY = _mm256_sub_ps(PixelTraits<Pixel>::loadAVX(nextRow + x), row);
+        PixelTraits<Pixel>::storeAVX(dstRow + x, _mm256_add_ps(row, eulerStepAVX<diffusivity, isotropic>(firstDerivativeX, firstDerivativeY, kappaSqrVec, dtVec, lastScaledFirstDerivativeX, cacheptr)));
+      }
+#endif
+    }
+    else
+    {
+      const __m128 kappaSqrVec = _mm_set1_ps(kappaSqr);
+      const __m128 dtVec = _mm_set1_ps(dt);
+      __m128 lastScaledFirstDerivativeX = _mm_setzero_ps();
+      for(; x < width; x += 4)
+      {
+        __m128 row = PixelTraits<Pixel>::loadSSE(srcRow + x);
+        __m128 firstDerivativeX = _mm_sub_ps(PixelTraits<Pixel>::loadSSE(srcRow + x + 1), row);
+        __m128 firstDerivativeY = _mm_sub_ps(PixelTraits<Pixel>::loadSSE(nextRow + x), row);
+        PixelTraits<Pixel>::storeSSE(dstRow + x, _mm_add_ps(row, eulerStepSSE<diffusivity, isotropic>(firstDerivativeX, firstDerivativeY, kappaSqrVec, dtVec, lastScaledFirstDerivativeX, cacheptr)));
+      }
+    }
+#endif
+  }
+  else
+  {
+    float lastScaledFirstDerivativeX = 0.f;
+    for(; x < width; x++)
+    {
+      float row = PixelTraits<Pixel>::load(srcRow + x);
+      float firstDerivativeX = PixelTraits<Pixel>::load(srcRow + x + 1) - row;
+      float firstDerivativeY = PixelTraits<Pixel>::load(nextRow + x) - row;
+      PixelTraits<Pixel>::store(dstRow + x, row + diffusion<diffusivity, isotropic>(firstDerivativeX, firstDerivativeY, kappaSqr, dt, lastScaledFirstDerivativeX, cache[x]));
+    }
+  }
+}
+
+template<DiffusivityFunction diffusivity, bool isotropic, bool simd, bool avx, bool avx512>
+void PeronaMalik::diffusivityRow(const float* row, const float* nextRow, float* diffusivityX, float* diffusivityY, unsigned int width, float kappaSqr)
+{
+  unsigned int x = 0;
+  if(simd)
+  {
+#ifdef HAS_SSE4
+    // The last vector may exceed the width, which only affects the padding.
+    if(avx512)
+    {
+#ifdef HAS_AVX512
+      const __m512 kappaSqrVec = _mm512_set1_ps(kappaSqr);
+      for(; x < width; x += 16)
+      {
+        const __m512 pixels = _mm512_load_ps(row + x);
+        const __m512 firstDerivativeX = _mm512_sub_ps(_mm512_loadu_ps(row + x + 1), pixels);
+        const __m512 firstDerivativeY = _mm512_sub_ps(_mm512_load_ps(nextRow + x), pixels);
+        if(isotropic)
+          _mm512_store_ps(diffusivityX + x, DiffusivityTraits<diffusivity>::computeAVX512(_mm512_add_ps(_mm512_mul_ps(firstDerivativeX, firstDerivativeX), _mm512_mul_ps(firstDerivativeY, firstDerivativeY)), kappaSqrVec));
+        else
+        {
+          _mm512_store_ps(diffusivityX + x, DiffusivityTraits<diffusivity>::computeAVX512(_mm512_mul_ps(firstDerivativeX, firstDerivativeX), kappaSqrVec));
+          _mm512_store_ps(diffusivityY + x, DiffusivityTraits<diffusivity>::computeAVX512(_mm512_mul_ps(firstDerivativeY, firstDerivativeY), kappaSqrVec));
+        }
+      }
+#endif
+    }
+    else if(avx)
+    {
+#ifdef HAS_AVX2
+      const __m256 kappaSqrVec = _mm256_set1_ps(kappaSqr);
+      for(; x < width; x += 8)
+      {
+        const __m256 pixels = _mm256_load_ps(row + x);
+        const __m256 firstDerivativeX = _mm256_sub_ps(_mm256_loadu_ps(row + x + 1), pixels);
+        const __m256 firstDerivativeY = _mm256_sub_ps(_mm256_load_ps(nextRow + x), pixels);
+        if(isotropic)
+          _mm256_store_ps(diffusivityX + x, DiffusivityTraits<diffusivity>::computeAVX(_mm256_add_ps(_mm256_mul_ps(firstDerivativeX, firstDerivativeX), _mm256_mul_ps(firstDerivativeY, firstDerivativeY)), kappaSqrVec));
+        else
+        {
+          _mm256_store_ps(diffusivityX + x, DiffusivityTraits<diffusivity>::computeAVX(_mm256_mul_ps(firstDerivativeX, firstDerivativeX), kappaSqrVec));
+          _mm256_store_ps(diffusivityY + x, DiffusivityTraits<diffusivity>::computeAVX(_mm256_mul_ps(firstDerivativeY, firstDerivativeY), kappaSqrVec));
+        }
+      }
+#endif
+    }
+    else
+    {
+      const __m128 kappaSqrVec = _mm_set1_ps(kappaSqr);
+      for(; x < width; x += 4)
+      {
+        const __m128 pixels = _mm_load_ps(row + x);
+        const __m128 firstDerivativeX = _mm_sub_ps(_mm_loadu_ps(row + x + 1), pixels);
+        const __m128 firstDerivativeY = _mm_sub_ps(_mm_load_ps(nextRow + x), pixels);
+        if(isotropic)
+          _mm_store_ps(diffusivityX + x, DiffusivityTraits<diffusivity>::computeSSE(_mm_add_ps(_mm_mul_ps(firstDerivativeX, firstDerivativeX), _mm_mul_ps(firstDerivativeY, firstDerivativeY)), kappaSqrVec));
+        else
+        {
+          _mm_store_ps(diffusivityX + x, DiffusivityTraits<diffusivity>::computeSSE(_mm_mul_ps(firstDerivativeX, firstDerivativeX), kappaSqrVec));
+          _mm_store_ps(diffusivityY + x, DiffusivityTraits<diffusivity>::computeSSE(_mm_mul_ps(firstDerivativeY, firstDerivativeY), kappaSqrVec));
+        }
+      }
+    }
+#endif
+  }
+  else
+  {
+    for(; x < width; x++)
+    {
+      const float firstDerivativeX = row[x + 1] - row[x];
+      const float firstDerivativeY = nextRow[x] - row[x];
+      if(isotropic)
+        diffusivityX[x] = DiffusivityTraits<diffusivity>::compute(firstDerivativeX * firstDerivativeX + firstDerivativeY * firstDerivativeY, kappaSqr);
+      else
+      {
+        diffusivityX[x] = DiffusivityTraits<diffusivity>::compute(firstDerivativeX * firstDerivativeX, kappaSqr);
+        diffusivityY[x] = DiffusivityTraits<diffusivity>::compute(firstDerivativeY * firstDerivativeY, kappaSqr);
+      }
+    }
+  }
+}
+
+template<bool simd, bool avx, bool avx512>
+void PeronaMalik::solveRows(const float* rhs, const float* diffusivities, float* solution, float* scratch, std::size_t stride, unsigned int width, unsigned int rows, float twoDt)
+{
+  // The system of a row has the diagonal 1 + twoDt * (g[x - 1] + g[x]) and the off-diagonals -twoDt * g. The connection
+  // to the value behind the last pixel moves to the right hand side. The factors are stored without their signs and
+  // the operations are done in the same order in all versions.
+  unsigned int y = 0;
+  if(simd)
+  {
+#ifdef HAS_SSE4
+    if(avx)
+    {
+#ifdef HAS_AVX2
+      // The rows are solved in groups of eight. The scratch memory contains a vector per pixel with the eliminated
+      // upper diagonals and one with the eliminated right hand sides.
+      const __m256 twoDtVec = _mm256_set1_ps(twoDt);
+      __m256* factors = reinterpret_cast<__m256*>(scratch);
+      __m256* values = factors + width;
+      for(; y + 8 <= rows; y += 8)
+      {
+        const float* rhsRows = rhs + y * stride;
+        const float* diffusivityRows = diffusivities + y * stride;
+        float* solutionRows = solution + y * stride;
+        const __m256 boundary = _mm256_setr_ps(rhsRows[width], rhsRows[stride + width], rhsRows[2 * stride + width], rhsRows[3 * stride + width],
+                                               rhsRows[4 * stride + width], rhsRows[5 * stride + width], rhsRows[6 * stride + width], rhsRows[7 * stride + width]);
+
+        __m256 lastFactor = _mm256_setzero_ps(), lastValue = _mm256_setzero_ps(), lastDiffusivity = _mm256_setzero_ps();
+        for(unsigned int x = 0; x < width; x += 8)
+        {
+          __m256 rhsBlock[8], diffusivityBlock[8];
+          for(unsigned int i = 0; i < 8; i++)
+          {
+            rhsBlock[i] = _mm256_load_ps(rhsRows + i * stride + x);
+            diffusivityBlock[i] = _mm256_load_ps(diffusivityRows + i * stride + x);
+          }
+          transposeAVX(rhsBlock);
+          transposeAVX(diffusivityBlock);
+          for(unsigned int i = 0; i < 8 && x + i < width; i++)
+          {
+            const __m256 lower = _mm256_mul_ps(twoDtVec, lastDiffusivity);
+            const __m256 upper = _mm256_mul_ps(twoDtVec, diffusivityBlock[i]);
+            const __m256 diagonal = _mm256_add_ps(_mm256_set1_ps(1.f), _mm256_mul_ps(twoDtVec, _mm256_add_ps(lastDiffusivity, diffusivityBlock[i])));
+            __m256 value = rhsBlock[i];
+            if(x + i == width - 1)
+              value = _mm256_add_ps(value, _mm256_mul_ps(upper, boundary));
+            const __m256 pivot = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sub_ps(diagonal, _mm256_mul_ps(lower, lastFactor)));
+            lastFactor = _mm256_mul_ps(upper, pivot);
+            lastValue = _mm256_mul_ps(_mm256_add_ps(value, _mm256_mul_ps(lower, lastValue)), pivot);
+            lastDiffusivity = diffusivityBlock[i];
+            factors[x + i] = lastFactor;
+            values[x + i] = lastValue;
+          }
+        }
+
+        __m256 nextValue = _mm256_setzero_ps();
+        for(unsigned int x = (width - 1) / 8 * 8 + 8; x > 0;)
+        {
+          x -= 8;
+          __m256 block[8];
+          for(unsigned int i = 8; i > 0; i--)
+          {
+            if(x + i - 1 < width)
+              nextValue = _mm256_add_ps(values[x + i - 1], _mm256_mul_ps(factors[x + i - 1], nextValue));
+            block[i - 1] = nextValue;
+          }
+          transposeAVX(block);
+          for(unsigned int i = 0; i < 8; i++)
+            _mm256_store_ps(solutionRows + i * stride + x, block[i]);
+        }
+      }
+#endif
+    }
+    else
+    {
+      const __m128 twoDtVec = _mm_set1_ps(twoDt);
+      __m128* factors = reinterpret_cast<__m128*>(scratch);
+      __m128* values = factors + width;
+      for(; y + 4 <= rows; y += 4)
+      {
+        const float* rhsRows = rhs + y * stride;
+        const float* diffusivityRows = diffusivities + y * stride;
+        float* solutionRows = solution + y * stride;
+        const __m128 boundary = _mm_setr_ps(rhsRows[width], rhsRows[stride + width], rhsRows[2 * stride + width], rhsRows[3 * stride + width]);
+
+        __m128 lastFactor = _mm_setzero_ps(), lastValue = _mm_setzero_ps(), lastDiffusivity = _mm_setzero_ps();
+        for(unsigned int x = 0; x < width; x += 4)
+        {
+          __m128 rhsBlock[4], diffusivityBlock[4];
+          for(unsigned int i = 0; i < 4; i++)
+          {
+            rhsBlock[i] = _mm_load_ps(rhsRows + i * stride + x);
+            diffusivityBlock[i] = _mm_load_ps(diffusivityRows + i * stride + x);
+          }
+          transposeSSE(rhsBlock);
+          transposeSSE(diffusivityBlock);
+          for(unsigned int i = 0; i < 4 && x + i < width; i++)
+          {
+            const __m128 lower = _mm_mul_ps(twoDtVec, lastDiffusivity);
+            const __m128 upper = _mm_mul_ps(twoDtVec, diffusivityBlock[i]);
+            const __m128 diagonal = _mm_add_ps(_mm_set1_ps(1.f), _mm_mul_ps(twoDtVec, _mm_add_ps(lastDiffusivity, diffusivityBlock[i])));
+            __m128 value = rhsBlock[i];
+            if(x + i == width - 1)
+              value = _mm_add_ps(value, _mm_mul_ps(upper, boundary));
+            const __m128 pivot = _mm_div_ps(_mm_set1_ps(1.f), _mm_sub_ps(diagonal, _mm_mul_ps(lower, lastFactor)));
+            lastFactor = _mm_mul_ps(upper, pivot);
+            lastValue = _mm_mul_ps(_mm_add_ps(value, _mm_mul_ps(lower, lastValue)), pivot);
+            lastDiffusivity = diffusivityBlock[i];
+            factors[x + i] = lastFactor;
+            values[x + i] = lastValue;
+          }
+        }
+
+        __m128 nextValue = _mm_setzero_ps();
+        for(unsigned int x = (width - 1) / 4 * 4 + 4; x > 0;)
+        {
+          x -= 4;
+          __m128 block[4];
+          for(unsigned int i = 4; i > 0; i--)
+          {
+            if(x + i - 1 < width)
+              nextValue = _mm_add_ps(values[x + i - 1], _mm_mul_ps(factors[x + i - 1], nextValue));
+            block[i - 1] = nextValue;
+          }
+          transposeSSE(block);
+          for(unsigned int i = 0; i < 4; i++)
+            _mm_store_ps(solutionRows + i * stride + x, block[i]);
+        }
+      }
+    }
+#endif
+  }
+
+  // The remaining rows are solved one by one.
+  for(; y < rows; y++)
+  {
+    const float* rhsRow = rhs + y * stride;
+    const float* diffusivityRow = diffusivities + y * stride;
+    float* solutionRow = solution + y * stride;
+    float* factors = scratch;
+
+    float lastFactor = 0.f, lastValue = 0.f, lastDiffusivity = 0.f;
+    for(unsigned int x = 0; x < width; x++)
+    {
+      const float lower = twoDt * lastDiffusivity;
+      const float upper = twoDt * diffusivityRow[x];
+      const float diagonal = 1.f + twoDt * (lastDiffusivity + diffusivityRow[x]);
+      float value = rhsRow[x];
+      if(x == width - 1)
+        value = value + upper * rhsRow[width];
+      const float pivot = 1.f / (diagonal - lower * lastFactor);
+      lastFactor = upper * pivot;
+      lastValue = (value + lower * lastValue) * pivot;
+      lastDiffusivity = diffusivityRow[x];
+      factors[x] = lastFactor;
+      solutionRow[x] = lastValue;
+    }
+
+    float nextValue = 0.f;
+    for(unsigned int x = width; x > 0; x--)
+      solutionRow[x - 1] = nextValue = solutionRow[x - 1] + factors[x - 1] * nextValue;
+  }
+}
+
+template<bool simd, bool avx, bool avx512>
+void PeronaMalik::solveColumns(const float* rhs, const float* diffusivities, float* factors, float* solution, const float* rowSolution, float* dst, std::size_t stride, unsigned int width, unsigned int rows, float twoDt)
+{
+  // The elimination runs down all columns at once, so that it reads and writes whole rows. The operations are done in
+  // the same order as in solveRows.
+  for(unsigned int y = 0; y < rows; y++)
+  {
+    const float* rhsRow = rhs + y * stride;
+    const float* diffusivityRow = diffusivities + y * stride;
+    float* factorRow = factors + y * stride;
+    float* valueRow = solution + y * stride;
+    const bool first = y == 0, last = y == rows - 1;
+    // The rows above are only read if there are any.
+    const float* lastDiffusivityRow = first ? diffusivityRow : diffusivityRow - stride;
+    const float* lastFactorRow = first ? factorRow : factorRow - stride;
+    const float* lastValueRow = first ? valueRow : valueRow - stride;
+
+    unsigned int x = 0;
+    if(simd)
+    {
+#ifdef HAS_SSE4
+      // The last vector may exceed the width, which only affects the padding.
+      if(avx512)
+      {
+#ifdef HAS_AVX512
+        const __m512 twoDtVec = _mm512_set1_ps(twoDt);
+        for(; x < width; x += 16)
+        {
+          const __m512 diffusivity = _mm512_load_ps(diffusivityRow + x);
+          const __m512 lastDiffusivity = first ? _mm512_setzero_ps() : _mm512_load_ps(lastDiffusivityRow + x);
+          const __m512 lastFactor = first ? _mm512_setzero_ps() : _mm512_load_ps(lastFactorRow + x);
+          const __m512 lastValue = first ? _mm512_setzero_ps() : _mm512_load_ps(lastValueRow + x);
+          const __m512 lower = _mm512_mul_ps(twoDtVec, lastDiffusivity);
+          const __m512 upper = _mm512_mul_ps(twoDtVec, diffusivity);
+          const __m512 diagonal = _mm512_add_ps(_mm512_set1_ps(1.f), _mm512_mul_ps(twoDtVec, _mm512_add_ps(lastDiffusivity, diffusivity)));
+          __m512 value = _mm512_load_ps(rhsRow + x);
+          if(last)
+            value = _mm512_add_ps(value, _mm512_mul_ps(upper, _mm512_load_ps(rhsRow + stride + x)));
+          const __m512 pivot = _mm512_div_ps(_mm512_set1_ps(1.f), _mm512_sub_ps(diagonal, _mm512_mul_ps(lower, lastFactor)));
+          _mm512_store_ps(factorRow + x, _mm512_mul_ps(upper, pivot));
+          _mm512_store_ps(valueRow + x, _mm512_mul_ps(_mm512_add_ps(value, _mm512_mul_ps(lower, lastValue)), pivot));
+        }
+#endif
+      }
+      else if(avx)
+      {
+#ifdef HAS_AVX2
+        const __m256 twoDtVec = _mm256_set1_ps(twoDt);
+        for(; x < width; x += 8)
+        {
+          const __m256 diffusivity = _mm256_load_ps(diffusivityRow + x);
+          const __m256 lastDiffusivity = first ? _mm256_setzero_ps() : _mm256_load_ps(lastDiffusivityRow + x);
+          const __m256 lastFactor = first ? _mm256_setzero_ps() : _mm256_load_ps(lastFactorRow + x);
+          const __m256 lastValue = first ? _mm256_setzero_ps() : _mm256_load_ps(lastValueRow + x);
+          const __m256 lower = _mm256_mul_ps(twoDtVec, lastDiffusivity);
+          const __m256 upper = _mm256_mul_ps(twoDtVec, diffusivity);
+          const __m256 diagonal = _mm256_add_ps(_mm256_set1_ps(1.f), _mm256_mul_ps(twoDtVec, _mm256_add_ps(lastDiffusivity, diffusivity)));
+          __m256 value = _mm256_load_ps(rhsRow + x);
+          if(last)
+            value = _mm256_add_ps(value, _mm256_mul_ps(upper, _mm256_load_ps(rhsRow + stride + x)));
+          const __m256 pivot = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sub_ps(diagonal, _mm256_mul_ps(lower, lastFactor)));
+          _mm256_store_ps(factorRow + x, _mm256_mul_ps(upper, pivot));
+          _mm256_store_ps(valueRow + x, _mm256_mul_ps(_mm256_add_ps(value, _mm256_mul_ps(lower, lastValue)), pivot));
+        }
+#endif
+      }
+      else
+      {
+        const __m128 twoDtVec = _mm_set1_ps(twoDt);
+        for(; x < width; x += 4)
+        {
+          const __m128 diffusivity = _mm_load_ps(diffusivityRow + x);
+          const __m128 lastDiffusivity = first ? _mm_setzero_ps() : _mm_load_ps(lastDiffusivityRow + x);
+          const __m128 lastFactor = first ? _mm_setzero_ps() : _mm_load_ps(lastFactorRow + x);
+          const __m128 lastValue = first ? _mm_setzero_ps() : _mm_load_ps(lastValueRow + x);
+          const __m128 lower = _mm_mul_ps(twoDtVec, lastDiffusivity);
+          const __m128 upper = _mm_mul_ps(twoDtVec, diffusivity);
+          const __m128 diagonal = _mm_add_ps(_mm_set1_ps(1.f), _mm_mul_ps(twoDtVec, _mm_add_ps(lastDiffusivity, diffusivity)));
+          __m128 value = _mm_load_ps(rhsRow + x);
+          if(last)
+            value = _mm_add_ps(value, _mm_mul_ps(upper, _mm_load_ps(rhsRow + stride + x)));
+          const __m128 pivot = _mm_div_ps(_mm_set1_ps(1.f), _mm_sub_ps(diagonal, _mm_mul_ps(lower, lastFactor)));
+          _mm_store_ps(factorRow + x, _mm_mul_ps(upper, pivot));
+          _mm_store_ps(valueRow + x, _mm_mul_ps(_mm_add_ps(value, _mm_mul_ps(lower, lastValue)), pivot));
+        }
+      }
+#endif
+    }
+    else
+    {
+      for(; x < width; x++)
+      {
+        const float lastDiffusivity = first ? 0.f : lastDiffusivityRow[x];
+        const float lower = twoDt * lastDiffusivity;
+        const float upper = twoDt * diffusivityRow[x];
+        const float diagonal = 1.f + twoDt * (lastDiffusivity + diffusivityRow[x]);
+        float value = rhsRow[x];
+        if(last)
+          value = value + upper * rhsRow[stride + x];
+        const float pivot = 1.f / (diagonal - lower * (first ? 0.f : lastFactorRow[x]));
+        factorRow[x] = upper * pivot;
+        valueRow[x] = (value + lower * (first ? 0.f : lastValueRow[x])) * pivot;
+      }
+    }
+  }
+
+  // The back substitution runs up all columns and averages the solutions of both directions.
+  for(unsigned int y = rows; y > 0; y--)
+  {
+    const float* factorRow = factors + (y - 1) * stride;
+    const float* nextValueRow = solution + y * stride;
+    const float* rowSolutionRow = rowSolution + (y - 1) * stride;
+    float* valueRow = solution + (y - 1) * stride;
+    float* dstRow = dst + (y - 1) * stride;
+    const bool last = y == rows;
+
+    unsigned int x = 0;
+    if(simd)
+    {
+#ifdef HAS_SSE4
+      if(avx512)
+      {
+#ifdef HAS_AVX512
+        for(; x < width; x += 16)
+        {
+          const __m512 nextValue = last ? _mm512_setzero_ps() : _mm512_load_ps(nextValueRow + x);
+          const __m512 value = _mm512_add_ps(_mm512_load_ps(valueRow + x), _mm512_mul_ps(_mm512_load_ps(factorRow + x), nextValue));
+          _mm512_store_ps(valueRow + x, value);
+          _mm512_store_ps(dstRow + x, _mm512_mul_ps(_mm512_set1_ps(0.5f), _mm512_add_ps(value, _mm512_load_ps(rowSolutionRow + x))));
+        }
+#endif
+      }
+      else if(avx)
+      {
+#ifdef HAS_AVX2
+        for(; x < width; x += 8)
+        {
+          const __m256 nextValue = last ? _mm256_setzero_ps() : _mm256_load_ps(nextValueRow + x);
+          const __m256 value = _mm256_add_ps(_mm256_load_ps(valueRow + x), _mm256_mul_ps(_mm256_load_ps(factorRow + x), nextValue));
+          _mm256_store_ps(valueRow + x, value);
+          _mm256_store_ps(dstRow + x, _mm256_mul_ps(_mm256_set1_ps(0.5f), _mm256_add_ps(value, _mm256_load_ps(rowSolutionRow + x))));
+        }
+#endif
+      }
+      else
+      {
+        for(; x < width; x += 4)
+        {
+          const __m128 nextValue = last ? _mm_setzero_ps() : _mm_load_ps(nextValueRow + x);
+          const __m128 value = _mm_add_ps(_mm_load_ps(valueRow + x), _mm_mul_ps(_mm_load_ps(factorRow + x), nextValue));
+          _mm_store_ps(valueRow + x, value);
+          _mm_store_ps(dstRow + x, _mm_mul_ps(_mm_set1_ps(0.5f), _mm_add_ps(value, _mm_load_ps(rowSolutionRow + x))));
+        }
+      }
+#endif
+    }
+    else
+    {
+      for(; x < width; x++)
+      {
+        const float value = valueRow[x] + factorRow[x] * (last ? 0.f : nextValueRow[x]);
+        valueRow[x] = value;
+        dstRow[x] = 0.5f * (value + rowSolutionRow[x]);
+      }
+    }
+  }
+}
@@ -0,0 +1,250 @@
+/**
+ * @file Pixel.h
+ *
+ * This file declares the pixel types that images can consist of and the conversions between them.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "SIMD.h"
+
+/**
+ * @brief This enum enumerates the pixel types that images can consist of.
+ */
+enum class PixelFormat
+{
+  uint8,            ///< Unsigned 8-bit integers.
+  uint16,           ///< Unsigned 16-bit integers.
+  float32,          ///< Single precision floating point numbers.
+  float16,          ///< Half precision floating point numbers (see Half).
+  numOfPixelFormats ///< The number of pixel formats.
+};
+
+/**
+ * @brief This struct is a half precision (IEEE 754 binary16) floating point number.
+ *
+ * It is only meant for storage, i.e. computations are done after converting to single precision.
+ */
+struct Half
+{
+  /**
+   * @brief Converts a single precision number to half precision (rounding to nearest even like F16C does).
+   * @param value The single precision number.
+   * @return The half precision number.
+   */
+  static ALWAYSINLINE Half fromFloat(float value)
+  {
+    std::uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    const std::uint16_t sign = static_cast<std::uint16_t>((f >> 16) & 0x8000);
+    const std::uint32_t magnitude = f & 0x7fffffff;
+    Half result;
+    if(magnitude >= 0x7f800000)
+      result.bits = sign | (magnitude > 0x7f800000 ? 0x7e00 | ((magnitude >> 13) & 0x3ff) : 0x7c00);
+    else if(magnitude >= 0x477ff000)
+      result.bits = sign | 0x7c00;
+    else if(magnitude < 0x38800000)
+    {
+      // The result is subnormal (or zero), so the implicit bit has to be shifted into the mantissa.
+      const unsigned int shift = 126 - (magnitude >> 23);
+      if(shift > 24)
+        result.bits = sign;
+      else
+      {
+        const std::uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+        const std::uint32_t halfMantissa = mantissa >> shift;
+        const std::uint32_t rest = mantissa & ((1u << shift) - 1);
+        const std::uint32_t halfway = 1u << (shift - 1);
+        result.bits = static_cast<std::uint16_t>(sign | (halfMantissa + (rest > halfway || (rest == halfway && (halfMantissa & 1)))));
+      }
+    }
+    else
+    {
+      const std::uint32_t rebased = magnitude - 0x38000000;
+      result.bits = static_cast<std::uint16_t>(sign | ((rebased + 0xfff + ((rebased >> 13) & 1)) >> 13));
+    }
+    return result;
+  }
+  /**
+   * @brief Converts this number to single precision (which is exact).
+   * @return The single precision number.
+   */
+  ALWAYSINLINE float toFloat() const
+  {
+    const std::uint32_t sign = static_cast<std::uint32_t>(bits & 0x8000) << 16;
+    const std::uint32_t exponent = (bits >> 10) & 0x1f;
+    std::uint32_t mantissa = bits & 0x3ff;
+    std::uint32_t f;
+    if(exponent == 0x1f)
+      f = sign | 0x7f800000 | (mantissa << 13);
+    else if(exponent != 0)
+      f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if(mantissa == 0)
+      f = sign;
+    else
+    {
+      // Subnormal numbers are normalized.
+      std::uint32_t e = 113;
+      while(!(mantissa & 0x400))
+      {
+        mantissa <<= 1;
+        e--;
+      }
+      f = sign | (e << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float value;
+    std::memcpy(&value, &f, sizeof(value));
+    return value;
+  }
+  std::uint16_t bits; ///< The binary representation.
+};
+
+/**
+ * @brief This struct provides loads that convert pixels to single precision and stores that convert them back.
+ *
+ * Conversions to integers round half up and saturate, conversions to Half round to nearest even.
+ * The results of all variants are identical and do not depend on the rounding mode of the MXCSR.
+ * The broadcast and reverse helpers move raw pixels (e.g. into the halo of an image). They only need SSE2, which
+ * every x86-64 CPU has, so they are available in all files.
+ * @tparam Pixel The pixel type.
+ */
+template<typename Pixel>
+struct PixelTraits;
+
+template<>
+struct PixelTraits<std::uint8_t>
+{
+  static constexpr PixelFormat format = PixelFormat::uint8;
+  static ALWAYSINLINE float load(const std::uint8_t* ptr) { return static_cast<float>(*ptr); }
+  static ALWAYSINLINE void store(std::uint8_t* ptr, float value) { *ptr = static_cast<std::uint8_t>(std::floor(std::min(std::max(value, 0.f), 255.f) + 0.5f)); }
+  static ALWAYSINLINE __m128i broadcast(std::uint8_t value) { return _mm_set1_epi8(static_cast<char>(value)); }
+  static ALWAYSINLINE __m128i reverse(__m128i pixels)
+  {
+    pixels = _mm_shufflehi_epi16(_mm_shufflelo_epi16(_mm_shuffle_epi32(pixels, 0x1b), 0xb1), 0xb1);
+    return _mm_or_si128(_mm_slli_epi16(pixels, 8), _mm_srli_epi16(pixels, 8));
+  }
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 loadSSE(const std::uint8_t* ptr)
+  {
+    int bytes;
+    std::memcpy(&bytes, ptr, sizeof(bytes));
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+  }
+  static ALWAYSINLINE void storeSSE(std::uint8_t* ptr, __m128 value)
+  {
+    __m128i i = _mm_cvtps_epi32(_mm_floor_ps(_mm_add_ps(_mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(255.f)), _mm_set1_ps(0.5f))));
+    i = _mm_packus_epi16(_mm_packus_epi32(i, i), _mm_setzero_si128());
+    const int bytes = _mm_cvtsi128_si32(i);
+    std::memcpy(ptr, &bytes, sizeof(bytes));
+  }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 loadAVX(const std::uint8_t* ptr) { return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(ptr)))); }
+  static ALWAYSINLINE void storeAVX(std::uint8_t* ptr, __m256 value)
+  {
+    __m256i i = _mm256_cvtps_epi32(_mm256_floor_ps(_mm256_add_ps(_mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), _mm256_set1_ps(255.f)), _mm256_set1_ps(0.5f))));
+    __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(ptr), _mm_packus_epi16(w, w));
+  }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 loadAVX512(const std::uint8_t* ptr) { return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)))); }
+  static ALWAYSINLINE void storeAVX512(std::uint8_t* ptr, __m512 value)
+  {
+    __m512i i = _mm512_cvtps_epi32(_mm512_floor_ps(_mm512_add_ps(_mm512_min_ps(_mm512_max_ps(value, _mm512_setzero_ps()), _mm512_set1_ps(255.f)), _mm512_set1_ps(0.5f))));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), _mm512_cvtusepi32_epi8(i));
+  }
+#endif
+};
+
+template<>
+struct PixelTraits<std::uint16_t>
+{
+  static constexpr PixelFormat format = PixelFormat::uint16;
+  static ALWAYSINLINE float load(const std::uint16_t* ptr) { return static_cast<float>(*ptr); }
+  static ALWAYSINLINE void store(std::uint16_t* ptr, float value) { *ptr = static_cast<std::uint16_t>(std::floor(std::min(std::max(value, 0.f), 65535.f) + 0.5f)); }
+  static ALWAYSINLINE __m128i broadcast(std::uint16_t value) { return _mm_set1_epi16(static_cast<short>(value)); }
+  static ALWAYSINLINE __m128i reverse(__m128i pixels) { return _mm_shufflehi_epi16(_mm_shufflelo_epi16(_mm_shuffle_epi32(pixels, 0x1b), 0xb1), 0xb1); }
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 loadSSE(const std::uint16_t* ptr) { return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(ptr)))); }
+  static ALWAYSINLINE void storeSSE(std::uint16_t* ptr, __m128 value)
+  {
+    __m128i i = _mm_cvtps_epi32(_mm_floor_ps(_mm_add_ps(_mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), _mm_set1_ps(65535.f)), _mm_set1_ps(0.5f))));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(ptr), _mm_packus_epi32(i, i));
+  }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 loadAVX(const std::uint16_t* ptr) { return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)))); }
+  static ALWAYSINLINE void storeAVX(std::uint16_t* ptr, __m256 value)
+  {
+    __m256i i = _mm256_cvtps_epi32(_mm256_floor_ps(_mm256_add_ps(_mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), _mm256_set1_ps(65535.f)), _mm256_set1_ps(0.5f))));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), _mm_packus_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1)));
+  }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 loadAVX512(const std::uint16_t* ptr) { return _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)))); }
+  static ALWAYSINLINE void storeAVX512(std::uint16_t* ptr, __m512 value)
+  {
+    __m512i i = _mm512_cvtps_epi32(_mm512_floor_ps(_mm512_add_ps(_mm512_min_ps(_mm512_max_ps(value, _mm512_setzero_ps()), _mm512_set1_ps(65535.f)), _mm512_set1_ps(0.5f))));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr), _mm512_cvtusepi32_epi16(i));
+  }
+#endif
+};
+
+template<>
+struct PixelTraits<float>
+{
+  static constexpr PixelFormat format = PixelFormat::float32;
+  static ALWAYSINLINE float load(const float* ptr) { return *ptr; }
+  static ALWAYSINLINE void store(float* ptr, float value) { *ptr = value; }
+  static ALWAYSINLINE __m128i broadcast(float value) { return _mm_castps_si128(_mm_set1_ps(value)); }
+  static ALWAYSINLINE __m128i reverse(__m128i pixels) { return _mm_shuffle_epi32(pixels, 0x1b); }
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 loadSSE(const float* ptr) { return _mm_loadu_ps(ptr); }
+  static ALWAYSINLINE void storeSSE(float* ptr, __m128 value) { _mm_storeu_ps(ptr, value); }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 loadAVX(const float* ptr) { return _mm256_loadu_ps(ptr); }
+  static ALWAYSINLINE void storeAVX(float* ptr, __m256 value) { _mm256_storeu_ps(ptr, value); }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 loadAVX512(const float* ptr) { return _mm512_loadu_ps(ptr); }
+  static ALWAYSINLINE void storeAVX512(float* ptr, __m512 value) { _mm512_storeu_ps(ptr, value); }
+#endif
+};
+
+template<>
+struct PixelTraits<Half>
+{
+  static constexpr PixelFormat format = PixelFormat::float16;
+  static ALWAYSINLINE float load(const Half* ptr) { return ptr->toFloat(); }
+  static ALWAYSINLINE void store(Half* ptr, float value) { *ptr = Half::fromFloat(value); }
+  static ALWAYSINLINE __m128i broadcast(Half value) { return _mm_set1_epi16(static_cast<short>(value.bits)); }
+  static ALWAYSINLINE __m128i reverse(__m128i pixels) { return _mm_shufflehi_epi16(_mm_shufflelo_epi16(_mm_shuffle_epi32(pixels, 0x1b), 0xb1), 0xb1); }
+  // F16C is not part of SSE4.1, so the SSE variants convert each pixel on its own.
+#ifdef HAS_SSE4
+  static ALWAYSINLINE __m128 loadSSE(const Half* ptr) { return _mm_setr_ps(ptr[0].toFloat(), ptr[1].toFloat(), ptr[2].toFloat(), ptr[3].toFloat()); }
+  static ALWAYSINLINE void storeSSE(Half* ptr, __m128 value)
+  {
+    alignas(16) float values[4];
+    _mm_store_ps(values, value);
+    for(unsigned int i = 0; i < 4; i++)
+      ptr[i] = Half::fromFloat(values[i]);
+  }
+#endif
+#ifdef HAS_AVX2
+  static ALWAYSINLINE __m256 loadAVX(const Half* ptr) { return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr))); }
+  static ALWAYSINLINE void storeAVX(Half* ptr, __m256 value) { _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), _mm256_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT)); }
+#endif
+#ifdef HAS_AVX512
+  static ALWAYSINLINE __m512 loadAVX512(const Half* ptr) { return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr))); }
+  static ALWAYSINLINE void storeAVX512(Half* ptr, __m512 value) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr), _mm512_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT)); }
+#endif
+};
@@ -13,7 +13,43 @@
 
 #define ALWAYSINLINE __forceinline
 #else
+// GCC 12 warns about the deliberately undefined pass-through operands in its own AVX-512 intrinsics (GCC bug 105593).
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ == 12
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 #include <x86intrin.h>
+#pragma GCC diagnostic pop
+#else
+#include <x86intrin.h>
+#endif
 
 #define ALWAYSINLINE inline __attribute__((always_inline))
 #endif
+
+// The kernels of an instruction set are only compiled if the file targets it (see KernelsSSE4.cpp etc.).
+#if defined(__SSE4_1__) || defined(_MSC_VER)
+#define HAS_SSE4
+#endif
+
+#ifdef __AVX2__
+#define HAS_AVX2
+#endif
+
+// The AVX-512 code paths need the byte and word instructions (BW) on 128- and 256-bit vectors (VL) as well.
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VL__)
+#define HAS_AVX512
+#endif
+
+// Helpers that are compiled once per instruction set are declared in an inline namespace that is named after it. Otherwise,
+// the copies in the different files would be the same inline functions and the linker would keep an arbitrary one of them
+// (possibly with instructions that the CPU does not support). Members of classes that are shared between the files must either
+// be ALWAYSINLINE or get the instruction set as template arguments.
+#if defined(HAS_AVX512)
+#define SIMD_NAMESPACE simdAVX512
+#elif defined(HAS_AVX2)
+#define SIMD_NAMESPACE simdAVX2
+#elif defined(HAS_SSE4)
+#define SIMD_NAMESPACE simdSSE4
+#else
+#define SIMD_NAMESPACE simdBaseline
+#endif
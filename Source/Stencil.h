@@ -0,0 +1,373 @@
+/**
+ * @file Stencil.h
+ *
+ * This file declares the Stencil class, which generates the scalar and vectorized kernels of integer stencils.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "ConstantDivision.h"
+#include "SIMD.h"
+
+inline namespace SIMD_NAMESPACE
+{
+
+/**
+ * @brief This struct wraps the 8- and 16-bit integer instructions of an instruction set that the stencils need.
+ *
+ * The pixels are widened to 16 bits in two halves that are packed again in the same order, because unpack and pack
+ * both work per 128-bit lane.
+ * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+ * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+ */
+template<bool avx, bool avx512>
+struct StencilVector;
+
+#ifdef HAS_SSE4
+template<>
+struct StencilVector<false, false>
+{
+  using Type = __m128i;
+  static constexpr unsigned int size = 16;
+
+  static ALWAYSINLINE Type load(const std::uint8_t* p) { return _mm_load_si128(reinterpret_cast<const __m128i*>(p)); }
+  static ALWAYSINLINE Type loadu(const std::uint8_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+  static ALWAYSINLINE Type zero() { return _mm_setzero_si128(); }
+  static ALWAYSINLINE Type set1(std::uint16_t value) { return _mm_set1_epi16(value); }
+  static ALWAYSINLINE Type widenLow(Type a) { return _mm_unpacklo_epi8(a, _mm_setzero_si128()); }
+  static ALWAYSINLINE Type widenHigh(Type a) { return _mm_unpackhi_epi8(a, _mm_setzero_si128()); }
+  static ALWAYSINLINE Type add(Type a, Type b) { return _mm_add_epi16(a, b); }
+  static ALWAYSINLINE Type mul(Type a, Type b) { return _mm_mullo_epi16(a, b); }
+  static ALWAYSINLINE Type sub(Type a, Type b) { return _mm_sub_epi16(a, b); }
+  static ALWAYSINLINE Type mulhi(Type a, Type b) { return _mm_mulhi_epu16(a, b); }
+  static ALWAYSINLINE Type min(Type a, Type b) { return _mm_min_epu16(a, b); }
+  template<unsigned int count>
+  static ALWAYSINLINE Type shiftRight(Type a) { return _mm_srli_epi16(a, count); }
+  static ALWAYSINLINE Type narrow(Type low, Type high) { return _mm_packus_epi16(low, high); }
+  // The whole vector is written, which may overwrite the padding (and the halo) after the row.
+  template<bool streaming>
+  static ALWAYSINLINE void store(std::uint8_t* p, Type a, unsigned int)
+  {
+    if(streaming)
+      _mm_stream_si128(reinterpret_cast<__m128i*>(p), a);
+    else
+      _mm_store_si128(reinterpret_cast<__m128i*>(p), a);
+  }
+};
+#endif
+
+#ifdef HAS_AVX2
+template<>
+struct StencilVector<true, false>
+{
+  using Type = __m256i;
+  static constexpr unsigned int size = 32;
+
+  static ALWAYSINLINE Type load(const std::uint8_t* p) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(p)); }
+  static ALWAYSINLINE Type loadu(const std::uint8_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+  static ALWAYSINLINE Type zero() { return _mm256_setzero_si256(); }
+  static ALWAYSINLINE Type set1(std::uint16_t value) { return _mm256_set1_epi16(value); }
+  static ALWAYSINLINE Type widenLow(Type a) { return _mm256_unpacklo_epi8(a, _mm256_setzero_si256()); }
+  static ALWAYSINLINE Type widenHigh(Type a) { return _mm256_unpackhi_epi8(a, _mm256_setzero_si256()); }
+  static ALWAYSINLINE Type add(Type a, Type b) { return _mm256_add_epi16(a, b); }
+  static ALWAYSINLINE Type mul(Type a, Type b) { return _mm256_mullo_epi16(a, b); }
+  static ALWAYSINLINE Type sub(Type a, Type b) { return _mm256_sub_epi16(a, b); }
+  static ALWAYSINLINE Type mulhi(Type a, Type b) { return _mm256_mulhi_epu16(a, b); }
+  static ALWAYSINLINE Type min(Type a, Type b) { return _mm256_min_epu16(a, b); }
+  template<unsigned int count>
+  static ALWAYSINLINE Type shiftRight(Type a) { return _mm256_srli_epi16(a, count); }
+  static ALWAYSINLINE Type narrow(Type low, Type high) { return _mm256_packus_epi16(low, high); }
+  // The whole vector is written, which may overwrite the padding (and the halo) after the row.
+  template<bool streaming>
+  static ALWAYSINLINE void store(std::uint8_t* p, Type a, unsigned int)
+  {
+    if(streaming)
+      _mm256_stream_si256(reinterpret_cast<__m256i*>(p), a);
+    else
+      _mm256_store_si256(reinterpret_cast<__m256i*>(p), a);
+  }
+};
+#endif
+
+#ifdef HAS_AVX512
+template<>
+struct StencilVector<true, true>
+{
+  using Type = __m512i;
+  static constexpr unsigned int size = 64;
+
+  static ALWAYSINLINE Type load(const std::uint8_t* p) { return _mm512_load_si512(p); }
+  static ALWAYSINLINE Type loadu(const std::uint8_t* p) { return _mm512_loadu_si512(p); }
+  static ALWAYSINLINE Type zero() { return _mm512_setzero_si512(); }
+  static ALWAYSINLINE Type set1(std::uint16_t value) { return _mm512_set1_epi16(value); }
+  static ALWAYSINLINE Type widenLow(Type a) { return _mm512_unpacklo_epi8(a, _mm512_setzero_si512()); }
+  static ALWAYSINLINE Type widenHigh(Type a) { return _mm512_unpackhi_epi8(a, _mm512_setzero_si512()); }
+  static ALWAYSINLINE Type add(Type a, Type b) { return _mm512_add_epi16(a, b); }
+  static ALWAYSINLINE Type mul(Type a, Type b) { return _mm512_mullo_epi16(a, b); }
+  static ALWAYSINLINE Type sub(Type a, Type b) { return _mm512_sub_epi16(a, b); }
+  static ALWAYSINLINE Type mulhi(Type a, Type b) { return _mm512_mulhi_epu16(a, b); }
+  static ALWAYSINLINE Type min(Type a, Type b) { return _mm512_min_epu16(a, b); }
+  template<unsigned int count>
+  static ALWAYSINLINE Type shiftRight(Type a) { return _mm512_srli_epi16(a, count); }
+  static ALWAYSINLINE Type narrow(Type low, Type high) { return _mm512_packus_epi16(low, high); }
+  // The last vector of a row is masked so that it does not write into the halo.
+  template<bool streaming>
+  static ALWAYSINLINE void store(std::uint8_t* p, Type a, unsigned int remaining)
+  {
+    if(remaining >= size && streaming)
+      _mm512_stream_si512(reinterpret_cast<__m512i*>(p), a);
+    else if(remaining >= size)
+      _mm512_store_si512(p, a);
+    else
+      _mm512_mask_storeu_epi8(p, _bzhi_u64(~0ull, remaining), a);
+  }
+};
+#endif
+
+/**
+ * @brief Calculates the side length of a square footprint.
+ * @param size The number of weights of the footprint.
+ * @param diameter The smallest side length that is considered.
+ * @return The smallest side length whose square is at least the number of weights.
+ */
+constexpr unsigned int stencilDiameter(unsigned int size, unsigned int diameter = 1)
+{
+  return diameter * diameter >= size ? diameter : stencilDiameter(size, diameter + 1);
+}
+
+/**
+ * @brief This class generates the kernels of a stencil that divides a weighted sum of the neighborhood of each pixel by a constant.
+ *
+ * The weights are known at compile time, so the kernels only load, widen and multiply the pixels with non-zero weights
+ * and skip the multiplication for weights of one. The sums are accumulated in 16 bits and divided exactly
+ * (see ConstantDivision), so all instruction sets compute the same results.
+ * @tparam divisor The constant that the weighted sum is divided by.
+ * @tparam weights The weights of a square footprint with an odd side length, row by row.
+ */
+template<unsigned int divisor, unsigned int... weights>
+class Stencil final
+{
+public:
+  static constexpr unsigned int size = sizeof...(weights);                    ///< The number of weights.
+  static constexpr unsigned int diameter = stencilDiameter(sizeof...(weights)); ///< The side length of the footprint.
+  static constexpr unsigned int radius = diameter / 2;                        ///< The number of rows and columns on each side of the pixel.
+
+  /**
+   * @brief Computes a row of the stencil.
+   * @tparam simd Whether SIMD instructions should be used.
+   * @tparam avx Whether AVX instructions should be used (instead of SSE instructions).
+   * @tparam avx512 Whether AVX-512 instructions should be used (instead of AVX2 instructions).
+   * @tparam streaming Whether the result is written with non-temporal stores (because it is not read again soon).
+   * @param rows The diameter rows around the row that is computed (aligned, with radius pixels of halo on either side).
+   *             The vectorized kernels read up to radius pixels past the padding of the rows.
+   * @param dstRow The computed row (aligned, the vectorized kernels may overwrite the pixels after it).
+   * @param width The number of pixels in a row.
+   */
+  template<bool simd, bool avx, bool avx512, bool streaming>
+  static void apply(const std::uint8_t* const* rows, std::uint8_t* dstRow, unsigned int width);
+private:
+  /**
+   * @brief Returns a weight of the footprint.
+   * @param index The index of the weight (row by row).
+   * @return The weight.
+   */
+  static constexpr unsigned int weight(std::size_t index)
+  {
+    constexpr unsigned int footprint[] = {weights...};
+    return footprint[index];
+  }
+  /**
+   * @brief Calculates the largest weighted sum of a neighborhood.
+   * @return The weighted sum of a neighborhood in which all pixels are 255.
+   */
+  static constexpr unsigned int maxSum()
+  {
+    unsigned int sum = 0;
+    for(std::size_t i = 0; i < size; i++)
+      sum += 255 * weight(i);
+    return sum;
+  }
+
+  /**
+   * @brief Computes the vectorized kernel.
+   * @tparam Vector The instruction set (a StencilVector).
+   * @tparam streaming Whether the result is written with non-temporal stores.
+   * @tparam indices The indices of all weights.
+   * @param rows The rows around the row that is computed.
+   * @param dstRow The computed row.
+   * @param width The number of pixels in a row.
+   */
+  template<typename Vector, bool streaming, std::size_t... indices>
+  static void applyVector(const std::uint8_t* const* rows, std::uint8_t* dstRow, unsigned int width, std::index_sequence<indices...>);
+  /**
+   * @brief Adds a weighted pixel vector to the sums of a vector of pixels.
+   * @tparam Vector The instruction set (a StencilVector).
+   * @tparam index The index of the weight.
+   * @param rows The rows around the row that is computed.
+   * @param x The first pixel of the vector.
+   * @param low The sums of the lower half of the pixels.
+   * @param high The sums of the upper half of the pixels.
+   */
+  template<typename Vector, std::size_t index>
+  static ALWAYSINLINE void accumulate(const std::uint8_t* const* rows, unsigned int x, typename Vector::Type& low, typename Vector::Type& high);
+  /**
+   * @brief Divides the sums exactly by the divisor.
+   * @tparam Vector The instruction set (a StencilVector).
+   * @param sums The weighted sums.
+   * @return The quotients (the packing saturates them to the results of the scalar kernel).
+   */
+  template<typename Vector>
+  static ALWAYSINLINE typename Vector::Type divide(typename Vector::Type sums);
+  /**
+   * @brief Computes the scalar kernel.
+   * @tparam indices The indices of all weights.
+   * @param rows The rows around the row that is computed.
+   * @param dstRow The computed row.
+   * @param width The number of pixels in a row.
+   */
+  template<std::size_t... indices>
+  static void applyScalar(const std::uint8_t* const* rows, std::uint8_t* dstRow, unsigned int width, std::index_sequence<indices...>);
+  /**
+   * @brief Returns a weighted pixel.
+   * @tparam index The index of the weight.
+   * @param taps The rows around the row that is computed, shifted by the column of each weight.
+   * @param x The pixel.
+   * @return The pixel multiplied by the weight.
+   */
+  template<std::size_t index>
+  static ALWAYSINLINE unsigned int term(const std::uint8_t* const* taps, unsigned int x)
+  {
+    return weight(index) == 0 ? 0 : weight(index) * taps[index][x];
+  }
+};
+
+template<unsigned int divisor, unsigned int... weights>
+constexpr unsigned int Stencil<divisor, weights...>::size;
+
+template<unsigned int divisor, unsigned int... weights>
+constexpr unsigned int Stencil<divisor, weights...>::diameter;
+
+template<unsigned int divisor, unsigned int... weights>
+constexpr unsigned int Stencil<divisor, weights...>::radius;
+
+template<unsigned int divisor, unsigned int... weights>
+template<bool simd, bool avx, bool avx512, bool streaming>
+void Stencil<divisor, weights...>::apply(const std::uint8_t* const* rows, std::uint8_t* dstRow, unsigned int width)
+{
+  static_assert(diameter * diameter == size && diameter % 2 == 1, "The footprint of a stencil must be a square with an odd side length!");
+  static_assert(divisor > 0, "The divisor of a stencil must not be zero!");
+  static_assert(maxSum() <= 0xffff, "The weighted sums of a stencil must fit into 16 bits!");
+
+  if(simd)
+  {
+    if(avx512)
+    {
+#ifdef HAS_AVX512
+      applyVector<StencilVector<true, true>, streaming>(rows, dstRow, width, std::make_index_sequence<size>());
+#endif
+    }
+    else if(avx)
+    {
+#ifdef HAS_AVX2
+      applyVector<StencilVector<true, false>, streaming>(rows, dstRow, width, std::make_index_sequence<size>());
+#endif
+    }
+    else
+    {
+#ifdef HAS_SSE4
+      applyVector<StencilVector<false, false>, streaming>(rows, dstRow, width, std::make_index_sequence<size>());
+#endif
+    }
+  }
+  else
+    applyScalar(rows, dstRow, width, std::make_index_sequence<size>());
+}
+
+template<unsigned int divisor, unsigned int... weights>
+template<typename Vector, bool streaming, std::size_t... indices>
+void Stencil<divisor, weights...>::applyVector(const std::uint8_t* const* rows, std::uint8_t* dstRow, unsigned int width, std::index_sequence<indices...>)
+{
+  // The last vector may exceed the width, which only affects the padding (and the halo) of the result.
+  for(unsigned int x = 0; x < width; x += Vector::size)
+  {
+    typename Vector::Type low = Vector::zero();
+    typename Vector::Type high = Vector::zero();
+    const int expand[] = {(accumulate<Vector, indices>(rows, x, low, high), 0)...};
+    static_cast<void>(expand);
+
+    Vector::template store<streaming>(dstRow + x, Vector::narrow(divide<Vector>(low), divide<Vector>(high)), width - x);
+  }
+}
+
+template<unsigned int divisor, unsigned int... weights>
+template<typename Vector, std::size_t index>
+void Stencil<divisor, weights...>::accumulate(const std::uint8_t* const* rows, unsigned int x, typename Vector::Type& low, typename Vector::Type& high)
+{
+  constexpr unsigned int w = weight(index);
+  constexpr std::ptrdiff_t dx = static_cast<std::ptrdiff_t>(index % diameter) - radius;
+  if(w == 0)
+    return;
+
+  // Only the pixels in the column of the center are aligned.
+  const std::uint8_t* p = rows[index / diameter] + x + dx;
+  const typename Vector::Type pixels = dx == 0 ? Vector::load(p) : Vector::loadu(p);
+  if(w == 1)
+  {
+    low = Vector::add(low, Vector::widenLow(pixels));
+    high = Vector::add(high, Vector::widenHigh(pixels));
+  }
+  else
+  {
+    low = Vector::add(low, Vector::mul(Vector::widenLow(pixels), Vector::set1(w)));
+    high = Vector::add(high, Vector::mul(Vector::widenHigh(pixels), Vector::set1(w)));
+  }
+}
+
+template<unsigned int divisor, unsigned int... weights>
+template<typename Vector>
+typename Vector::Type Stencil<divisor, weights...>::divide(typename Vector::Type sums)
+{
+  using Division = ConstantDivision<divisor, maxSum()>;
+  typename Vector::Type quotients;
+  if(Division::powerOfTwo)
+    quotients = Vector::template shiftRight<Division::shift>(sums);
+  else
+  {
+    const typename Vector::Type product = Vector::mulhi(sums, Vector::set1(Division::multiplier));
+    if(Division::add)
+      quotients = Vector::template shiftRight<Division::add ? Division::shift - 1 : 0>(Vector::add(Vector::template shiftRight<1>(Vector::sub(sums, product)), product));
+    else
+      quotients = Vector::template shiftRight<Division::shift>(product);
+  }
+
+  // The packing saturates signed 16-bit integers, so quotients from 0x8000 on would become 0 instead of 255.
+  if(maxSum() / divisor > 0x7fff)
+    quotients = Vector::min(quotients, Vector::set1(255));
+  return quotients;
+}
+
+template<unsigned int divisor, unsigned int... weights>
+template<std::size_t... indices>
+void Stencil<divisor, weights...>::applyScalar(const std::uint8_t* const* rows, std::uint8_t* dstRow, unsigned int width, std::index_sequence<indices...>)
+{
+  // The pointers are local, so that the compiler knows that the result does not overwrite them.
+  const std::uint8_t* const taps[] = {(rows[indices / diameter] + static_cast<std::ptrdiff_t>(indices % diameter) - radius)...};
+
+  for(unsigned int x = 0; x < width; x++)
+  {
+    unsigned int sum = 0;
+    const int expand[] = {(sum += term<indices>(taps, x), 0)...};
+    static_cast<void>(expand);
+    // The vectorized kernels saturate like this when they pack the sums.
+    dstRow[x] = static_cast<std::uint8_t>(std::min(sum / divisor, 255u));
+  }
+}
+
+}
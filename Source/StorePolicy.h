@@ -0,0 +1,20 @@
+/**
+ * @file StorePolicy.h
+ *
+ * This file declares the StorePolicy enum.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+/**
+ * @brief This enum enumerates the ways in which the vectorized kernels write their results.
+ */
+enum class StorePolicy
+{
+  regular,           ///< The results are written through the caches, so that they can be read again soon.
+  streaming,         ///< The results are written with non-temporal stores that bypass the caches.
+  automatic,         ///< Streaming stores are used if the working set does not fit into the share of the last level cache of the threads (see CPUFeatures).
+  numOfStorePolicies ///< The number of store policies.
+};
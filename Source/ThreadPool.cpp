@@ -0,0 +1,174 @@
+/**
+ * @file ThreadPool.cpp
+ *
+ * This file implements the ThreadPool class.
+ *
+ * @author Arne Hasselbring
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.h"
+
+namespace
+{
+  /**
+   * @brief This class contains the state that is shared between the caller of ThreadPool::run and the workers.
+   */
+  class Workers
+  {
+  public:
+    /**
+     * @brief Stops and joins all workers.
+     */
+    ~Workers()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      start.notify_all();
+      for(std::thread& thread : threads)
+        thread.join();
+    }
+    /**
+     * @brief Executes the tasks of a job (on the caller and the workers).
+     * @param tasks The number of tasks.
+     * @param task The function that is called with the index of each task.
+     */
+    void run(unsigned int tasks, const std::function<void(unsigned int)>& task)
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while(threads.size() + 1 < tasks)
+        threads.emplace_back(&Workers::work, this);
+      job = &task;
+      numOfTasks = tasks;
+      nextTask = 0;
+      unfinishedTasks = tasks;
+      error = nullptr;
+      generation++;
+      lock.unlock();
+      start.notify_all();
+
+      execute(&task, tasks);
+
+      lock.lock();
+      // Workers that have not joined the job until now must not join it anymore, because the task is about to vanish.
+      finished.wait(lock, [this] { return unfinishedTasks == 0 && activeWorkers == 0; });
+      job = nullptr;
+      if(error)
+        std::rethrow_exception(error);
+    }
+
+    std::mutex busy; ///< Is locked while a job is executed.
+  private:
+    /**
+     * @brief The main loop of a worker.
+     */
+    void work()
+    {
+      insideTask = true;
+      unsigned int lastGeneration = 0;
+      std::unique_lock<std::mutex> lock(mutex);
+      while(true)
+      {
+        start.wait(lock, [&] { return stop || generation != lastGeneration; });
+        if(stop)
+          return;
+        lastGeneration = generation;
+        if(job == nullptr)
+          continue;
+        const std::function<void(unsigned int)>* task = job;
+        const unsigned int tasks = numOfTasks;
+        activeWorkers++;
+        lock.unlock();
+        execute(task, tasks);
+        lock.lock();
+        if(--activeWorkers == 0)
+          finished.notify_all();
+      }
+    }
+    /**
+     * @brief Takes tasks of the current job until all of them have been started.
+     * @param task The function of the job.
+     * @param tasks The number of tasks of the job.
+     */
+    void execute(const std::function<void(unsigned int)>* task, unsigned int tasks)
+    {
+      unsigned int index;
+      while((index = nextTask++) < tasks)
+      {
+        try
+        {
+          (*task)(index);
+        }
+        catch(...)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if(!error)
+            error = std::current_exception();
+        }
+        if(--unfinishedTasks == 0)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          finished.notify_all();
+        }
+      }
+    }
+
+    std::mutex mutex;                                       ///< Protects the job description.
+    std::condition_variable start;                          ///< Is notified when a job is started (or the workers are stopped).
+    std::condition_variable finished;                       ///< Is notified when the last task of a job is finished.
+    std::vector<std::thread> threads;                       ///< The worker threads.
+    const std::function<void(unsigned int)>* job = nullptr; ///< The function of the current job.
+    unsigned int numOfTasks = 0;                            ///< The number of tasks of the current job.
+    std::atomic<unsigned int> nextTask{0};                  ///< The index of the next task that is started.
+    std::atomic<unsigned int> unfinishedTasks{0};           ///< The number of tasks that have not finished yet.
+    std::exception_ptr error;                               ///< The first exception that has been thrown by a task.
+    unsigned int activeWorkers = 0;                         ///< The number of workers that have joined the current job.
+    unsigned int generation = 0;                            ///< Is incremented for each job so that workers see new jobs.
+    bool stop = false;                                      ///< Whether the workers should exit.
+  public:
+    static thread_local bool insideTask;                    ///< Whether the current thread is executing a task.
+  };
+
+  thread_local bool Workers::insideTask = false;
+
+  Workers workers;
+}
+
+void ThreadPool::run(unsigned int tasks, const std::function<void(unsigned int)>& task)
+{
+  if(tasks == 0)
+    return;
+  // Nested and concurrent jobs would wait for workers that are busy, so they are executed sequentially.
+  if(tasks == 1 || Workers::insideTask || !workers.busy.try_lock())
+  {
+    for(unsigned int i = 0; i < tasks; i++)
+      task(i);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(workers.busy, std::adopt_lock);
+  Workers::insideTask = true;
+  try
+  {
+    workers.run(tasks, task);
+  }
+  catch(...)
+  {
+    Workers::insideTask = false;
+    throw;
+  }
+  Workers::insideTask = false;
+}
+
+unsigned int ThreadPool::getHardwareThreads()
+{
+  const unsigned int threads = std::thread::hardware_concurrency();
+  return threads > 0 ? threads : 1;
+}
@@ -0,0 +1,36 @@
+/**
+ * @file ThreadPool.h
+ *
+ * This file declares the ThreadPool class.
+ *
+ * @author Arne Hasselbring
+ */
+
+#pragma once
+
+#include <functional>
+
+/**
+ * @brief This class distributes independent tasks over a set of persistent worker threads.
+ *
+ * The workers are started when they are needed for the first time and are kept until the program exits,
+ * so a parallel loop does not pay for creating threads. The calling thread works on the tasks as well.
+ */
+class ThreadPool
+{
+public:
+  /**
+   * @brief Executes a number of tasks in parallel and waits until all of them are finished.
+   *
+   * Calls from inside a task and concurrent calls from another thread execute the tasks on the calling thread.
+   * If a task throws, the first exception is rethrown after all tasks have finished.
+   * @param tasks The number of tasks (one thread is used per task).
+   * @param task The function that is called with the index of each task.
+   */
+  static void run(unsigned int tasks, const std::function<void(unsigned int)>& task);
+  /**
+   * @brief Returns the number of threads that the hardware can execute concurrently.
+   * @return The number of hardware threads (at least 1).
+   */
+  static unsigned int getHardwareThreads();
+};